@@ -65,18 +65,27 @@ extern int          worker_processes;    // 多进程下workers数目
 extern string       log_path;
 extern int          log_level;
 
-extern int worker_connections;  // 并发连接数
+extern int worker_connections;  // 并发连接数上限
+extern int connection_chunk;    // 连接池每次增长的连接数
 extern int epoll_events;        // 一次循环处理事件数
 
-extern int listen_on;           // 端口号
-extern int request_timeout;     // 请求超时的上限
-extern int upstream_timeout;    // 请求上游响应超时
-extern int keep_alive_requests;    // 每个连接最多处理多少个请求
 extern int accept_defer;
+extern int sendfile_max_chunk;  // 单次sendfile最多发送字节数, 0不限制
+extern int write_budget;        // 每个连接每轮事件循环最多写出字节数, 0不限制
+extern int tcp_notsent_lowat;   // TCP_NOTSENT_LOWAT, 0不设置
+extern int aio_threads;         // 读入不在内存中的文件的线程数, 0不用
+extern int open_file_cache;         // 每个worker缓存的打开文件数, 0不缓存
+extern int open_file_cache_valid;   // 缓存项有效毫秒数
+extern int open_file_cache_events;  // 用inotify使修改过的文件失效
+extern int open_file_cache_mem;     // 小文件连同响应头缓存在内存中的字节数, 0不缓存
+extern int open_file_cache_mem_max; // 缓存在内存中的文件大小上限
+extern int gzip_comp_level;         // 压缩级别, worker忙时自动降低
+extern int gzip_min_length;         // 短于此的响应不压缩
+extern array *gzip_types;           // string, 压缩的Content-Type, text/html总是压缩
 
 extern const char *index_name;         // 索引文件名称
 extern const char *root;               // 根目录
 
-extern array       *locations;
+extern array       *servers;    // server, 端口和超时见server.h
 
 #endif //FANCY_BASE_H
@@ -164,10 +164,10 @@ ssize_t buffer_read_fd(buffer *b, int fd, int *saved_errno)
     return n;
 }
 
-ssize_t buffer_write_fd(buffer *b, int fd, int *saved_errno)
+ssize_t buffer_write_fd(buffer *b, int fd, size_t max, int *saved_errno)
 {
     size_t  readable = buffer_readable_bytes(b);
-    ssize_t n = write(fd, buffer_peek(b), readable);
+    ssize_t n = write(fd, buffer_peek(b), readable < max ? readable : max);
     if (n == -1) {
         *saved_errno = errno;
     }
@@ -188,7 +188,7 @@ static void buffer_make_space(buffer *b, size_t len)
                 array_at(b->data, b->read_index),
                 readable);
         b->read_index = 0;
-        b->read_index = readable;
+        b->write_index = readable;
         assert(readable == buffer_readable_bytes(b));
     }
 }
\ No newline at end of file
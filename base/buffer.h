@@ -39,7 +39,7 @@ void buffer_has_writen(buffer *b, size_t len);
 void buffer_unwrite(buffer *b, size_t len);
 size_t buffer_internal_capacity(buffer *b);
 ssize_t buffer_read_fd(buffer *b, int fd, int *saved_errno);
-ssize_t buffer_write_fd(buffer *b, int fd, int *saved_errno);
+ssize_t buffer_write_fd(buffer *b, int fd, size_t max, int *saved_errno);
 
 #define buffer_append_space(b) \
 buffer_append(b, " ", 1)
@@ -31,6 +31,14 @@ list_node *list_head(list *h)
     return h->next;
 }
 
+list_node *list_tail(list *h)
+{
+    if (h->prev == h) {
+        return NULL;
+    }
+    return h->prev;
+}
+
 void list_remove(list_node *x)
 {
     x->prev->next = x->next;
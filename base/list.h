@@ -20,6 +20,7 @@ void list_init(list *h);
 int list_empty(list *h);
 void list_insert_head(list *h, list_node *x);
 list_node *list_head(list *h);
+list_node *list_tail(list *h);
 void list_remove(list_node *x);
 
 #endif //FANCY_LIST_H
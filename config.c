@@ -6,6 +6,7 @@
 #include "config.h"
 #include "palloc.h"
 #include "request.h"
+#include "server.h"
 #include "log.h"
 
 static mem_pool *pool;
@@ -17,6 +18,7 @@ static const char *config_location(const char *s, void *);
 
 static const char *config_bool(const char *s, void *d);
 static const char *config_num_positive(const char *s, void *d);
+static const char *config_size(const char *s, void *d);
 static const char *config_log_path(const char *s, void *d);
 
 static const char *config_str_semicolons(const char *s, void *d);
@@ -26,6 +28,16 @@ static const char *config_log_level(const char *s, void *d);
 static const char *config_proxy_pass(const char *s, void *d);
 static const char *config_root(const char *s, void *d);
 static const char *config_index(const char *s, void *d);
+static const char *config_status(const char *s, void *d);
+static const char *config_warmup(const char *s, void *d);
+static const char *config_gzip_static(const char *s, void *d);
+static const char *config_gzip(const char *s, void *d);
+static const char *config_return(const char *s, void *d);
+static const char *config_limit_rate_after(const char *s, void *d);
+static const char *config_limit_rate(const char *s, void *d);
+static const char *config_gzip_comp_level(const char *s, void *d);
+static const char *config_gzip_types(const char *s, void *d);
+static const char *config_server_name(const char *s, void *d);
 
 static const char *config_comment(const char *s, void *d);
 static void config_error(const char *expect, const char *see);
@@ -51,17 +63,39 @@ string     log_path = null_str;
 
 /* events conf */
 int worker_connections  = -1;
+int connection_chunk    = 256;
 int epoll_events        = -1;
 
-/* server conf */
-int listen_on           = -1;
-int request_timeout     = -1;
-int upstream_timeout    = -1;
-int keep_alive_requests = -1;
+/* server conf, the same for all servers */
 int accept_defer        = -1;
+int sendfile_max_chunk  = 0;
+int write_budget        = 0;
+int tcp_notsent_lowat   = 0;
+int aio_threads         = 0;
+int open_file_cache         = 0;
+int open_file_cache_valid   = 60000;
+int open_file_cache_events  = 0;
+int open_file_cache_mem     = 0;
+int open_file_cache_mem_max = 16 * 1024;
+int gzip_comp_level         = 6;
+int gzip_min_length         = 256;
+array *gzip_types;
+
+/* server conf, each server {} block has its own */
+array    *servers;
+
+static const server server_default = {
+        .listen_on              = -1,
+        .request_timeout        = 60000,
+        .upstream_timeout       = 60000,
+        .keep_alive_requests    = 1000,
+        .keepalive_timeout      = 60000,
+        .client_max_body_size   = 1024 * 1024,
+        .http2                  = 0,
+};
 
-/*location conf*/
-array    *locations;
+/* the server {} block being read */
+static server conf_srv;
 
 static conf_block conf_main_block[] = {
         {string("daemonize"), config_bool, &daemonize},
@@ -77,17 +111,34 @@ static conf_block conf_main_block[] = {
 
 static conf_block conf_events_block[] = {
         {string("worker_connections"), config_num_positive, &worker_connections},
+        {string("connection_chunk"), config_num_positive, &connection_chunk},
         {string("epoll_events"), config_num_positive, &epoll_events},
         {string("#"), config_comment, NULL},
         {null_str, NULL, NULL},
 };
 
 static conf_block conf_server_block[] = {
-        {string("listen_on"), config_num_positive, &listen_on},
-        {string("request_timeout"), config_num_positive, &request_timeout},
-        {string("upstream_timeout"), config_num_positive, &upstream_timeout},
-        {string("keep_alive_requests"), config_num_positive, &keep_alive_requests},
+        {string("listen_on"), config_num_positive, &conf_srv.listen_on},
+        {string("server_name"), config_server_name, &conf_srv},
+        {string("request_timeout"), config_num_positive, &conf_srv.request_timeout},
+        {string("upstream_timeout"), config_num_positive, &conf_srv.upstream_timeout},
+        {string("keep_alive_requests"), config_num_positive, &conf_srv.keep_alive_requests},
+        {string("keepalive_timeout"), config_num_positive, &conf_srv.keepalive_timeout},
+        {string("client_max_body_size"), config_size, &conf_srv.client_max_body_size},
+        {string("http2"), config_bool, &conf_srv.http2},
         {string("accept_defer"), config_num_positive, &accept_defer},
+        {string("sendfile_max_chunk"), config_size, &sendfile_max_chunk},
+        {string("write_budget"), config_size, &write_budget},
+        {string("tcp_notsent_lowat"), config_size, &tcp_notsent_lowat},
+        {string("aio_threads"), config_num_positive, &aio_threads},
+        {string("open_file_cache_valid"), config_num_positive, &open_file_cache_valid},
+        {string("open_file_cache_events"), config_bool, &open_file_cache_events},
+        {string("open_file_cache_mem_max"), config_size, &open_file_cache_mem_max},
+        {string("open_file_cache_mem"), config_size, &open_file_cache_mem},
+        {string("open_file_cache"), config_size, &open_file_cache},
+        {string("gzip_comp_level"), config_gzip_comp_level, &gzip_comp_level},
+        {string("gzip_min_length"), config_size, &gzip_min_length},
+        {string("gzip_types"), config_gzip_types, NULL},
         {string("location"), config_location, NULL},
         {string("#"), config_comment, NULL},
         {null_str, NULL, NULL},
@@ -97,14 +148,22 @@ static conf_block conf_location_block[] = {
         {string("root"), config_root, NULL},
         {string("index"), config_index, NULL},
         {string("proxy_pass"), config_proxy_pass, NULL},
+        {string("status"), config_status, NULL},
+        {string("warmup"), config_warmup, NULL},
+        {string("gzip_static"), config_gzip_static, NULL},
+        {string("gzip"), config_gzip, NULL},
+        {string("return"), config_return, NULL},
+        {string("limit_rate_after"), config_limit_rate_after, NULL},
+        {string("limit_rate"), config_limit_rate, NULL},
         {string("#"), config_comment, NULL},
         {null_str, NULL, NULL},
 };
 
 void config(const char *path)
 {
-    pool = mem_pool_create(2048);
-    locations = array_create(pool, 4, sizeof(location));
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    servers = array_create(pool, 4, sizeof(server));
+    gzip_types = array_create(pool, 4, sizeof(string));
 
     struct stat sbuf;
     if (stat(path, &sbuf) == -1) {
@@ -129,6 +188,13 @@ void config(const char *path)
     CHECK(close(fd));
     config_main(file, NULL);
 
+    if (servers->size == 0) {
+        config_error("server", "nothing");
+    }
+
+    /* the arrays do not move any more */
+    server_init(servers);
+
     /*for (size_t i = 0; i < locations->size; ++i) {
         location *loc = array_at(locations, i);
         if (loc->use_proxy) {
@@ -198,7 +264,16 @@ static const char *config_server(const char *s, void *d)
 {
     (void)d;
 
-    conf_block *b = conf_server_block;
+    conf_block  *b = conf_server_block;
+    server      *srv;
+
+    conf_srv = server_default;
+    conf_srv.names = array_create(pool, 4, sizeof(string));
+    conf_srv.locations = array_create(pool, 4, sizeof(location));
+    if (conf_srv.names == NULL || conf_srv.locations == NULL) {
+        fprintf(stderr, "palloc failed");
+        exit(EXIT_FAILURE);
+    }
 
     s = expect(s, '{');
     s = first_not_space(s);
@@ -216,6 +291,18 @@ static const char *config_server(const char *s, void *d)
             exit(EXIT_FAILURE);
         }
     }
+
+    if (conf_srv.listen_on == -1) {
+        config_error("listen_on", s);
+    }
+
+    srv = array_alloc(servers);
+    if (srv == NULL) {
+        fprintf(stderr, "palloc failed");
+        exit(EXIT_FAILURE);
+    }
+    *srv = conf_srv;
+
     return expect(s, '}');
 }
 
@@ -224,9 +311,28 @@ static const char *config_location(const char *s, void *d)
     (void)d;
 
     conf_block  *b = conf_location_block;
-    location    *loc = array_alloc(locations);
+    location    *loc = array_alloc(conf_srv.locations);
+
+    if (loc == NULL) {
+        fprintf(stderr, "palloc failed");
+        exit(EXIT_FAILURE);
+    }
+    bzero(loc, sizeof(location));
+
+    /* "^~" is taken as a plain prefix, there are no regex locations */
+    s = first_not_space(s);
+    if (*s == '=') {
+        loc->exact = 1;
+        ++s;
+    }
+    else if (strncmp(s, "^~", 2) == 0) {
+        s += 2;
+    }
 
     s = config_str_brace(s, &loc->prefix);
+    if (loc->prefix.len == 0 || loc->prefix.data[0] != '/') {
+        config_error("location uri", s);
+    }
     s = expect(s, '{');
     s = first_not_space(s);
     for (; *s != '}'; s = first_not_space(s)) {
@@ -289,6 +395,44 @@ static const char *config_num_positive(const char *s, void *d)
     return expect(s, ';');
 }
 
+/* bytes, with an optional k or m suffix, 0 is allowed */
+static const char *config_size(const char *s, void *d)
+{
+    int     *size = d;
+    long    n;
+
+    s = first_not_space(s);
+    if (!isdigit(*s)) {
+        config_error("size", s);
+    }
+
+    n = atol(s);
+    while (isdigit(*s))
+        ++s;
+
+    switch (*s) {
+        case 'k':
+        case 'K':
+            n *= 1024;
+            ++s;
+            break;
+        case 'm':
+        case 'M':
+            n *= 1024 * 1024;
+            ++s;
+            break;
+        default:
+            break;
+    }
+
+    if (n > INT_MAX) {
+        config_error("size less than 2g", s);
+    }
+    *size = (int)n;
+
+    return expect(s, ';');
+}
+
 static const char *config_log_path(const char *s, void *d)
 {
     s = config_str_semicolons(s, d);
@@ -307,7 +451,7 @@ static const char *config_str_semicolons(const char *s, void *d)
         ++end;
 
     str->data = pcalloc(pool, end - s + 1);
-    strncpy(str->data, s, end - s);
+    memcpy(str->data, s, end - s);
     str->len = end - s;
     s = end;
 
@@ -326,7 +470,7 @@ static const char *config_str_brace(const char *s, void *d)
         ++end;
 
     str->data = pcalloc(pool, end - s + 1);
-    strncpy(str->data, s, end - s);
+    memcpy(str->data, s, end - s);
     str->len = end - s;
     s = end;
 
@@ -372,6 +516,9 @@ static const char *config_proxy_pass(const char *s, void *d)
     const char          *temp_s;
 
     temp_s = s = first_not_space(s);
+    if (loc->return_code != 0) {
+        config_error("return or proxy_pass", s);
+    }
 
     addr->sin_family = AF_INET;
 
@@ -456,6 +603,210 @@ static const char *config_index(const char *s, void *d)
     return expect(s, ';');
 }
 
+/* status; counters of the worker instead of files */
+static const char *config_status(const char *s, void *d)
+{
+    location    *loc = d;
+
+    if (loc->use_proxy) {
+        config_error("status or proxy_pass", s);
+    }
+    loc->status = 1;
+
+    return expect(s, ';');
+}
+
+/* warmup; files up to open_file_cache_mem_max under root are read at startup */
+static const char *config_warmup(const char *s, void *d)
+{
+    location    *loc = d;
+
+    loc->warmup = 1;
+
+    return expect(s, ';');
+}
+
+/* gzip_static on; a.css.br or a.css.gz is sent if the client takes it */
+static const char *config_gzip_static(const char *s, void *d)
+{
+    location    *loc = d;
+    int         on;
+
+    s = config_bool(s, &on);
+    loc->gzip_static = on ? 1 : 0;
+
+    return s;
+}
+
+/* gzip on; proxied responses of gzip_types are compressed */
+static const char *config_gzip(const char *s, void *d)
+{
+    location    *loc = d;
+    int         on;
+
+    s = config_bool(s, &on);
+    loc->gzip = on ? 1 : 0;
+
+    return s;
+}
+
+/* return 200 "ok"; return 301 https://example.com/; return /login;
+ * answered without root or upstream, a url alone is a 302 */
+static const char *config_return(const char *s, void *d)
+{
+    location    *loc = d;
+    string      *text = &loc->return_text;
+    const char  *end;
+    long        code = 302;
+
+    if (loc->use_proxy) {
+        config_error("return or proxy_pass", s);
+    }
+
+    s = first_not_space(s);
+    if (isdigit(*s)) {
+        code = strtol(s, (char**)&end, 10);
+        if (code < 200 || code > 599 || (!isspace(*end) && *end != ';')) {
+            config_error("return code 200-599", s);
+        }
+        s = first_not_space(end);
+    }
+
+    if (*s == '"') {
+        end = ++s;
+        while (*end != '"' && *end != '\0' && *end != '\r' && *end != '\n') {
+            ++end;
+        }
+        if (*end != '"') {
+            config_error("closing \"", s);
+        }
+        text->data = pcalloc(pool, end - s + 1);
+        memcpy(text->data, s, end - s);
+        text->len = end - s;
+        s = end + 1;
+    }
+    else if (*s != ';') {
+        s = config_str_semicolons(s, text);
+    }
+    else {
+        str_set(text, "");
+    }
+
+    if (text->len > MAX_RETURN_TEXT) {
+        config_error("return text up to 8k", s);
+    }
+    if (RETURN_REDIRECT(code) && text->len == 0) {
+        config_error("return url", s);
+    }
+
+    loc->return_code = (int)code;
+    if (request_render_return(loc, pool) == FCY_ERROR) {
+        fprintf(stderr, "palloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    return expect(s, ';');
+}
+
+/* limit_rate 100k; bytes a second to each client, 0 is no limit */
+static const char *config_limit_rate(const char *s, void *d)
+{
+    location    *loc = d;
+
+    return config_size(s, &loc->limit_rate);
+}
+
+/* limit_rate_after 1m; sent at full speed before limit_rate starts */
+static const char *config_limit_rate_after(const char *s, void *d)
+{
+    location    *loc = d;
+
+    return config_size(s, &loc->limit_rate_after);
+}
+
+static const char *config_gzip_comp_level(const char *s, void *d)
+{
+    int *level = d;
+
+    s = config_num_positive(s, level);
+    if (*level > 9) {
+        config_error("gzip_comp_level 1-9", s);
+    }
+    return s;
+}
+
+/* gzip_types application/json text/css; text/html is always there */
+static const char *config_gzip_types(const char *s, void *d)
+{
+    (void)d;
+
+    string  *type;
+
+    for (s = first_not_space(s); *s != ';' && *s != '\0'; s = first_not_space(s)) {
+        type = array_alloc(gzip_types);
+        if (type == NULL) {
+            fprintf(stderr, "palloc failed");
+            exit(EXIT_FAILURE);
+        }
+        s = config_str_semicolons(s, type);
+    }
+
+    return expect(s, ';');
+}
+
+/* server_name example.com *.example.com .example.org;
+ * ".example.org" is example.org and all of its subdomains */
+static const char *config_server_name(const char *s, void *d)
+{
+    server      *srv = d;
+    string      name, *slot;
+    int         both;
+
+    for (s = first_not_space(s); *s != ';' && *s != '\0'; s = first_not_space(s)) {
+
+        s = config_str_semicolons(s, &name);
+        for (size_t i = 0; i < name.len; ++i) {
+            name.data[i] = (char)tolower(name.data[i]);
+        }
+        if (name.len > 0 && name.data[name.len - 1] == '.') {
+            name.data[--name.len] = '\0';
+        }
+
+        both = 0;
+        if (name.len > 2 && name.data[0] == '*' && name.data[1] == '.') {
+            ++name.data;
+            --name.len;
+        }
+        else if (name.len > 1 && name.data[0] == '.') {
+            both = 1;
+        }
+
+        if (name.len == 0 || name.len > SERVER_MAX_NAME
+            || strchr(name.data, '*') != NULL || strchr(name.data, ':') != NULL) {
+            config_error("server name", name.data);
+        }
+
+        slot = array_alloc(srv->names);
+        if (slot == NULL) {
+            fprintf(stderr, "palloc failed");
+            exit(EXIT_FAILURE);
+        }
+        *slot = name;
+
+        if (both) {
+            slot = array_alloc(srv->names);
+            if (slot == NULL) {
+                fprintf(stderr, "palloc failed");
+                exit(EXIT_FAILURE);
+            }
+            slot->data = name.data + 1;
+            slot->len = name.len - 1;
+        }
+    }
+
+    return expect(s, ';');
+}
+
 static const char *config_comment(const char *s, void *d)
 {
     (void)d;
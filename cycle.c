@@ -6,6 +6,7 @@
 #include "timer.h"
 #include "Signal.h"
 #include "connection.h"
+#include "aio.h"
 #include "http.h"
 #include "request.h"
 #include "config.h"
@@ -116,8 +117,6 @@ void run_single_process()
         exit(EXIT_FAILURE);
     }
 
-    LOG_INFO("worker listening port %d", listen_on);
-
     while (1) {
         event_and_timer_process();
         if (sig_quit) {
@@ -160,14 +159,15 @@ void run_signal_process(int sig_no)
 
 static int worker_init()
 {
-    size_t size = worker_connections * sizeof (connection) + sizeof(mem_pool);
+    /* connections are allocated in chunks outside of the pool */
+    size_t size = epoll_events * sizeof(struct epoll_event) + MEM_POOL_DEFAULT_SIZE;
     pool = mem_pool_create(size);
 
     if (pool == NULL){
         return FCY_ERROR;
     }
 
-    if (conn_pool_init(pool, worker_connections) == FCY_ERROR) {
+    if (conn_pool_init(worker_connections, connection_chunk) == FCY_ERROR) {
         mem_pool_destroy(pool);
         return FCY_ERROR;
     }
@@ -179,6 +179,11 @@ static int worker_init()
 
     timer_init();
 
+    if (aio_init() == FCY_ERROR) {
+        mem_pool_destroy(pool);
+        return FCY_ERROR;
+    }
+
     if (request_init(pool) == FCY_ERROR) {
         mem_pool_destroy(pool);
         return FCY_ERROR;
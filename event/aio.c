@@ -0,0 +1,276 @@
+//
+// Created by frank on 17-6-19.
+//
+
+#define _GNU_SOURCE
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "log.h"
+#include "list.h"
+#include "connection.h"
+#include "aio.h"
+
+typedef struct aio_task aio_task;
+
+struct aio_task {
+    connection      *conn;          /* NULL if it went away */
+    event_handler   handler;
+
+    int             fd;             /* a dup, closed by the helper thread */
+    off_t           offset;
+    size_t          count;
+
+    size_t          bytes;
+    u_long          usec;
+
+    list_node       node;
+};
+
+aio_stat                aio_stats;
+
+/* queue -> running -> done, moved by the helper threads under lock */
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cond = PTHREAD_COND_INITIALIZER;
+static list             queue;
+static list             running;
+static list             done;
+
+/* the helper threads say a read is done */
+static connection       *notify_conn;
+static long             page_size;
+
+static void *aio_thread(void *arg);
+static void aio_done_h(event *ev);
+static int aio_cancel_list(list *l, connection *conn);
+static int aio_probe(int fd, off_t offset);
+
+int aio_init()
+{
+    sigset_t    all, old;
+    pthread_t   tid;
+    int         fd, err;
+
+    if (aio_threads == 0) {
+        return FCY_OK;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    list_init(&queue);
+    list_init(&running);
+    list_init(&done);
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        LOG_SYSERR("eventfd error");
+        return FCY_ERROR;
+    }
+    notify_conn = conn_get();
+    if (notify_conn == NULL) {
+        CHECK(close(fd));
+        return FCY_ERROR;
+    }
+    notify_conn->sockfd = fd;
+    conn_enable_read(notify_conn, aio_done_h);
+
+    /* signals are for the event loop */
+    sigfillset(&all);
+    CHECK(pthread_sigmask(SIG_SETMASK, &all, &old));
+    for (int i = 0; i < aio_threads; ++i) {
+        err = pthread_create(&tid, NULL, aio_thread, NULL);
+        if (err != 0) {
+            LOG_ERROR("pthread_create error: %s", strerror(err));
+            CHECK(pthread_sigmask(SIG_SETMASK, &old, NULL));
+            return FCY_ERROR;
+        }
+        CHECK(pthread_detach(tid));
+    }
+    CHECK(pthread_sigmask(SIG_SETMASK, &old, NULL));
+
+    LOG_INFO("%d aio threads", aio_threads);
+    return FCY_OK;
+}
+
+size_t aio_resident(int fd, off_t offset, size_t count)
+{
+    size_t  first = (size_t)page_size - (size_t)(offset % page_size);
+
+    if (count > AIO_READ_SIZE) {
+        count = AIO_READ_SIZE;
+    }
+    if (!aio_probe(fd, offset)) {
+        return 0;
+    }
+
+    /* the page of offset is in, the rest is halved until its last byte is */
+    while (count > first && !aio_probe(fd, offset + (off_t)count - 1)) {
+        count = count / 2 > first ? count / 2 : first;
+    }
+    return count;
+}
+
+/* a byte read only from the page cache, no mapping to tear down.
+ * 1 if it is there, or if the kernel cannot tell */
+static int aio_probe(int fd, off_t offset)
+{
+    char            c;
+    struct iovec    iov = { &c, 1 };
+
+    if (preadv2(fd, &iov, 1, offset, RWF_NOWAIT) == -1 && errno == EAGAIN) {
+        return 0;
+    }
+    return 1;
+}
+
+int aio_read(connection *conn, int fd, off_t offset, size_t count)
+{
+    aio_task    *t;
+
+    assert(!conn->aio && notify_conn != NULL);
+
+    t = malloc(sizeof(aio_task));
+    if (t == NULL) {
+        LOG_ERROR("malloc failed");
+        return FCY_ERROR;
+    }
+
+    /* the file may be closed before the read is done */
+    t->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (t->fd == -1) {
+        LOG_SYSERR("dup error");
+        free(t);
+        return FCY_ERROR;
+    }
+    t->conn = conn;
+    t->handler = conn->write.handler;
+    t->offset = offset;
+    t->count = count < AIO_READ_SIZE ? count : AIO_READ_SIZE;
+    t->bytes = 0;
+    t->usec = 0;
+
+    CHECK(pthread_mutex_lock(&lock));
+    list_insert_head(queue.prev, &t->node);
+    CHECK(pthread_cond_signal(&cond));
+    CHECK(pthread_mutex_unlock(&lock));
+
+    conn->aio = 1;
+    ++aio_stats.cold;
+    return FCY_OK;
+}
+
+void aio_cancel(connection *conn)
+{
+    assert(conn->aio);
+
+    CHECK(pthread_mutex_lock(&lock));
+    if (!aio_cancel_list(&queue, conn) && !aio_cancel_list(&running, conn)) {
+        aio_cancel_list(&done, conn);
+    }
+    CHECK(pthread_mutex_unlock(&lock));
+
+    conn->aio = 0;
+}
+
+static int aio_cancel_list(list *l, connection *conn)
+{
+    for (list_node *x = l->next; x != l; x = x->next) {
+        aio_task *t = link_data(x, aio_task, node);
+        if (t->conn == conn) {
+            t->conn = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *aio_thread(void *arg)
+{
+    char            buf[64 * 1024];
+    struct timespec begin, end;
+    aio_task        *t;
+    uint64_t        one = 1;
+    size_t          want;
+    ssize_t         n;
+
+    (void)arg;
+
+    for ( ;; ) {
+        CHECK(pthread_mutex_lock(&lock));
+        while (list_empty(&queue)) {
+            CHECK(pthread_cond_wait(&cond, &lock));
+        }
+        t = link_data(list_head(&queue), aio_task, node);
+        list_remove(&t->node);
+        list_insert_head(&running, &t->node);
+        CHECK(pthread_mutex_unlock(&lock));
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+
+        /* the whole range is asked for at once, then waited for */
+        (void)posix_fadvise(t->fd, t->offset, (off_t)t->count, POSIX_FADV_WILLNEED);
+        while (t->bytes < t->count) {
+            want = t->count - t->bytes < sizeof(buf) ? t->count - t->bytes : sizeof(buf);
+            n = pread(t->fd, buf, want, t->offset + (off_t)t->bytes);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            t->bytes += (size_t)n;
+        }
+        close(t->fd);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t->usec = (u_long)((end.tv_sec - begin.tv_sec) * 1000000
+                           + (end.tv_nsec - begin.tv_nsec) / 1000);
+
+        CHECK(pthread_mutex_lock(&lock));
+        list_remove(&t->node);
+        list_insert_head(done.prev, &t->node);
+        CHECK(pthread_mutex_unlock(&lock));
+
+        /* EAGAIN only if the counter would pass 2^64 - 2 */
+        n = write(notify_conn->sockfd, &one, sizeof(one));
+        (void)n;
+    }
+
+    return NULL;
+}
+
+static void aio_done_h(event *ev)
+{
+    uint64_t    n;
+    aio_task        *t;
+    connection      *conn;
+    event_handler   handler;
+
+    if (read(ev->conn->sockfd, &n, sizeof(n)) == -1 && errno != EAGAIN) {
+        LOG_SYSERR("eventfd read error");
+    }
+
+    /* one at a time, a handler may cancel the others */
+    for ( ;; ) {
+        CHECK(pthread_mutex_lock(&lock));
+        if (list_empty(&done)) {
+            CHECK(pthread_mutex_unlock(&lock));
+            return;
+        }
+        t = link_data(list_head(&done), aio_task, node);
+        list_remove(&t->node);
+        CHECK(pthread_mutex_unlock(&lock));
+
+        aio_stats.bytes += t->bytes;
+        aio_stats.usec += t->usec;
+        conn = t->conn;
+        handler = t->handler;
+        free(t);
+
+        if (conn != NULL) {
+            /* the pages are in memory now, sendfile goes on */
+            conn->aio = 0;
+            conn_enable_write(conn, handler);
+            handler(&conn->write);
+        }
+    }
+}
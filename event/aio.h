@@ -0,0 +1,43 @@
+//
+// Created by frank on 17-6-19.
+// sendfile of pages not in the page cache blocks the worker on the disk.
+// the pages of a sendfile are looked up with mincore first, a cold
+// range is read in by one of aio_threads helper threads, the write
+// event of the connection is off meanwhile and back when it is done
+//
+
+#ifndef FANCY_AIO_H
+#define FANCY_AIO_H
+
+#include "base.h"
+#include "event.h"
+
+/* at most this much of a sendfile is looked up, and read in at once */
+#define AIO_READ_SIZE   (2 * 1024 * 1024)
+
+typedef struct aio_stat aio_stat;
+
+struct aio_stat {
+    u_long          warm;           /* sendfile with its first pages in memory */
+    u_long          cold;           /* read in by a helper thread first */
+    u_long          bytes;          /* read by helper threads */
+    u_long          usec;           /* spent in them */
+};
+
+extern aio_stat aio_stats;
+
+/* in each worker, nothing is done without aio_threads */
+int aio_init();
+
+/* bytes from offset in the page cache, up to count and AIO_READ_SIZE.
+ * a byte or a few are probed, 0 if the first is not there */
+size_t aio_resident(int fd, off_t offset, size_t count);
+
+/* count bytes from offset are read in, the write handler of conn
+ * is called again after. FCY_ERROR if it cannot be done */
+int aio_read(connection *conn, int fd, off_t offset, size_t count);
+
+/* conn goes away before its read is done */
+void aio_cancel(connection *conn);
+
+#endif //FANCY_AIO_H
@@ -3,77 +3,182 @@
 //
 
 #include "log.h"
+#include "timer.h"
 #include "connection.h"
-
-
-static connection   *conns;
-static connection   *peers;
-static list         conn_list;
-
+#include "aio.h"
+
+
+typedef struct conn_pool conn_pool;
+
+struct conn_chunk {
+    list_node   node;       // chunk list of the pool
+    list        free_list;
+    int         used;
+    timer_msec  idle_since;
+    connection  *conns;
+    conn_info   *infos;
+};
+
+struct conn_pool {
+    list        chunks;
+    int         n_chunks;
+    int         max_chunks;
+    int         used;
+};
+
+static int          chunk_size;
+static conn_pool    conns;
+static conn_pool    peers;
+static list         idle_list;
+
+/* release chunks which stay empty */
+static event        shrink_ev;
+
+static conn_chunk *conn_chunk_create(conn_pool *cp);
+static void conn_chunk_destroy(conn_pool *cp, conn_chunk *chunk);
+static connection *conn_pool_get(conn_pool *cp);
+static void conn_pool_free(conn_pool *cp, connection *conn);
+static size_t conn_limit(connection *conn, size_t budget);
+static void conn_limit_h(event *ev);
+static void conn_pool_shrink(conn_pool *cp, timer_msec current);
+static void conn_pool_shrink_h(event *ev);
+static size_t conn_budget(connection *conn);
 static void conn_init(connection *conn);
 static void event_set_field(event *ev);
 
-int conn_pool_init(mem_pool *p, int size)
+int conn_pool_init(int size, int chunk)
 {
-    list_init(&conn_list);
+    chunk_size = chunk < size ? chunk : size;
+
+    list_init(&conns.chunks);
+    list_init(&idle_list);
+    conns.max_chunks = (size + chunk_size - 1) / chunk_size;
+
+    /* peers are allocated on the first proxy request */
+    list_init(&peers.chunks);
+    peers.max_chunks = conns.max_chunks;
 
-    conns = palloc(p, size * sizeof(connection));
-    if (conns == NULL) {
+    shrink_ev.handler = conn_pool_shrink_h;
+
+    if (conn_chunk_create(&conns) == NULL) {
         return FCY_ERROR;
     }
+    return FCY_OK;
+}
 
-    peers = palloc(p, size * sizeof(connection));
-    if (peers == NULL) {
-        return FCY_ERROR;
+connection *conn_get()
+{
+    connection  *conn;
+
+    conn = conn_pool_get(&conns);
+    if (conn == NULL) {
+        return NULL;
     }
 
-    for (int i = size - 1; i >= 0; --i) {
-        conns[i].read.conn = &conns[i];
-        conns[i].write.conn = &conns[i];
-        conns[i].peer = &peers[i];
-        list_insert_head(&conn_list, &conns[i].node);
+    conn->peer = NULL;
+
+    return conn;
+}
+
+peer_connection *conn_get_peer(connection *conn)
+{
+    peer_connection *peer;
+
+    assert(conn->peer == NULL);
 
-        peers[i].read.conn = &peers[i];
-        peers[i].write.conn = &peers[i];
-        peers[i].peer = &conns[i];
+    peer = conn_pool_get(&peers);
+    if (peer == NULL) {
+        return NULL;
     }
 
-    return FCY_OK;
+    peer->peer = conn;
+    conn->peer = peer;
+
+    return peer;
 }
 
-connection *conn_get()
+peer_connection *conn_get_stream_peer(connection *conn)
 {
-    list_node   *head;
-    connection  *conn;
+    peer_connection *peer;
 
-    if (list_empty(&conn_list)) {
+    peer = conn_pool_get(&peers);
+    if (peer == NULL) {
         return NULL;
     }
 
-    head = list_head(&conn_list);
-    list_remove(head);
+    peer->peer = conn;
 
-    conn = link_data(head, connection, node);
-    conn_init(conn);
-    conn_init(conn->peer);
+    return peer;
+}
 
-    return conn;
+void conn_free_stream_peer(peer_connection *peer)
+{
+    peer->sockfd = -1;
+    peer->peer = NULL;
+    conn_pool_free(&peers, peer);
 }
 
 void conn_free(connection *conn)
 {
+    peer_connection *peer = conn->peer;
+
+    if (peer != NULL) {
+        peer->sockfd = -1;
+        peer->peer = NULL;
+        conn->peer = NULL;
+        conn_pool_free(&peers, peer);
+    }
+
+    if (conn->idle) {
+        conn_set_idle(conn, 0);
+    }
+    if (conn->aio) {
+        aio_cancel(conn);
+    }
+    conn->limited = 0;
+
     conn->sockfd = -1;
-    conn->peer->sockfd = -1;
+    conn_pool_free(&conns, conn);
+}
+
+int conn_used()
+{
+    return conns.used;
+}
 
-    list_insert_head(&conn_list, &conn->node);
+void conn_set_idle(connection *conn, int idle)
+{
+    assert(conn->idle != idle);
+
+    if (idle) {
+        list_insert_head(&idle_list, &conn->info->idle);
+    }
+    else {
+        list_remove(&conn->info->idle);
+    }
+    conn->idle = idle;
+}
+
+connection *conn_idle_oldest()
+{
+    list_node   *tail;
+    conn_info   *info;
+
+    tail = list_tail(&idle_list);
+    if (tail == NULL) {
+        return NULL;
+    }
+
+    info = link_data(tail, conn_info, idle);
+    return &info->chunk->conns[info - info->chunk->infos];
 }
 
 char *conn_str(connection *conn)
 {
     static char buf[32];
     snprintf(buf, 32,  "[%s:%hu]",
-             inet_ntoa(conn->addr.sin_addr),
-             ntohs(conn->addr.sin_port));
+             inet_ntoa(conn->info->addr.sin_addr),
+             ntohs(conn->info->addr.sin_port));
     return buf;
 }
 
@@ -207,9 +312,23 @@ int conn_read_chunked(connection *conn, buffer *in)
 
 int conn_write(connection *conn, buffer *out)
 {
-    int error;
+    int     error;
+    size_t  budget;
+    ssize_t n;
+
+    if (buffer_empty(out)) {
+        return FCY_OK;
+    }
+
+    /* budget is spent, EPOLLOUT fires again in the next iteration */
+    budget = conn_budget(conn);
+    if (budget == 0) {
+        return FCY_AGAIN;
+    }
+
     inter:
-    if (buffer_write_fd(out, conn->sockfd, &error) == -1) {
+    n = buffer_write_fd(out, conn->sockfd, budget, &error);
+    if (n == -1) {
         switch (error) {
             case EINTR:
                 goto inter;
@@ -220,18 +339,58 @@ int conn_write(connection *conn, buffer *out)
                 return FCY_ERROR;
         }
     }
+    conn->budget -= n;
+    if (conn->limited) {
+        conn->info->limit_sent += n;
+    }
+
     if (!buffer_empty(out)) {
         return FCY_AGAIN;
     }
     return FCY_OK;
 }
 
-int conn_send_file(connection *conn, int fd, struct stat *st)
+int conn_send_file(connection *conn, int fd, off_t *offset, struct stat *st)
 {
     ssize_t n;
+    size_t  count, resident;
+
+    /* the write event is off until the read is done */
+    if (conn->aio) {
+        return FCY_AGAIN;
+    }
+
+    count = conn_budget(conn);
+    if (count == 0) {
+        return FCY_AGAIN;
+    }
+    if (sendfile_max_chunk > 0 && count > (size_t)sendfile_max_chunk) {
+        count = (size_t)sendfile_max_chunk;
+    }
+    if (count > (size_t)st->st_size) {
+        /* a range ends before the file does */
+        count = (size_t)st->st_size;
+    }
+    if (count > INT_MAX) {
+        count = INT_MAX;
+    }
+
+    /* sendfile waits for the disk if the pages are not in memory,
+     * a helper thread reads ahead of it instead. only what is in memory is sent */
+    if (aio_threads > 0 && count > 0) {
+        resident = aio_resident(fd, *offset, count);
+        if (resident > 0) {
+            ++aio_stats.warm;
+            count = resident;
+        }
+        else if (aio_read(conn, fd, *offset, (size_t)st->st_size) == FCY_OK) {
+            conn_disable_write(conn);
+            return FCY_AGAIN;
+        }
+    }
 
     inter:
-    n = sendfile(conn->sockfd, fd, NULL, INT_MAX);
+    n = sendfile(conn->sockfd, fd, offset, count);
     if (n == -1) {
         switch (errno) {
             case EINTR:
@@ -243,15 +402,228 @@ int conn_send_file(connection *conn, int fd, struct stat *st)
                 return FCY_ERROR;
         }
     }
+    conn->budget -= n;
     st->st_size -= n;
+    if (conn->limited) {
+        conn->info->limit_sent += n;
+    }
     return FCY_OK;
 }
 
+void conn_limit_rate(connection *conn, size_t rate, size_t after)
+{
+    conn_info   *info = conn->info;
+
+    assert(!conn->write.timer_set);
+
+    conn->limited = rate > 0;
+    info->limit_rate = rate;
+    info->limit_after = after;
+    info->limit_sent = 0;
+    info->limit_start = current_msec();
+}
+
+static size_t conn_budget(connection *conn)
+{
+    if (write_budget == 0) {
+        conn->budget = SIZE_MAX;
+    }
+    else if (conn->budget_iteration != event_iteration) {
+        conn->budget_iteration = event_iteration;
+        conn->budget = (size_t)write_budget;
+    }
+    if (conn->limited && conn->write.active) {
+        return conn_limit(conn, conn->budget);
+    }
+    return conn->budget;
+}
+
+/* what the rate allows now, 0 if the write event waits on a timer */
+static size_t conn_limit(connection *conn, size_t budget)
+{
+    conn_info   *info = conn->info;
+    timer_msec  elapsed = current_msec() - info->limit_start, due;
+    size_t      allowed, over;
+
+    /* a second of the rate at once, as the response starts */
+    allowed = info->limit_after + info->limit_rate * (elapsed + 1000) / 1000;
+    if (allowed > info->limit_sent) {
+        allowed -= info->limit_sent;
+        return allowed < budget ? allowed : budget;
+    }
+
+    /* ahead of the rate: no EPOLLOUT until a step of it is allowed */
+    over = info->limit_sent - info->limit_after;
+    due = over * 1000 / info->limit_rate + CONN_LIMIT_STEP;
+    info->limit_handler = conn->write.handler;
+    conn_disable_write(conn);
+    conn->write.handler = conn_limit_h;
+    timer_add(&conn->write, due > elapsed + 1000 ? due - elapsed - 1000 : 1);
+    return 0;
+}
+
+static void conn_limit_h(event *ev)
+{
+    connection  *conn = ev->conn;
+
+    ev->timeout = 0;
+    conn_enable_write(conn, conn->info->limit_handler);
+    ev->handler(ev);
+}
+
+static conn_chunk *conn_chunk_create(conn_pool *cp)
+{
+    conn_chunk  *chunk = NULL;
+    connection  *c;
+    conn_info   *info;
+    size_t      size;
+
+    if (cp->n_chunks >= cp->max_chunks) {
+        return NULL;
+    }
+
+    /* [chunk][conns...][infos...], conns start on a cache line */
+    size = align_ptr(sizeof(conn_chunk), CACHE_LINE_SIZE)
+           + chunk_size * (sizeof(connection) + sizeof(conn_info));
+
+    if (posix_memalign((void**)&chunk, CACHE_LINE_SIZE, size) != 0) {
+        LOG_ERROR("alloc connection chunk failed");
+        return NULL;
+    }
+
+    c = (connection*)((char*)chunk + align_ptr(sizeof(conn_chunk), CACHE_LINE_SIZE));
+    info = (conn_info*)&c[chunk_size];
+
+    list_init(&chunk->free_list);
+    for (int i = chunk_size - 1; i >= 0; --i) {
+        c[i].read.conn = &c[i];
+        c[i].write.conn = &c[i];
+        c[i].info = &info[i];
+        info[i].chunk = chunk;
+        list_insert_head(&chunk->free_list, &info[i].node);
+    }
+
+    chunk->used = 0;
+    chunk->idle_since = current_msec();
+    chunk->conns = c;
+    chunk->infos = info;
+
+    /* new chunks go last, so that connections gather in the old ones */
+    list_insert_head(cp->chunks.prev, &chunk->node);
+    ++cp->n_chunks;
+
+    LOG_DEBUG("connection chunk %d/%d allocated", cp->n_chunks, cp->max_chunks);
+
+    return chunk;
+}
+
+static void conn_chunk_destroy(conn_pool *cp, conn_chunk *chunk)
+{
+    assert(chunk->used == 0);
+
+    list_remove(&chunk->node);
+    --cp->n_chunks;
+    free(chunk);
+
+    LOG_DEBUG("connection chunk released, %d/%d left", cp->n_chunks, cp->max_chunks);
+}
+
+static connection *conn_pool_get(conn_pool *cp)
+{
+    list_node   *node, *head;
+    conn_chunk  *chunk = NULL;
+    conn_info   *info;
+    connection  *conn;
+
+    /* first fit */
+    for (node = cp->chunks.next; node != &cp->chunks; node = node->next) {
+        conn_chunk *c = link_data(node, conn_chunk, node);
+        if (!list_empty(&c->free_list)) {
+            chunk = c;
+            break;
+        }
+    }
+
+    if (chunk == NULL) {
+        chunk = conn_chunk_create(cp);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+
+    head = list_head(&chunk->free_list);
+    list_remove(head);
+    ++chunk->used;
+    ++cp->used;
+
+    info = link_data(head, conn_info, node);
+    conn = &chunk->conns[info - chunk->infos];
+    conn_init(conn);
+
+    return conn;
+}
+
+static void conn_pool_free(conn_pool *cp, connection *conn)
+{
+    conn_chunk *chunk = conn->info->chunk;
+
+    list_insert_head(&chunk->free_list, &conn->info->node);
+    --cp->used;
+
+    if (--chunk->used == 0) {
+        chunk->idle_since = current_msec();
+        if (!shrink_ev.timer_set) {
+            timer_add(&shrink_ev, CONN_CHUNK_IDLE_TIMEOUT);
+        }
+    }
+}
+
+static void conn_pool_shrink(conn_pool *cp, timer_msec current)
+{
+    list_node   *node, *next;
+    conn_chunk  *chunk;
+
+    for (node = cp->chunks.next; node != &cp->chunks; node = next) {
+        next = node->next;
+        chunk = link_data(node, conn_chunk, node);
+
+        if (chunk->used > 0) {
+            continue;
+        }
+
+        /* the first client chunk is kept for good */
+        if (cp == &conns && cp->n_chunks == 1) {
+            break;
+        }
+
+        if (current - chunk->idle_since >= CONN_CHUNK_IDLE_TIMEOUT) {
+            conn_chunk_destroy(cp, chunk);
+        }
+        else if (!shrink_ev.timer_set) {
+            timer_add(&shrink_ev,
+                      CONN_CHUNK_IDLE_TIMEOUT - (current - chunk->idle_since));
+        }
+    }
+}
+
+static void conn_pool_shrink_h(event *ev)
+{
+    timer_msec current = current_msec();
+
+    ev->timeout = 0;
+
+    conn_pool_shrink(&conns, current);
+    conn_pool_shrink(&peers, current);
+}
+
 static void conn_init(connection *conn)
 {
     conn->sockfd = -1;
+    conn->idle = 0;
+    conn->http2 = 0;
     conn->app = NULL;
-    conn->app_count = 0;
+    conn->info->app_count = 0;
+    conn->info->listening = NULL;
 
     event_set_field(&conn->read);
     event_set_field(&conn->write);
@@ -263,4 +635,4 @@ static void event_set_field(event *ev)
 
     bzero(ev, sizeof(event));
     ev->conn = conn;
-}
\ No newline at end of file
+}
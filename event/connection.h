@@ -1,7 +1,9 @@
 //
 // Created by frank on 17-2-12.
 // TCP connection pool
-// the size of pool is determined by worker connection configuration
+// the pool grows in chunks of connection_chunk connections up to
+// worker_connections, and chunks unused for a while are given back.
+// peer connections come from a separate pool and are only taken when proxying
 //
 
 #ifndef FANCY_CONN_POOL_H
@@ -11,31 +13,86 @@
 #include "buffer.h"
 #include "event.h"
 
+#define CACHE_LINE_SIZE 64
+
+/* an empty chunk is released after being idle this long */
+#define CONN_CHUNK_IDLE_TIMEOUT (60 * 1000)
+
+/* ms of limit_rate sent at once after waiting */
+#define CONN_LIMIT_STEP 100
+
 typedef struct connection connection;
 typedef struct connection peer_connection;
+typedef struct conn_info  conn_info;
+typedef struct conn_chunk conn_chunk;
 
+/* hot part, touched on every event */
 struct connection {
 
-    int                 sockfd;
     event               read;
     event               write;
 
+    int                 sockfd;
+    unsigned            idle:1; // keep-alive, waiting for next request
+    unsigned            http2:1; // app is http2
+    unsigned            aio:1;   // the file being sent is read in, see aio.h
+    unsigned            limited:1; // limit_rate, see conn_limit_rate
+
+    /* bytes this connection may still write in budget_iteration */
+    size_t              budget;
+    u_long              budget_iteration;
+
     peer_connection     *peer;  // user or upstream connection
 
     void                *app;   // request, upstream
-    int                 app_count;
+
+    conn_info           *info;
+
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* cold part, touched when a connection is set up or torn down */
+struct conn_info {
 
     struct sockaddr_in  addr;   // peer address
 
-    list_node           node;
+    int                 app_count;
+
+    void                *listening; // accepted on, see server.h
+
+    conn_chunk          *chunk; // slab this connection belongs to
+    list_node           node;   // free list of the chunk
+    list_node           idle;   // idle list, most recently used first
+
+    /* limit_rate, only looked at if the connection is limited */
+    size_t              limit_rate;     // bytes per second
+    size_t              limit_after;    // sent at full speed first
+    size_t              limit_sent;
+    timer_msec          limit_start;
+    event_handler       limit_handler;  // the write handler while waiting
 };
 
-int conn_pool_init(mem_pool *p, int size);
+/* size is the hard cap, the pool starts with one chunk */
+int conn_pool_init(int size, int chunk_size);
 
 /* conn_get is the only way to get a connection */
 connection *conn_get();
 
+/* attach a peer connection to conn, the peer pool is allocated on first use */
+peer_connection *conn_get_peer(connection *conn);
+
+/* a peer for an http/2 stream, conn->peer is left alone */
+peer_connection *conn_get_stream_peer(connection *conn);
+void conn_free_stream_peer(peer_connection *peer);
+
+/* conn_free also gives back the attached peer */
 void conn_free(connection *conn);
+
+/* number of client connections in use */
+int conn_used();
+
+/* idle keep-alive connections, the oldest one is reclaimed first */
+void conn_set_idle(connection *conn, int idle);
+connection *conn_idle_oldest();
 char *conn_str(connection *conn);
 
 void conn_enable_accept(connection *, event_handler);
@@ -44,10 +101,15 @@ void conn_disable_read(connection *);
 void conn_enable_write(connection *, event_handler);
 void conn_disable_write(connection *);
 
+/* conn_write and conn_send_file send rate bytes a second after the first
+ * after bytes, the write event waits on a timer when ahead. 0 is no limit */
+void conn_limit_rate(connection *conn, size_t rate, size_t after);
+
 int conn_read(connection *conn, buffer *in);
 int conn_read_chunked(connection *conn, buffer *in);
 int conn_write(connection *conn, buffer *out);
-int conn_send_file(connection *conn, int fd, struct stat *st);
+/* the fd may be shared, its file offset is left alone */
+int conn_send_file(connection *conn, int fd, off_t *offset, struct stat *st);
 
 #define CONN_READ(conn, in, error_handler) \
 do {    \
@@ -77,9 +139,9 @@ do {    \
     }   \
 } while(0)  \
 
-#define CONN_SEND_FILE(conn, fd, st, error_handler)   \
+#define CONN_SEND_FILE(conn, fd, offset, st, error_handler)   \
 do {    \
-    int err = conn_send_file(conn, fd, st); \
+    int err = conn_send_file(conn, fd, offset, st); \
     switch(err) {    \
         case FCY_AGAIN: \
             return; \
@@ -11,9 +11,13 @@
 #include "connection.h"
 
 int epollfd = -1;
+u_long event_iteration;
+u_long event_lag;
 
 static struct epoll_event *event_list;
 
+static u_long event_usec();
+
 int event_init(mem_pool *p, int n_ev)
 {
     assert(epollfd == -1);
@@ -39,9 +43,11 @@ int event_process(timer_msec timeout)
     int         n_ev, events;
     event       *revent, *wevent;
     connection  *conn;
+    u_long      begin;
     struct epoll_event *e_event;
 
     n_ev = epoll_wait(epollfd, event_list, epoll_events, (int)timeout);
+    ++event_iteration;
 
     if (n_ev == -1) {
         if (errno == EINTR) {
@@ -51,10 +57,13 @@ int event_process(timer_msec timeout)
         return FCY_ERROR;
     }
     else if (n_ev == 0) {
-        /* timeout */
+        /* timeout, nothing to do */
+        event_lag = event_lag * 7 / 8;
         return 0;
     }
 
+    begin = event_usec();
+
     for (int i = 0; i < n_ev; ++i) {
         e_event = &event_list[i];
         events = e_event->events;
@@ -79,5 +88,16 @@ int event_process(timer_msec timeout)
             wevent->handler(wevent);
         }
     }
+
+    /* 7/8 of the old value, how busy the worker is of late */
+    event_lag = (event_lag * 7 + (event_usec() - begin)) / 8;
     return n_ev;
+}
+
+static u_long event_usec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u_long)ts.tv_sec * 1000000 + (u_long)ts.tv_nsec / 1000;
 }
\ No newline at end of file
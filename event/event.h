@@ -9,6 +9,8 @@
 #include "rbtree.h"
 
 extern int epollfd;
+extern u_long event_iteration;  // number of event_process calls
+extern u_long event_lag;        // 每轮处理事件所用微秒数, 平滑过的
 
 typedef rbtree_key          timer_msec;
 typedef struct event        event;
@@ -11,7 +11,6 @@ static rbtree      timer;
 static rbtree_node sentinel;
 
 static timer_msec timer_recent();
-static timer_msec current_msec();
 
 void timer_init()
 {
@@ -100,7 +99,7 @@ static timer_msec timer_recent()
     return 0;
 }
 
-static timer_msec current_msec()
+timer_msec current_msec()
 {
     struct timeval now;
 
@@ -12,5 +12,6 @@ void timer_add(event *ev, timer_msec timeout);
 void timer_del(event *ev);
 void timer_expired_process();
 void event_and_timer_process();
+timer_msec current_msec();
 
 #endif //FANCY_TIMER_H
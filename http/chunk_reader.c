@@ -9,82 +9,122 @@ enum {
 
     hex_start_ = 0,
     hex_,
+    extension_,
     hex_almost_done_,
-    hex_done_,
 
     chunk_data_,
+    chunk_data_end_,
     chunk_data_almost_done_,
 
+    trailer_start_,
+    trailer_,
+    trailer_almost_done_,
+
     all_almost_done_,
     all_done_,
 
     error_,
 };
 
+/* 1 + value of a hex digit, 0 for anything else */
+static const u_char hex_lut[256] = {
+        ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+        ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+        ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+        ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
 int chunk_reader_execute(chunk_reader *cr, char *beg, char *end)
 {
-    char *p = beg + cr->where;
+    char    *p = beg + cr->where;
+    int     v;
 
     for (; p < end; ++p) {
         switch (cr->state) {
             case hex_start_:
-                if (!isxdigit(*p)) {
+                v = hex_lut[(u_char)*p] - 1;
+                if (v < 0) {
                     goto error;
                 }
-                cr->first_hex = p;
+                cr->expect_chunked_size = (size_t)v;
                 cr->state = hex_;
                 break;
 
             case hex_:
-                if (isxdigit(*p)) {
-                    break;
+                /* the size line is eaten in one go */
+                while ((v = hex_lut[(u_char)*p] - 1) >= 0) {
+                    if (cr->expect_chunked_size > (SIZE_MAX >> 4)) {
+                        goto error;
+                    }
+                    cr->expect_chunked_size = (cr->expect_chunked_size << 4) | (size_t)v;
+                    if (++p == end) {
+                        goto done;
+                    }
                 }
                 if (*p == '\r') {
-                    char *hex_end;
-                    cr->expect_chunked_size = strtoul(cr->first_hex, &hex_end, 16);
-                    assert(hex_end == p);
                     cr->state = hex_almost_done_;
                     break;
                 }
+                if (*p == ';' || *p == ' ' || *p == '\t') {
+                    cr->state = extension_;
+                    break;
+                }
                 goto error;
 
-            case hex_almost_done_:
-                if (*p == '\n') {
-                    cr->state = hex_done_;
+            case extension_:
+                /* chunk-ext is ignored */
+                if (*p == '\r') {
+                    cr->state = hex_almost_done_;
                     break;
                 }
-                goto error;
+                if (*p == '\n') {
+                    goto error;
+                }
+                break;
 
-            case hex_done_:
-                if (cr->expect_chunked_size == 0) {
-                    if (*p == '\r') {
-                        cr->state = all_almost_done_;
-                        break;
-                    }
+            case hex_almost_done_:
+                if (*p != '\n') {
                     goto error;
                 }
-                cr->state = chunk_data_;
-                /* fall through */
+                if (cr->expect_chunked_size == 0) {
+                    cr->state = trailer_start_;
+                }
+                else {
+                    cr->state = chunk_data_;
+                }
+                break;
 
             case chunk_data_:
             {
-                size_t readable = end - p;
-                if (readable <= cr->expect_chunked_size) {
-                    cr->expect_chunked_size -= readable;
-                    p = end;
-                    goto done;
+                size_t n = end - p;
+                if (n > cr->expect_chunked_size) {
+                    n = cr->expect_chunked_size;
+                }
+                /* one move per span, the framing before it is overwritten */
+                if (beg + cr->size != p) {
+                    memmove(beg + cr->size, p, n);
                 }
+                cr->size += n;
+                p += n;
+                cr->expect_chunked_size -= n;
 
-                p += cr->expect_chunked_size;
-                cr->expect_chunked_size = 0;
+                if (cr->expect_chunked_size > 0) {
+                    assert(p == end);
+                    goto done;
+                }
+                cr->state = chunk_data_end_;
+                if (p == end) {
+                    goto done;
+                }
+            }
+                /* fall through */
 
+            case chunk_data_end_:
                 if (*p == '\r') {
                     cr->state = chunk_data_almost_done_;
                     break;
                 }
-
                 goto error;
-            }
 
             case chunk_data_almost_done_:
                 if (*p == '\n') {
@@ -93,6 +133,28 @@ int chunk_reader_execute(chunk_reader *cr, char *beg, char *end)
                 }
                 goto error;
 
+            case trailer_start_:
+                if (*p == '\r') {
+                    cr->state = all_almost_done_;
+                    break;
+                }
+                /* trailer fields are ignored */
+                cr->state = trailer_;
+                break;
+
+            case trailer_:
+                if (*p == '\r') {
+                    cr->state = trailer_almost_done_;
+                }
+                break;
+
+            case trailer_almost_done_:
+                if (*p == '\n') {
+                    cr->state = trailer_start_;
+                    break;
+                }
+                goto error;
+
             case all_almost_done_:
                 if (*p == '\n') {
                     cr->state = all_done_;
@@ -115,3 +177,25 @@ int chunk_reader_execute(chunk_reader *cr, char *beg, char *end)
     cr->state = error_;
     return FCY_ERROR;
 }
+
+int chunk_reader_decode(chunk_reader *cr, buffer *b)
+{
+    char    *beg = buffer_peek(b);
+    char    *end = buffer_begin_write(b);
+    size_t  tail;
+    int     err;
+
+    err = chunk_reader_execute(cr, beg, end);
+    if (err == FCY_ERROR) {
+        return err;
+    }
+
+    /* drop the framing, keep unparsed bytes right after the payload */
+    if (cr->where > cr->size) {
+        tail = end - (beg + cr->where);
+        memmove(beg + cr->size, beg + cr->where, tail);
+        buffer_unwrite(b, cr->where - cr->size);
+        cr->where = cr->size;
+    }
+    return err;
+}
@@ -1,23 +1,33 @@
 //
 // Created by frank on 17-6-3.
+// chunked body decoder, payload is compacted in place
 //
 
 #ifndef FANCY_CHUNK_READER_H
 #define FANCY_CHUNK_READER_H
 
-#include <wchar.h>
+#include "base.h"
+#include "buffer.h"
 
 typedef struct chunk_reader chunk_reader;
+
 struct chunk_reader {
 
     unsigned    state:8;
 
+    /* [beg, beg + size) is decoded payload, parsing resumes at beg + where */
     size_t      where;
-    char        *first_hex;
+    size_t      size;
 
     size_t      expect_chunked_size;
 };
 
+/* payload is moved down over the framing, where >= size always,
+ * bytes past the last chunk are left after beg + where */
 int chunk_reader_execute(chunk_reader *cr, char *beg, char *end);
 
+/* decode b in place, on return b holds the payload decoded so far,
+ * followed by what came after the body if it is done */
+int chunk_reader_decode(chunk_reader *cr, buffer *b);
+
 #endif //FANCY_CHUNK_READER_H
@@ -0,0 +1,590 @@
+//
+// Created by frank on 17-6-16.
+//
+
+#include <sys/inotify.h>
+#include <dirent.h>
+
+#include "base.h"
+#include "log.h"
+#include "connection.h"
+#include "http_parser.h"
+#include "server.h"
+#include "file_cache.h"
+
+#define FILE_CACHE_EVENTS   (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define WARMUP_DEPTH        8
+
+file_cache_stat         file_cache_stats;
+
+static cached_file      **table;        /* (dirfd, path) */
+static cached_file      **wd_table;     /* watch descriptor */
+static size_t           mask;
+static list             lru;
+static list             mem_lru;
+static connection       *inotify_conn;
+
+static cached_file *file_create(location *loc, const char *path, size_t len);
+static char *file_path(cached_file *f, char *path);
+static void file_resolve(cached_file *f, location *loc);
+static int file_revalidate(cached_file *f);
+static void file_load(cached_file *f);
+static void file_mem_free(cached_file *f);
+static void file_warmup(location *loc, char *uri, size_t len, int depth);
+static void file_watch(cached_file *f, const char *path);
+static void file_unlink(cached_file *f);
+static void inotify_h(event *ev);
+static u_int file_hash(int dirfd, const char *path, size_t len);
+
+int file_cache_init()
+{
+    size_t  size = 16;
+    int     fd;
+
+    if (open_file_cache == 0) {
+        return FCY_OK;
+    }
+
+    /* at most one entry per bucket on average */
+    while (size < (size_t)open_file_cache) {
+        size *= 2;
+    }
+    mask = size - 1;
+    table = calloc(size, sizeof(cached_file*));
+    wd_table = calloc(size, sizeof(cached_file*));
+    if (table == NULL || wd_table == NULL) {
+        return FCY_ERROR;
+    }
+    list_init(&lru);
+    list_init(&mem_lru);
+
+    if (open_file_cache_events) {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1) {
+            LOG_SYSERR("inotify_init1 error, open_file_cache_events ignored");
+        }
+        else {
+            inotify_conn = conn_get();
+            if (inotify_conn == NULL) {
+                CHECK(close(fd));
+                return FCY_ERROR;
+            }
+            inotify_conn->sockfd = fd;
+            conn_enable_read(inotify_conn, inotify_h);
+        }
+    }
+
+    if (open_file_cache_mem == 0) {
+        return FCY_OK;
+    }
+
+    for (size_t i = 0; i < servers->size; ++i) {
+        server *srv = array_at(servers, i);
+        for (size_t j = 0; j < srv->locations->size; ++j) {
+            location *loc = array_at(srv->locations, j);
+            if (loc->warmup && !loc->use_proxy) {
+                char uri[PATH_MAX] = "/";
+                file_warmup(loc, uri, 1, 0);
+            }
+        }
+    }
+    LOG_INFO("open file cache warmed up, %lu files, %zu bytes in memory",
+             file_cache_stats.mem_entries, file_cache_stats.mem_size);
+
+    return FCY_OK;
+}
+
+cached_file *file_cache_open(location *loc, const char *path, size_t len)
+{
+    cached_file *f;
+    u_int       h;
+
+    if (table == NULL) {
+        f = file_create(loc, path, len);
+        if (f != NULL) {
+            file_resolve(f, loc);
+        }
+        return f;
+    }
+
+    h = file_hash(loc->root_dirfd, path, len) & mask;
+    for (f = table[h]; f != NULL; f = f->next) {
+        if (f->dirfd == loc->root_dirfd && f->len == len
+            && memcmp(f->path, path, len) == 0) {
+            break;
+        }
+    }
+
+    if (f != NULL) {
+        if (current_msec() >= f->valid_until) {
+            if (file_revalidate(f) == FCY_OK) {
+                ++file_cache_stats.revalidated;
+                f->valid_until = current_msec() + (timer_msec)open_file_cache_valid;
+            }
+            else {
+                ++file_cache_stats.expired;
+                file_unlink(f);
+                f = NULL;
+            }
+        }
+    }
+
+    if (f != NULL) {
+        ++file_cache_stats.hits;
+        list_remove(&f->lru);
+        list_insert_head(&lru, &f->lru);
+        if (f->body != NULL) {
+            list_remove(&f->mem_lru);
+            list_insert_head(&mem_lru, &f->mem_lru);
+        }
+        ++f->refs;
+        return f;
+    }
+
+    ++file_cache_stats.misses;
+
+    /* make room, the least recently used first */
+    if (file_cache_stats.entries >= (u_long)open_file_cache) {
+        ++file_cache_stats.evicted;
+        file_unlink(link_data(list_tail(&lru), cached_file, lru));
+    }
+
+    f = file_create(loc, path, len);
+    if (f == NULL) {
+        return NULL;
+    }
+    file_resolve(f, loc);
+
+    /* a failure other than "not there" or "not allowed" may pass */
+    if (f->status == STATUS_INTARNAL_SEARVE_ERROR) {
+        return f;
+    }
+
+    f->cached = 1;
+    ++f->refs;
+    f->valid_until = current_msec() + (timer_msec)open_file_cache_valid;
+    f->next = table[h];
+    table[h] = f;
+    list_insert_head(&lru, &f->lru);
+    if (f->wd != -1) {
+        f->wd_next = wd_table[f->wd & mask];
+        wd_table[f->wd & mask] = f;
+    }
+    ++file_cache_stats.entries;
+
+    if (f->status == STATUS_OK && open_file_cache_mem > 0
+        && f->st.st_size <= open_file_cache_mem_max) {
+        file_load(f);
+    }
+
+    return f;
+}
+
+void file_cache_release(cached_file *f)
+{
+    assert(f->refs > 0);
+
+    if (--f->refs > 0) {
+        return;
+    }
+    if (f->fd != -1) {
+        CHECK(close(f->fd));
+    }
+    assert(f->body == NULL);
+    free(f);
+}
+
+cached_file *file_cache_open_sibling(location *loc, cached_file *f, const char *ext)
+{
+    char    path[PATH_MAX];
+    size_t  len = f->len;
+    size_t  index_len = f->index == NULL ? 0 : strlen(f->index);
+    size_t  ext_len = strlen(ext);
+
+    if (len + index_len + ext_len + 1 >= PATH_MAX) {
+        return NULL;
+    }
+
+    memcpy(path, f->path, len);
+    if (f->index != NULL) {
+        if (path[len - 1] != '/') {
+            path[len++] = '/';
+        }
+        memcpy(path + len, f->index, index_len);
+        len += index_len;
+    }
+    memcpy(path + len, ext, ext_len + 1);
+
+    return file_cache_open(loc, path, len + ext_len);
+}
+
+void file_cache_set_header(cached_file *f, const char *header, size_t len)
+{
+    if (f->body == NULL || f->header.data != NULL) {
+        return;
+    }
+    f->header.data = malloc(len);
+    if (f->header.data == NULL) {
+        return;
+    }
+    memcpy(f->header.data, header, len);
+    f->header.len = len;
+    file_cache_stats.mem_size += len;
+}
+
+static cached_file *file_create(location *loc, const char *path, size_t len)
+{
+    cached_file *f = malloc(sizeof(cached_file) + len + 1);
+
+    if (f == NULL) {
+        LOG_ERROR("malloc failed");
+        return NULL;
+    }
+    bzero(f, sizeof(cached_file));
+    f->fd = -1;
+    f->wd = -1;
+    f->refs = 1;
+    f->dirfd = loc->root_dirfd;
+    f->len = len;
+    memcpy(f->path, path, len);
+    f->path[len] = '\0';
+    return f;
+}
+
+/* relative to dirfd, NULL if too long. the end of it is returned */
+static char *file_path(cached_file *f, char *path)
+{
+    char    *p;
+    size_t  index_len = f->index == NULL ? 0 : strlen(f->index);
+
+    if (f->len + index_len >= PATH_MAX - 2) {
+        return NULL;
+    }
+
+    if (f->len == 1) {
+        strcpy(path, "./");
+        p = path + 2;
+    }
+    else {
+        memcpy(path, f->path + 1, f->len);
+        p = path + f->len - 1;
+    }
+
+    if (f->index != NULL) {
+        if (p[-1] != '/') {
+            *p++ = '/';
+        }
+        memcpy(p, f->index, index_len + 1);
+        p += index_len;
+    }
+    return p;
+}
+
+/* what used to be done for every request: stat, index files, open */
+static void file_resolve(cached_file *f, location *loc)
+{
+    char        path[PATH_MAX];
+    char        *path_base;
+    struct stat *st = &f->st;
+    const char  *dot;
+    int         fd;
+
+    path_base = file_path(f, path);
+    if (path_base == NULL) {
+        f->status = STATUS_URI_TOO_LONG;
+        return;
+    }
+
+    if (fstatat(f->dirfd, path, st, 0) == -1) {
+        LOG_DEBUG("fstatat %s error: %s", path, strerror(errno));
+        f->status = errno == EACCES ? STATUS_FORBIDDEN : STATUS_NOT_FOUND;
+        return;
+    }
+
+    dot = strrchr(f->path, '.');
+    if (S_ISDIR(st->st_mode)) {
+
+        if (path_base[-1] != '/') {
+            *path_base++ = '/';
+        }
+
+        for (int i = 0; loc->index[i].data != NULL; ++i) {
+            if (loc->index[i].len >= (size_t)(path + PATH_MAX - path_base)) {
+                continue;
+            }
+            memcpy(path_base, loc->index[i].data, loc->index[i].len + 1);
+            if (fstatat(f->dirfd, path, st, 0) != -1) {
+                f->index = loc->index[i].data;
+                dot = strrchr(f->index, '.');
+                break;
+            }
+        }
+
+        if (f->index == NULL) {
+            f->status = STATUS_NOT_FOUND;
+            return;
+        }
+    }
+    else if (dot != NULL && strchr(dot, '/') != NULL) {
+        dot = NULL;
+    }
+
+    if (!S_ISREG(st->st_mode) || !(S_IRUSR & st->st_mode)) {
+        f->status = STATUS_FORBIDDEN;
+        return;
+    }
+
+    fd = openat(f->dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        LOG_SYSERR("openat %s error", path);
+        f->status = errno == EACCES ? STATUS_FORBIDDEN : STATUS_INTARNAL_SEARVE_ERROR;
+        return;
+    }
+
+    /* larger ones are sent by sendfile from start to end, read ahead more */
+    if (st->st_size > open_file_cache_mem_max) {
+        (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    f->fd = fd;
+    f->status = STATUS_OK;
+    if (dot != NULL) {
+        f->suffix.data = (char*)dot;
+        f->suffix.len = strlen(dot);
+    }
+
+    if (inotify_conn != NULL) {
+        file_watch(f, path);
+    }
+}
+
+/* one fstatat instead of stat, open and read, FCY_OK if nothing changed */
+static int file_revalidate(cached_file *f)
+{
+    char        path[PATH_MAX];
+    struct stat st;
+
+    if (file_path(f, path) == NULL) {
+        return FCY_ERROR;
+    }
+
+    if (fstatat(f->dirfd, path, &st, 0) == -1) {
+        return f->status == STATUS_NOT_FOUND && errno == ENOENT ? FCY_OK : FCY_ERROR;
+    }
+    if (f->status != STATUS_OK) {
+        return FCY_ERROR;
+    }
+
+    /* a file renamed over it has another inode */
+    if (st.st_ino != f->st.st_ino || st.st_dev != f->st.st_dev
+        || st.st_size != f->st.st_size
+        || st.st_mtim.tv_sec != f->st.st_mtim.tv_sec
+        || st.st_mtim.tv_nsec != f->st.st_mtim.tv_nsec) {
+        return FCY_ERROR;
+    }
+    return FCY_OK;
+}
+
+/* the least recently used bodies go first, the entries stay */
+static void file_load(cached_file *f)
+{
+    size_t  size = (size_t)f->st.st_size;
+    size_t  done = 0;
+    ssize_t n;
+
+    if (size > (size_t)open_file_cache_mem) {
+        return;
+    }
+    while (file_cache_stats.mem_size + size > (size_t)open_file_cache_mem) {
+        file_mem_free(link_data(list_tail(&mem_lru), cached_file, mem_lru));
+    }
+
+    f->body = malloc(size + 1);
+    if (f->body == NULL) {
+        return;
+    }
+    while (done < size) {
+        n = pread(f->fd, f->body + done, size - done, (off_t)done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            LOG_SYSERR("pread %s error", f->path);
+            free(f->body);
+            f->body = NULL;
+            return;
+        }
+        done += n;
+    }
+
+    list_insert_head(&mem_lru, &f->mem_lru);
+    ++file_cache_stats.mem_entries;
+    file_cache_stats.mem_size += size;
+}
+
+static void file_mem_free(cached_file *f)
+{
+    if (f->body == NULL) {
+        return;
+    }
+    list_remove(&f->mem_lru);
+    --file_cache_stats.mem_entries;
+    file_cache_stats.mem_size -= (size_t)f->st.st_size + f->header.len;
+    free(f->body);
+    free(f->header.data);
+    f->body = NULL;
+    str_null(&f->header);
+}
+
+/* small regular files under the root, until the cache is full */
+static void file_warmup(location *loc, char *uri, size_t len, int depth)
+{
+    DIR             *dir;
+    struct dirent   *de;
+    struct stat     st;
+    size_t          n;
+    int             fd;
+
+    fd = openat(loc->root_dirfd, len == 1 ? "." : uri + 1, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    dir = fdopendir(fd);
+    if (dir == NULL) {
+        CHECK(close(fd));
+        return;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        if (file_cache_stats.entries >= (u_long)open_file_cache
+            || file_cache_stats.mem_size >= (size_t)open_file_cache_mem) {
+            break;
+        }
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        n = strlen(de->d_name);
+        if (len + n + 2 >= PATH_MAX) {
+            continue;
+        }
+        memcpy(uri + len, de->d_name, n + 1);
+
+        if (fstatat(dirfd(dir), de->d_name, &st, 0) == -1) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode) && depth + 1 < WARMUP_DEPTH) {
+            uri[len + n] = '/';
+            uri[len + n + 1] = '\0';
+            file_warmup(loc, uri, len + n + 1, depth + 1);
+        }
+        else if (S_ISREG(st.st_mode) && st.st_size <= open_file_cache_mem_max) {
+            cached_file *f = file_cache_open(loc, uri, len + n);
+            if (f != NULL) {
+                file_cache_release(f);
+            }
+        }
+    }
+    uri[len] = '\0';
+    closedir(dir);
+}
+
+/* the negative entries wait for open_file_cache_valid */
+static void file_watch(cached_file *f, const char *path)
+{
+    char    proc[PATH_MAX + 32];
+
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d/%s", f->dirfd, path);
+    f->wd = inotify_add_watch(inotify_conn->sockfd, proc, FILE_CACHE_EVENTS);
+    if (f->wd == -1) {
+        LOG_SYSERR("inotify_add_watch %s error", path);
+    }
+}
+
+/* out of the cache, the last user closes the fd */
+static void file_unlink(cached_file *f)
+{
+    cached_file **p, *other;
+    int         shared = 0;
+
+    assert(f->cached);
+
+    p = &table[file_hash(f->dirfd, f->path, f->len) & mask];
+    while (*p != f) {
+        p = &(*p)->next;
+    }
+    *p = f->next;
+    list_remove(&f->lru);
+
+    /* one watch for one inode, another entry may still use it */
+    if (f->wd != -1) {
+        p = &wd_table[f->wd & mask];
+        while (*p != f) {
+            p = &(*p)->wd_next;
+        }
+        *p = f->wd_next;
+
+        for (other = wd_table[f->wd & mask]; other != NULL; other = other->wd_next) {
+            if (other->wd == f->wd) {
+                shared = 1;
+                break;
+            }
+        }
+        if (!shared) {
+            inotify_rm_watch(inotify_conn->sockfd, f->wd);
+        }
+    }
+
+    file_mem_free(f);
+    f->cached = 0;
+    --file_cache_stats.entries;
+    file_cache_release(f);
+}
+
+static void inotify_h(event *ev)
+{
+    char                    buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event    *ie;
+    cached_file             *f, *next;
+    ssize_t                 n;
+
+    for ( ;; ) {
+        n = read(ev->conn->sockfd, buf, sizeof(buf));
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                LOG_SYSERR("inotify read error");
+            }
+            return;
+        }
+
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ie->len) {
+            ie = (struct inotify_event*)p;
+            if (ie->mask & IN_IGNORED) {
+                continue;
+            }
+
+            /* every entry of the inode goes, the watch with the last one */
+            for (f = wd_table[ie->wd & mask]; f != NULL; f = next) {
+                next = f->wd_next;
+                if (f->wd == ie->wd) {
+                    ++file_cache_stats.invalidated;
+                    file_unlink(f);
+                }
+            }
+        }
+    }
+}
+
+/* FNV-1a */
+static u_int file_hash(int dirfd, const char *path, size_t len)
+{
+    u_int h = 2166136261u ^ (u_int)dirfd;
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (u_char)path[i];
+        h *= 16777619u;
+    }
+    return h;
+}
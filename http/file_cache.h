@@ -0,0 +1,86 @@
+//
+// Created by frank on 17-6-16.
+// per worker cache of open static files, keyed by root and path:
+// the fd, its stat, the index file a directory resolves to,
+// and "not found" or "forbidden" answers. an entry lives for
+// open_file_cache_valid, or until inotify says the file changed,
+// it is then stat'ed again and kept if size and mtime are the same.
+// fds are reference counted, a replaced entry is closed by its last user.
+// files up to open_file_cache_mem_max are read into memory, together
+// with their response headers, within open_file_cache_mem bytes
+//
+
+#ifndef FANCY_FILE_CACHE_H
+#define FANCY_FILE_CACHE_H
+
+#include "base.h"
+#include "list.h"
+#include "timer.h"
+#include "location.h"
+#include "http_header.h"
+
+typedef struct cached_file      cached_file;
+typedef struct file_cache_stat  file_cache_stat;
+
+struct cached_file {
+
+    int             fd;             /* -1 for a negative entry */
+    int             status;         /* STATUS_OK, or why there is no fd */
+    struct stat     st;
+    string          suffix;         /* of the file opened, null if none */
+    const content_type  *content_type;  /* set by the first request */
+    const char      *index;         /* a directory resolved to, NULL if none */
+    char            etag[HTTP_ETAG_LEN];    /* set by the first request */
+    int             etag_len;
+
+    char            *body;          /* the whole file, NULL if not in memory */
+    string          header;         /* rendered by the first response */
+    list_node       mem_lru;
+
+    int             refs;           /* the cache holds one while it has the entry */
+    unsigned        cached:1;
+
+    int             dirfd;
+    int             wd;             /* inotify watch, -1 if none */
+    timer_msec      valid_until;
+
+    cached_file     *next;          /* hash chain */
+    cached_file     *wd_next;       /* chain of the watch table */
+    list_node       lru;            /* most recently used first */
+
+    size_t          len;
+    char            path[];         /* relative to dirfd, nul terminated */
+};
+
+struct file_cache_stat {
+    u_long          hits;
+    u_long          misses;
+    u_long          expired;        /* open_file_cache_valid passed, file changed */
+    u_long          revalidated;    /* open_file_cache_valid passed, the same file */
+    u_long          invalidated;    /* by inotify */
+    u_long          evicted;        /* to make room */
+    u_long          entries;
+    u_long          mem_hits;       /* served from memory */
+    u_long          mem_entries;
+    size_t          mem_size;
+};
+
+extern file_cache_stat file_cache_stats;
+
+/* in each worker, after the event loop is set up,
+ * locations with warmup have their small files read in */
+int file_cache_init();
+
+/* path is the normalized uri, it starts with '/'. NULL if out of memory,
+ * otherwise a reference the caller gives back with file_cache_release */
+cached_file *file_cache_open(location *loc, const char *path, size_t len);
+void file_cache_release(cached_file *f);
+
+/* the file f resolved to with ext appended, "/a.css" and ".gz" is "/a.css.gz" */
+cached_file *file_cache_open_sibling(location *loc, cached_file *f, const char *ext);
+
+/* the response headers of a file in memory, the Connection header excluded.
+ * not for precompressed siblings, they are files of their own too */
+void file_cache_set_header(cached_file *f, const char *header, size_t len);
+
+#endif //FANCY_FILE_CACHE_H
@@ -0,0 +1,86 @@
+//
+// Created by frank on 17-6-17.
+//
+
+#include <zlib.h>
+
+#include "base.h"
+#include "log.h"
+#include "event.h"
+#include "gzip.h"
+
+gzip_stat           gzip_stats;
+
+static z_stream     stream;
+static int          initialized;
+
+int gzip_init()
+{
+    int err;
+
+    /* 16 + 15: gzip header and trailer, the largest window */
+    err = deflateInit2(&stream, gzip_comp_level, Z_DEFLATED, 16 + MAX_WBITS,
+                       8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+        LOG_ERROR("deflateInit2 error %d", err);
+        return FCY_ERROR;
+    }
+    initialized = 1;
+    return FCY_OK;
+}
+
+int gzip_level()
+{
+    int level = gzip_comp_level - (int)(event_lag / GZIP_LAG_STEP);
+
+    return level < 1 ? 1 : level;
+}
+
+int gzip_begin(int level)
+{
+    assert(initialized);
+
+    if (deflateReset(&stream) != Z_OK
+        || deflateParams(&stream, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+        LOG_ERROR("deflate reset error");
+        return FCY_ERROR;
+    }
+    return FCY_OK;
+}
+
+int gzip_update(const char *data, size_t len, buffer *out, int finish)
+{
+    struct timespec begin, end;
+    size_t          avail, before = buffer_readable_bytes(out);
+    int             err;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = (uInt)len;
+
+    do {
+        /* what is left of the input at worst, plus the trailer */
+        avail = deflateBound(&stream, stream.avail_in);
+        buffer_ensure_writable_bytes(out, avail);
+        stream.next_out = (Bytef*)buffer_begin_write(out);
+        stream.avail_out = (uInt)avail;
+
+        err = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (err == Z_STREAM_ERROR) {
+            LOG_ERROR("deflate error");
+            return FCY_ERROR;
+        }
+        buffer_has_writen(out, avail - stream.avail_out);
+    } while (stream.avail_in > 0 || (finish && err != Z_STREAM_END));
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    gzip_stats.bytes_in += len;
+    gzip_stats.bytes_out += buffer_readable_bytes(out) - before;
+    gzip_stats.usec += (u_long)((end.tv_sec - begin.tv_sec) * 1000000
+                                + (end.tv_nsec - begin.tv_nsec) / 1000);
+    if (finish) {
+        ++gzip_stats.responses;
+    }
+    return FCY_OK;
+}
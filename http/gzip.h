@@ -0,0 +1,39 @@
+//
+// Created by frank on 17-6-17.
+// gzip for proxied responses, one deflate stream per worker
+// is reset for every response instead of being allocated.
+// the level goes down from gzip_comp_level as event_lag grows
+//
+
+#ifndef FANCY_GZIP_H
+#define FANCY_GZIP_H
+
+#include "base.h"
+#include "buffer.h"
+
+#define GZIP_LAG_STEP   2000    /* us of event_lag, one level less */
+
+typedef struct gzip_stat gzip_stat;
+
+struct gzip_stat {
+    u_long          responses;
+    u_long          bytes_in;
+    u_long          bytes_out;
+    u_long          usec;           /* spent in deflate */
+};
+
+extern gzip_stat gzip_stats;
+
+/* in each worker */
+int gzip_init();
+
+/* gzip_comp_level while the worker keeps up, 1 at the least */
+int gzip_level();
+
+/* a new gzip member */
+int gzip_begin(int level);
+
+/* len bytes more, appended to out; finish with the last ones */
+int gzip_update(const char *data, size_t len, buffer *out, int finish);
+
+#endif //FANCY_GZIP_H
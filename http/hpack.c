@@ -0,0 +1,496 @@
+//
+// Created by frank on 17-6-14.
+//
+
+#include "palloc.h"
+#include "hpack.h"
+
+typedef struct {
+    string      name;
+    string      value;
+} hpack_static_entry;
+
+#define HPACK_STATIC_SIZE   61
+#define HPACK_ENTRY_EXTRA   32
+
+static const hpack_static_entry static_table[HPACK_STATIC_SIZE] = {
+        {string(":authority"), string("")},
+        {string(":method"), string("GET")},
+        {string(":method"), string("POST")},
+        {string(":path"), string("/")},
+        {string(":path"), string("/index.html")},
+        {string(":scheme"), string("http")},
+        {string(":scheme"), string("https")},
+        {string(":status"), string("200")},
+        {string(":status"), string("204")},
+        {string(":status"), string("206")},
+        {string(":status"), string("304")},
+        {string(":status"), string("400")},
+        {string(":status"), string("404")},
+        {string(":status"), string("500")},
+        {string("accept-charset"), string("")},
+        {string("accept-encoding"), string("gzip, deflate")},
+        {string("accept-language"), string("")},
+        {string("accept-ranges"), string("")},
+        {string("accept"), string("")},
+        {string("access-control-allow-origin"), string("")},
+        {string("age"), string("")},
+        {string("allow"), string("")},
+        {string("authorization"), string("")},
+        {string("cache-control"), string("")},
+        {string("content-disposition"), string("")},
+        {string("content-encoding"), string("")},
+        {string("content-language"), string("")},
+        {string("content-length"), string("")},
+        {string("content-location"), string("")},
+        {string("content-range"), string("")},
+        {string("content-type"), string("")},
+        {string("cookie"), string("")},
+        {string("date"), string("")},
+        {string("etag"), string("")},
+        {string("expect"), string("")},
+        {string("expires"), string("")},
+        {string("from"), string("")},
+        {string("host"), string("")},
+        {string("if-match"), string("")},
+        {string("if-modified-since"), string("")},
+        {string("if-none-match"), string("")},
+        {string("if-range"), string("")},
+        {string("if-unmodified-since"), string("")},
+        {string("last-modified"), string("")},
+        {string("link"), string("")},
+        {string("location"), string("")},
+        {string("max-forwards"), string("")},
+        {string("proxy-authenticate"), string("")},
+        {string("proxy-authorization"), string("")},
+        {string("range"), string("")},
+        {string("referer"), string("")},
+        {string("refresh"), string("")},
+        {string("retry-after"), string("")},
+        {string("server"), string("")},
+        {string("set-cookie"), string("")},
+        {string("strict-transport-security"), string("")},
+        {string("transfer-encoding"), string("")},
+        {string("user-agent"), string("")},
+        {string("vary"), string("")},
+        {string("via"), string("")},
+        {string("www-authenticate"), string("")},
+};
+
+/* canonical code: for each length, the first code, the number of codes
+ * and where its symbols start in huff_sym */
+static const uint32_t huff_first[31] = {
+        0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+        0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+        0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+        0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+};
+static const u_short huff_count[31] = {
+        0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+static const u_short huff_offset[31] = {
+        0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92, 0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+};
+static const u_short huff_sym[257] = {
+        48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+        45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+        95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+        58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+        77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+        106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+        88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+        0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+        195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+        167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+        132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+        173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+        233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+        151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+        183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+        171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+        200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+        255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+        246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+        6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+        21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+        249, 10, 13, 22, 256,
+};
+
+static int decode_int(u_char **pos, u_char *end, int prefix, size_t *value);
+static int decode_string(u_char **pos, u_char *end, mem_pool *pool, string *s);
+static int huff_decode(const u_char *src, size_t len, u_char *dst, size_t *n);
+static int table_get(hpack *h, size_t index, mem_pool *pool,
+                     string *name, string *value, int name_only);
+static void table_add(hpack *h, string *name, string *value);
+static void table_evict(hpack *h, size_t max_size);
+static void table_compact(hpack *h);
+static int copy_string(mem_pool *pool, const char *data, size_t len, string *s);
+static void encode_int(buffer *b, u_char first, int prefix, size_t value);
+static int static_name_index(const char *name, size_t len);
+
+void hpack_init(hpack *h)
+{
+    bzero(h, offsetof(hpack, data));
+    h->max_size = HPACK_TABLE_SIZE;
+}
+
+int hpack_decode(hpack *h, u_char *p, u_char *end, mem_pool *pool,
+                 hpack_header_callback cb, void *user)
+{
+    string  name, value;
+    size_t  index;
+    int     indexing, size_update_allowed = 1;
+
+    while (p < end) {
+
+        /* 1xxxxxxx indexed header field */
+        if (*p & 0x80) {
+            if (decode_int(&p, end, 7, &index) == FCY_ERROR
+                || table_get(h, index, pool, &name, &value, 0) == FCY_ERROR) {
+                return FCY_ERROR;
+            }
+            cb(user, &name, &value);
+            size_update_allowed = 0;
+            continue;
+        }
+
+        /* 001xxxxx dynamic table size update, only at the beginning */
+        if ((*p & 0xe0) == 0x20) {
+            if (!size_update_allowed
+                || decode_int(&p, end, 5, &index) == FCY_ERROR
+                || index > HPACK_TABLE_SIZE) {
+                return FCY_ERROR;
+            }
+            h->max_size = index;
+            table_evict(h, h->max_size);
+            continue;
+        }
+        size_update_allowed = 0;
+
+        /* 01xxxxxx with incremental indexing,
+         * 0000xxxx without indexing, 0001xxxx never indexed */
+        indexing = (*p & 0xc0) == 0x40;
+        if (decode_int(&p, end, indexing ? 6 : 4, &index) == FCY_ERROR) {
+            return FCY_ERROR;
+        }
+
+        if (index == 0) {
+            if (decode_string(&p, end, pool, &name) == FCY_ERROR) {
+                return FCY_ERROR;
+            }
+        }
+        else if (table_get(h, index, pool, &name, NULL, 1) == FCY_ERROR) {
+            return FCY_ERROR;
+        }
+
+        if (decode_string(&p, end, pool, &value) == FCY_ERROR) {
+            return FCY_ERROR;
+        }
+
+        if (indexing) {
+            table_add(h, &name, &value);
+        }
+        cb(user, &name, &value);
+    }
+
+    return FCY_OK;
+}
+
+void hpack_encode_status(buffer *b, int status)
+{
+    char    digits[4];
+
+    /* :status of the static table */
+    switch (status) {
+        case 200: buffer_append_literal(b, "\x88"); return;
+        case 204: buffer_append_literal(b, "\x89"); return;
+        case 206: buffer_append_literal(b, "\x8a"); return;
+        case 304: buffer_append_literal(b, "\x8b"); return;
+        case 400: buffer_append_literal(b, "\x8c"); return;
+        case 404: buffer_append_literal(b, "\x8d"); return;
+        case 500: buffer_append_literal(b, "\x8e"); return;
+        default:
+            break;
+    }
+
+    /* literal value with the name :status (index 8) */
+    snprintf(digits, sizeof(digits), "%03d", status);
+    encode_int(b, 0x00, 4, 8);
+    encode_int(b, 0x00, 7, 3);
+    buffer_append(b, digits, 3);
+}
+
+void hpack_encode_header(buffer *b, const char *name, size_t name_len,
+                         const char *value, size_t value_len)
+{
+    int     index = static_name_index(name, name_len);
+    char    *p;
+
+    encode_int(b, 0x00, 4, (size_t)index);
+    if (index == 0) {
+        encode_int(b, 0x00, 7, name_len);
+        buffer_ensure_writable_bytes(b, name_len);
+        p = buffer_begin_write(b);
+        for (size_t i = 0; i < name_len; ++i) {
+            p[i] = (char)tolower(name[i]);
+        }
+        buffer_has_writen(b, name_len);
+    }
+
+    encode_int(b, 0x00, 7, value_len);
+    buffer_append(b, value, value_len);
+}
+
+static int decode_int(u_char **pos, u_char *end, int prefix, size_t *value)
+{
+    u_char  *p = *pos;
+    size_t  mask = ((size_t)1 << prefix) - 1;
+    size_t  v;
+    int     shift = 0;
+
+    if (p >= end) {
+        return FCY_ERROR;
+    }
+
+    v = *p++ & mask;
+    if (v == mask) {
+        do {
+            /* way more than any index or length we accept */
+            if (p >= end || shift > 21) {
+                return FCY_ERROR;
+            }
+            v += (size_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+    }
+
+    *pos = p;
+    *value = v;
+    return FCY_OK;
+}
+
+static int decode_string(u_char **pos, u_char *end, mem_pool *pool, string *s)
+{
+    u_char  *p = *pos;
+    size_t  len, n;
+    int     huffman;
+
+    if (p >= end) {
+        return FCY_ERROR;
+    }
+    huffman = *p & 0x80;
+
+    if (decode_int(&p, end, 7, &len) == FCY_ERROR
+        || len > (size_t)(end - p)
+        || len > HPACK_MAX_STRING) {
+        return FCY_ERROR;
+    }
+
+    if (!huffman) {
+        if (copy_string(pool, (char*)p, len, s) == FCY_ERROR) {
+            return FCY_ERROR;
+        }
+    }
+    else {
+        /* the shortest code is 5 bits */
+        s->data = palloc(pool, len * 8 / 5 + 1);
+        if (s->data == NULL
+            || huff_decode(p, len, (u_char*)s->data, &n) == FCY_ERROR) {
+            return FCY_ERROR;
+        }
+        s->data[n] = '\0';
+        s->len = n;
+    }
+
+    *pos = p + len;
+    return FCY_OK;
+}
+
+static int huff_decode(const u_char *src, size_t len, u_char *dst, size_t *n)
+{
+    u_char      *out = dst;
+    uint32_t    code = 0, k;
+    int         code_len = 0;
+    u_short     sym;
+
+    for (size_t i = 0; i < len; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((src[i] >> bit) & 1);
+            if (++code_len < 5) {
+                continue;
+            }
+
+            k = code - huff_first[code_len];
+            if (k < huff_count[code_len]) {
+                sym = huff_sym[huff_offset[code_len] + k];
+                if (sym == 256) {
+                    /* EOS must not appear in a string */
+                    return FCY_ERROR;
+                }
+                *out++ = (u_char)sym;
+                code = 0;
+                code_len = 0;
+            }
+            else if (code_len == 30) {
+                return FCY_ERROR;
+            }
+        }
+    }
+
+    /* padded with at most 7 bits of the EOS prefix */
+    if (code_len > 7 || code != ((uint32_t)1 << code_len) - 1) {
+        return FCY_ERROR;
+    }
+
+    *n = out - dst;
+    return FCY_OK;
+}
+
+static int table_get(hpack *h, size_t index, mem_pool *pool,
+                     string *name, string *value, int name_only)
+{
+    hpack_entry *e;
+    char        *data;
+
+    if (index == 0) {
+        return FCY_ERROR;
+    }
+
+    /* strings are copied, the caller may change them in place */
+    if (index <= HPACK_STATIC_SIZE) {
+        const hpack_static_entry *se = &static_table[index - 1];
+        if (copy_string(pool, se->name.data, se->name.len, name) == FCY_ERROR) {
+            return FCY_ERROR;
+        }
+        if (!name_only) {
+            return copy_string(pool, se->value.data, se->value.len, value);
+        }
+        return FCY_OK;
+    }
+
+    index -= HPACK_STATIC_SIZE;
+    if (index > h->n) {
+        return FCY_ERROR;
+    }
+
+    /* index 1 is the newest entry */
+    e = &h->entries[(h->head + HPACK_TABLE_SIZE / 32 - index) % (HPACK_TABLE_SIZE / 32)];
+    data = h->data + e->offset;
+    if (copy_string(pool, data, e->name_len, name) == FCY_ERROR) {
+        return FCY_ERROR;
+    }
+    if (!name_only) {
+        return copy_string(pool, data + e->name_len, e->value_len, value);
+    }
+    return FCY_OK;
+}
+
+static void table_add(hpack *h, string *name, string *value)
+{
+    size_t      size = name->len + value->len + HPACK_ENTRY_EXTRA;
+    size_t      len = name->len + value->len;
+    hpack_entry *e;
+
+    /* an entry larger than the table empties it */
+    if (size > h->max_size) {
+        table_evict(h, 0);
+        return;
+    }
+    table_evict(h, h->max_size - size);
+
+    if (h->data_end + len > sizeof(h->data)) {
+        table_compact(h);
+    }
+
+    e = &h->entries[h->head];
+    e->offset = h->data_end;
+    e->name_len = (u_short)name->len;
+    e->value_len = (u_short)value->len;
+    memcpy(h->data + h->data_end, name->data, name->len);
+    memcpy(h->data + h->data_end + name->len, value->data, value->len);
+    h->data_end += len;
+
+    if (h->n == 0) {
+        h->data_start = e->offset;
+    }
+    h->head = (h->head + 1) % (HPACK_TABLE_SIZE / 32);
+    ++h->n;
+    h->size += size;
+}
+
+/* drop the oldest entries until size fits */
+static void table_evict(hpack *h, size_t max_size)
+{
+    hpack_entry *e;
+
+    while (h->size > max_size) {
+        e = &h->entries[(h->head + HPACK_TABLE_SIZE / 32 - h->n) % (HPACK_TABLE_SIZE / 32)];
+        h->size -= e->name_len + e->value_len + HPACK_ENTRY_EXTRA;
+        --h->n;
+        if (h->n == 0) {
+            h->data_start = h->data_end = 0;
+        }
+        else {
+            h->data_start = e->offset + e->name_len + e->value_len;
+        }
+    }
+}
+
+/* live entries are at most HPACK_TABLE_SIZE bytes, half of data */
+static void table_compact(hpack *h)
+{
+    u_int   shift = h->data_start;
+
+    memmove(h->data, h->data + shift, h->data_end - shift);
+    for (u_int i = 1; i <= h->n; ++i) {
+        h->entries[(h->head + HPACK_TABLE_SIZE / 32 - i) % (HPACK_TABLE_SIZE / 32)].offset -= shift;
+    }
+    h->data_start = 0;
+    h->data_end -= shift;
+}
+
+static int copy_string(mem_pool *pool, const char *data, size_t len, string *s)
+{
+    s->data = palloc(pool, len + 1);
+    if (s->data == NULL) {
+        return FCY_ERROR;
+    }
+    memcpy(s->data, data, len);
+    s->data[len] = '\0';
+    s->len = len;
+    return FCY_OK;
+}
+
+static void encode_int(buffer *b, u_char first, int prefix, size_t value)
+{
+    u_char  bytes[16];
+    size_t  n = 0;
+    size_t  mask = ((size_t)1 << prefix) - 1;
+
+    if (value < mask) {
+        bytes[n++] = (u_char)(first | value);
+    }
+    else {
+        bytes[n++] = (u_char)(first | mask);
+        value -= mask;
+        while (value >= 0x80) {
+            bytes[n++] = (u_char)(value | 0x80);
+            value >>= 7;
+        }
+        bytes[n++] = (u_char)value;
+    }
+    buffer_append(b, (char*)bytes, n);
+}
+
+/* 1 + position in the static table, 0 if the name is not there */
+static int static_name_index(const char *name, size_t len)
+{
+    /* skip the pseudo headers */
+    for (int i = 14; i < HPACK_STATIC_SIZE; ++i) {
+        if (static_table[i].name.len == len
+            && strncasecmp(static_table[i].name.data, name, len) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+//
+// Created by frank on 17-6-14.
+// HPACK (RFC 7541) for http/2 header blocks:
+// the decoder keeps the dynamic table, the encoder never indexes
+//
+
+#ifndef FANCY_HPACK_H
+#define FANCY_HPACK_H
+
+#include "base.h"
+#include "buffer.h"
+
+#define HPACK_TABLE_SIZE    4096    /* SETTINGS_HEADER_TABLE_SIZE, the default */
+#define HPACK_MAX_STRING    8192    /* a longer name or value is refused */
+
+typedef struct hpack        hpack;
+typedef struct hpack_entry  hpack_entry;
+typedef void (*hpack_header_callback)(void *user, string *name, string *value);
+
+struct hpack_entry {
+    u_int       offset;     /* name and value follow each other in data */
+    u_short     name_len;
+    u_short     value_len;
+};
+
+struct hpack {
+
+    size_t      size;       /* as RFC 7541 counts it, 32 bytes more per entry */
+    size_t      max_size;
+
+    /* ring, the newest entry is right before head */
+    u_int       head;
+    u_int       n;
+    hpack_entry entries[HPACK_TABLE_SIZE / 32];
+
+    /* live entries are in [data_start, data_end), compacted when full */
+    u_int       data_start;
+    u_int       data_end;
+    char        data[HPACK_TABLE_SIZE * 2];
+};
+
+void hpack_init(hpack *h);
+
+/* a whole header block, decoded strings are copied into pool
+ * and nul terminated, FCY_ERROR is a COMPRESSION_ERROR */
+int hpack_decode(hpack *h, u_char *p, u_char *end, mem_pool *pool,
+                 hpack_header_callback cb, void *user);
+
+/* literal header fields without indexing, the name is put in lower case */
+void hpack_encode_status(buffer *b, int status);
+void hpack_encode_header(buffer *b, const char *name, size_t name_len,
+                         const char *value, size_t value_len);
+
+#endif //FANCY_HPACK_H
@@ -10,6 +10,7 @@
 #include "connection.h"
 #include "request.h"
 #include "upstream.h"
+#include "http2.h"
 
 /* generic handler */
 static void accept_h(event *);
@@ -32,20 +33,81 @@ static void send_file_h(event *);
 /* a request is finished, connection can be closed or keep alive */
 static void finalize_request_h(event *);
 
+/* keep-alive: go on with a pipelined request, or wait for the next one */
+static void next_request(connection *conn);
+static void flush_response_h(event *);
+static void flush_pipeline_h(event *);
+static void keepalive_idle(connection *conn);
+static void make_response_headers(request *rqst);
+static void make_validators(buffer *b, cached_file *f);
+static void append_template(buffer *b, string *tmpl, size_t date_offset);
+static int make_templates();
+static int inline_static_file(request *rqst);
+
 static void response_and_close(connection *conn, int status_code);
-static void close_connection(connection *conn);
 
-static int tcp_listen();
+/* h2c by prior knowledge, FCY_AGAIN for a part of the preface */
+static int http2_preface(buffer *in);
+
+/* evict the least recently used keep-alive connection */
+static connection *reclaim_idle_connection();
+static timer_msec keepalive_timer(connection *conn);
+static server *request_server(connection *conn);
+
+/* stop polling the listen socket while out of connections */
+static void accept_disable();
+static void accept_enable();
+
+static int tcp_listen(int port);
+
+/* kernel hands pending connections of a closed listener to its siblings */
+static int          accept_migrate;
+static int          accept_migrate_enabled();
+
+static int          accept_disabled;
+static timer_msec   accept_disabled_since;
+static u_long       accept_disabled_times;
+static timer_msec   accept_disabled_msec;
+
+static u_long       idle_reclaimed;
+
+/* pipelined requests handled in one go, bounds the recursion */
+static int          pipeline_depth;
+
+/* "HTTP/1.1 200 OK\r\nServer: fancy beta\r\nDate: ", the date follows */
+static string       status_lines[STATUS_COUNT];
+/* whole responses of the statuses with nothing else to say */
+static string       error_pages[STATUS_COUNT];
 
 int accept_init()
 {
-    connection *conn = conn_get();
-    if (conn == NULL) {
+    if (make_templates() == FCY_ERROR) {
         return FCY_ERROR;
     }
 
-    conn->sockfd = tcp_listen();
-    conn_enable_accept(conn, accept_h);
+    for (size_t i = 0; i < listenings->size; ++i) {
+        listening *ls = array_at(listenings, i);
+
+        connection *conn = conn_get();
+        if (conn == NULL) {
+            return FCY_ERROR;
+        }
+
+        conn->sockfd = tcp_listen(ls->port);
+        if (conn->sockfd == FCY_ERROR) {
+            conn_free(conn);
+            return FCY_ERROR;
+        }
+
+        conn->info->listening = ls;
+        conn_enable_accept(conn, accept_h);
+        ls->conn = conn;
+
+        LOG_INFO("worker listening port %d", ls->port);
+    }
+
+    accept_migrate = master_process && worker_processes > 1
+                     && accept_migrate_enabled();
 
     return FCY_OK;
 }
@@ -53,12 +115,16 @@ int accept_init()
 static void accept_h(event *ev)
 {
     connection *conn = conn_get();
+    if (conn == NULL) {
+        conn = reclaim_idle_connection();
+    }
     if (conn == NULL) {
         LOG_WARN("not enough idle connections, current %d", worker_connections);
+        accept_disable();
         return;
     }
 
-    struct sockaddr_in  *addr = &conn->addr;
+    struct sockaddr_in  *addr = &conn->info->addr;
     socklen_t           len = sizeof(*addr);
     int                 connfd;
 
@@ -71,17 +137,33 @@ inter:
             case EAGAIN:
                 conn_free(conn);
                 return;
+            case EMFILE:
+            case ENFILE:
+                LOG_SYSERR("accept4 error");
+                conn_free(conn);
+                accept_disable();
+                return;
             default:
                 LOG_SYSERR("accept4 error");
+                conn_free(conn);
                 return;
         }
     }
 
     conn->sockfd = connfd;
+    conn->info->listening = ev->conn->info->listening;
+
+    /* wake up for EPOLLOUT only when the socket is nearly drained */
+    if (tcp_notsent_lowat > 0) {
+        if (setsockopt(connfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                       &tcp_notsent_lowat, sizeof(tcp_notsent_lowat)) == -1) {
+            LOG_SYSERR("%s set TCP_NOTSENT_LOWAT error", conn_str(conn));
+        }
+    }
 
     conn_enable_read(conn, read_request_headers_h);
 
-    timer_add(&conn->read, (timer_msec)request_timeout);
+    timer_add(&conn->read, (timer_msec)conn_server(conn)->request_timeout);
 
     LOG_DEBUG("%s [up]", conn_str(conn));
 
@@ -97,6 +179,12 @@ static void response_and_close(connection *conn, int status_code)
 
     rqst->should_keep_alive = 0;
     rqst->status_code = status_code;
+    make_response_headers(rqst);
+
+    /* batched responses may be being flushed */
+    if (conn->write.active) {
+        conn_disable_write(conn);
+    }
     conn_enable_write(conn, write_response_headers_h);
     write_response_headers_h(&conn->write);
 }
@@ -105,10 +193,17 @@ static void read_request_headers_h(event *ev)
 {
     connection *conn = ev->conn;
 
+    /* keep-alive timeout, close quietly */
+    if (ev->timeout && conn->idle) {
+        LOG_DEBUG("%s keep-alive timeout", conn_str(conn));
+        close_connection(conn);
+        return;
+    }
+
     /* peer timeout */
     if (ev->timeout) {
         LOG_WARN("%s request timeout (%dms)",
-                 conn_str(conn), request_timeout);
+                 conn_str(conn), request_server(conn)->request_timeout);
         conn_disable_read(conn);
         response_and_close(conn, STATUS_REQUEST_TIME_OUT);
         return;
@@ -129,6 +224,13 @@ static void read_request_headers_h(event *ev)
     /* 读http request header */
     CONN_READ(conn, header_in, close_connection(conn));
 
+    /* next request arrives, switch to request timeout */
+    if (conn->idle) {
+        conn_set_idle(conn, 0);
+        timer_del(ev);
+        timer_add(ev, (timer_msec)request_server(conn)->request_timeout);
+    }
+
     /* 解析请求 */
     parse_request_h(ev);
 }
@@ -137,17 +239,39 @@ static void parse_request_h(event *ev)
 {
     connection  *conn = ev->conn;
     request     *rqst = conn->app;
+    int         err;
+
+    /* only as the first thing on the connection */
+    if (conn_server(conn)->http2 && conn->info->app_count == 1) {
+        switch (http2_preface(rqst->header_in)) {
+            case FCY_AGAIN:
+                return;
+            case FCY_OK:
+                if (http2_init(conn, rqst) == FCY_ERROR) {
+                    LOG_ERROR("%s h2c init failed", conn_str(conn));
+                    close_connection(conn);
+                }
+                return;
+            default:
+                break;
+        }
+    }
 
-    int err = request_parse(rqst);
+    err = request_parse(rqst);
     switch (err) {
 
         case FCY_ERROR:
-            LOG_INFO("%s request parse error, \"%s\"", conn_str(conn));
+            LOG_INFO("%s request parse error", conn_str(conn));
             conn_disable_read(conn);
             response_and_close(conn, STATUS_BAD_REQUEST);
             return;
 
         case FCY_AGAIN:
+            /* don't hold back responses of earlier pipelined requests */
+            if (!buffer_empty(rqst->header_out) && !conn->write.active) {
+                conn_enable_write(conn, flush_response_h);
+                flush_response_h(&conn->write);
+            }
             return;
 
         default:
@@ -156,20 +280,50 @@ static void parse_request_h(event *ev)
 
     buffer_retrieve(rqst->header_in, rqst->parser.where);
 
-    /* content too long */
-    if (rqst->content_length > HTTP_MAX_CONTENT_LENGTH) {
-        LOG_WARN("%s content-length too long, %d bytes",
-                 conn_str(conn), rqst->content_length);
+    /* parsed before the pending flush, it only has to write now */
+    if (conn->write.active && conn->write.handler == flush_pipeline_h) {
+        conn->write.handler = flush_response_h;
+    }
+
+    /* reject before reading a body that would be thrown away */
+    err = check_request_header(rqst);
+    if (err == FCY_ERROR) {
+        LOG_INFO("%s bad request header, status %d",
+                 conn_str(conn), rqst->status_code);
         conn_disable_read(conn);
-        response_and_close(conn, STATUS_REQUEST_HEADER_FIELD_TOO_LARGE);
+        response_and_close(conn, rqst->status_code);
         return;
     }
 
-    /* move body */
-    if (!buffer_empty(rqst->header_in)) {
+    /* Upgrade: h2c without a body, the response goes on stream 1 */
+    if (rqst->srv->http2 && rqst->upgrade_h2c
+        && !rqst->is_chunked && rqst->content_length == 0
+        && http_headers_get(&rqst->headers, HEADER_HTTP2_SETTINGS) != NULL
+        && buffer_empty(rqst->header_out) && !conn->write.active) {
+        if (http2_upgrade(conn, rqst) == FCY_ERROR) {
+            LOG_INFO("%s bad h2c upgrade", conn_str(conn));
+            conn_disable_read(conn);
+            response_and_close(conn, STATUS_BAD_REQUEST);
+        }
+        return;
+    }
+
+    /* decoded in place, whatever follows the last chunk stays behind it */
+    if (rqst->is_chunked && !buffer_empty(rqst->header_in)) {
         buffer_transfer(rqst->body_in, rqst->header_in);
     }
 
+    /* move body, what follows is the next pipelined request */
+    if (rqst->has_content_length_header && rqst->content_length > 0
+        && !buffer_empty(rqst->header_in)) {
+        size_t n = buffer_readable_bytes(rqst->header_in);
+        if (n > (size_t)rqst->content_length) {
+            n = (size_t)rqst->content_length;
+        }
+        buffer_append(rqst->body_in, buffer_peek(rqst->header_in), n);
+        buffer_retrieve(rqst->header_in, n);
+    }
+
     conn->read.handler = read_request_body;
     read_request_body(ev);
 }
@@ -189,6 +343,7 @@ static void read_request_body(event *ev)
 
     buffer *body_in = rqst->body_in;
     size_t readable;
+    int    err;
 
     /* content-length */
     if (rqst->has_content_length_header) {
@@ -196,32 +351,55 @@ static void read_request_body(event *ev)
         if (readable >= (size_t)rqst->content_length) {
             goto done;
         }
+        if (!buffer_empty(rqst->header_out) && !conn->write.active) {
+            conn_enable_write(conn, flush_response_h);
+        }
         CONN_READ(conn, body_in, close_connection(conn));
         if (buffer_readable_bytes(body_in) < (size_t)rqst->content_length) {
             return;
         }
     }
     else if (rqst->is_chunked) {
-        LOG_ERROR("CHUNKED");
-        pause();
+        for (;;) {
+            err = request_read_chunked(rqst);
+            if (err == FCY_ERROR) {
+                LOG_INFO("%s bad chunked body", conn_str(conn));
+                conn_disable_read(conn);
+                response_and_close(conn, STATUS_BAD_REQUEST);
+                return;
+            }
+            if (rqst->srv->client_max_body_size > 0
+                && rqst->reader.size > (size_t)rqst->srv->client_max_body_size) {
+                LOG_WARN("%s chunked body too large", conn_str(conn));
+                conn_disable_read(conn);
+                response_and_close(conn, STATUS_PAYLOAD_TOO_LARGE);
+                return;
+            }
+            if (err == FCY_OK) {
+                goto done;
+            }
+            if (!buffer_empty(rqst->header_out) && !conn->write.active) {
+                conn_enable_write(conn, flush_response_h);
+            }
+            CONN_READ(conn, body_in, close_connection(conn));
+        }
     }
 
-    /* http request read and parse is done */
+    /* http request read and parse is done,
+     * bytes past content_length are left for request_reset */
 done:
-    readable = buffer_readable_bytes(body_in);
-    if (readable > (size_t)rqst->content_length) {
-        LOG_WARN("%s read extra request body", conn_str(conn));
-        /* trunc */
-        buffer_unwrite(body_in, readable - rqst->content_length);
-    }
-
     conn_disable_read(conn);
 
+    /* the response writes what is batched first */
+    if (conn->write.active) {
+        conn_disable_write(conn);
+    }
+
     if (ev->timer_set) {
         timer_del(ev);
     }
 
-    if (conn->app_count >= keep_alive_requests) {
+    if (conn->info->app_count >= rqst->srv->keep_alive_requests) {
         LOG_WARN("%s too many requests", conn_str(conn));
         rqst->should_keep_alive = 0;
     }
@@ -232,16 +410,43 @@ done:
 static void process_request_h(event *ev)
 {
     connection  *conn = ev->conn;
-    connection  *peer = conn->peer;
+    connection  *peer;
     request     *rqst = conn->app;
+    int         err;
 
-    int err = check_request_header(rqst);
-    if (err == FCY_ERROR) {
-        response_and_close(conn, rqst->status_code);
+    /* only for this response, finalize_request_h lifts it */
+    if (rqst->loc != NULL && rqst->loc->limit_rate > 0) {
+        conn_limit_rate(conn, (size_t)rqst->loc->limit_rate,
+                        (size_t)rqst->loc->limit_rate_after);
+    }
+
+    if (rqst->is_static && rqst->loc->return_code != 0) {
+        /* rendered at config time, only the date changes */
+        location *loc = rqst->loc;
+
+        append_template(rqst->header_out, &loc->return_response[rqst->should_keep_alive],
+                        loc->return_date);
+        if (rqst->should_keep_alive) {
+            finalize_request_h(&conn->write);
+            return;
+        }
+        conn_enable_write(conn, write_response_headers_h);
+        write_response_headers_h(&conn->write);
         return;
     }
+    else if (rqst->is_static && rqst->loc->status) {
+        char    body[1024];
+        int     n = request_status_page(rqst, body, sizeof(body));
+
+        assert(n > 0);
+        make_response_headers(rqst);
+        buffer_append(rqst->header_out, body, (size_t)n);
 
-    if (rqst->is_static) {
+        conn_enable_write(conn, write_response_headers_h);
+        write_response_headers_h(&conn->write);
+        return;
+    }
+    else if (rqst->is_static) {
         /* static file request */
 
         err = open_static_file(rqst);
@@ -254,6 +459,41 @@ static void process_request_h(event *ev)
         LOG_DEBUG("%s request \"%s\" %ld bytes",
                   conn_str(conn), rqst->uri.data, rqst->sbuf.st_size);
 
+        make_response_headers(rqst);
+        if (rqst->n_ranges > 1) {
+            request_multipart_next(rqst, rqst->header_out);
+        }
+
+        /* 304, the headers are all */
+        if (rqst->status_code == STATUS_NOT_MODIFIED) {
+            request_close_file(rqst);
+            if (rqst->should_keep_alive) {
+                finalize_request_h(&conn->write);
+                return;
+            }
+        }
+        /* the body is in memory: one write, no file system calls */
+        else if (rqst->file->body != NULL && rqst->n_ranges <= 1) {
+            buffer_append(rqst->header_out, rqst->file->body + rqst->send_offset,
+                          (size_t)rqst->sbuf.st_size);
+            ++file_cache_stats.mem_hits;
+            request_close_file(rqst);
+            if (rqst->should_keep_alive) {
+                finalize_request_h(&conn->write);
+                return;
+            }
+        }
+        /* more pipelined requests, or a batch to join: copy a small file
+         * behind its headers and write them all at once later */
+        else if (rqst->should_keep_alive
+            && (!buffer_empty(rqst->header_in) || !buffer_empty(rqst->header_out))
+            && rqst->sbuf.st_size <= HTTP_PIPELINE_INLINE
+            && rqst->n_ranges <= 1
+            && inline_static_file(rqst) == FCY_OK) {
+            finalize_request_h(&conn->write);
+            return;
+        }
+
         conn_enable_write(conn, write_response_headers_h);
         write_response_headers_h(&conn->write);
         return;
@@ -264,7 +504,21 @@ static void process_request_h(event *ev)
         LOG_DEBUG("%s upstream %s \"%s\"",
                   conn_str(conn), method_str[rqst->parser.method].data, rqst->uri.data);
 
+        peer = conn_get_peer(conn);
+        if (peer == NULL) {
+            LOG_WARN("%s not enough peer connections", conn_str(conn));
+            response_and_close(conn, STATUS_SERVICE_UNAVAILABLE);
+            return;
+        }
+        peer->info->addr = rqst->loc->proxy_pass;
+
+        /* the connection is closed after proxying, drop the pipeline */
         rqst->should_keep_alive = 0;
+        if ((rqst->has_content_length_header || rqst->is_chunked)
+            && buffer_readable_bytes(rqst->body_in) > (size_t)rqst->content_length) {
+            buffer_unwrite(rqst->body_in,
+                           buffer_readable_bytes(rqst->body_in) - rqst->content_length);
+        }
         peer_connect_h(&peer->write);
         return;
     }
@@ -289,7 +543,7 @@ static void peer_connect_h(event *ev)
     }
 
     inter:
-    err = connect(peer->sockfd, &peer->addr, sizeof(peer->addr));
+    err = connect(peer->sockfd, &peer->info->addr, sizeof(peer->info->addr));
     if (err == -1) {
         switch (errno) {
             case EINTR:
@@ -298,7 +552,7 @@ static void peer_connect_h(event *ev)
             // common case
             case EINPROGRESS:
                 conn_enable_write(peer, upstream_write_request_h);
-                timer_add(&peer->write, (timer_msec)upstream_timeout);
+                timer_add(&peer->write, (timer_msec)((request*)conn->app)->srv->upstream_timeout);
                 return;
 
             default:
@@ -358,13 +612,14 @@ static void upstream_write_request_h(event *ev)
         if (ev->timer_set) {
             timer_del(ev);
         }
+
+        request_headers_htop(rqst, upstm->header_out);
     }
 
     /* write request buffer to upstream */
     buffer *header_out = upstm->header_out;
     buffer *body_out = rqst->body_in;
 
-    request_headers_htop(rqst, header_out);
     /* TODO: use writev instead */
     CONN_WRITE(peer, header_out,
               close_connection(conn));
@@ -377,7 +632,7 @@ static void upstream_write_request_h(event *ev)
 
     /* set read timeout */
     assert(!peer->write.timer_set);
-    timer_add(&peer->read, (timer_msec)upstream_timeout);
+    timer_add(&peer->read, (timer_msec)rqst->srv->upstream_timeout);
 
     conn_disable_write(peer);
     conn_enable_read(peer, upstream_read_response_header_h);
@@ -392,7 +647,7 @@ static void upstream_read_response_header_h(event *ev)
 
     if (ev->timeout) {
         LOG_WARN("%s upstream response timeout (%dms)",
-                 conn_str(conn), upstream_timeout);
+                 conn_str(conn), ((request*)conn->app)->srv->upstream_timeout);
         conn_disable_read(peer);
         response_and_close(conn, STATUS_INTARNAL_SEARVE_ERROR);
         return;
@@ -452,6 +707,7 @@ static void upstream_read_response_body(event *ev)
 {
     connection  *peer = ev->conn;
     connection  *conn = peer->peer;
+    request     *rqst = conn->app;
     upstream    *upstm = peer->app;
     buffer      *b = upstm->body_in;
 
@@ -483,6 +739,10 @@ static void upstream_read_response_body(event *ev)
                 LOG_ERROR("upstream_read_chunked error");
                 goto error;
             case FCY_AGAIN:
+                if (upstm->reader.size > HTTP_MAX_CONTENT_LENGTH) {
+                    LOG_WARN("%s upstream chunked body too long", conn_str(conn));
+                    goto error;
+                }
                 return;
             default:
                 goto done;
@@ -503,6 +763,10 @@ static void upstream_read_response_body(event *ev)
     }
 
     conn_disable_read(peer);
+
+    upstream_gzip(upstm, rqst);
+    upstream_headers_htop(upstm, rqst->header_out);
+
     conn_enable_write(conn, write_response_all_h);
     write_response_all_h(&conn->write);
 }
@@ -516,7 +780,6 @@ static void write_response_all_h(event *ev)
     buffer      *body_out = uptm->body_in;
 
     /* TODO: use writev instead */
-    upstream_headers_htop(uptm, header_out);
     CONN_WRITE(conn, header_out,
               close_connection(conn));
     if (body_out != NULL) {
@@ -532,51 +795,211 @@ static void write_response_headers_h(event *ev)
 {
     connection  *conn = ev->conn;
     request     *rqst = conn->app;
+
+    /* header_out may start with batched responses of earlier requests */
+    CONN_WRITE(conn, rqst->header_out,
+              close_connection(conn));
+
+    if (rqst->send_fd > 0) {
+        ev->handler = send_file_h;
+    } else {
+        conn_disable_write(conn);
+        ev->handler = finalize_request_h;
+    }
+
+    ev->handler(ev);
+}
+
+/* appended to header_out */
+static void make_response_headers(request *rqst)
+{
     buffer      *b = rqst->header_out;
-    string      *status_str = &status_code_out_str[rqst->status_code];
+    int         status = rqst->status_code;
+    string      *status_str = &status_code_out_str[status];
+    cached_file *f = rqst->file;
+    size_t      start = buffer_readable_bytes(b);
+    int         n;
+
+    /* nothing but the status, the whole response is rendered */
+    if (error_pages[status].data != NULL && !rqst->should_keep_alive) {
+        append_template(b, &error_pages[status], status_lines[status].len);
+        return;
+    }
 
-    /* write header_out */
-    if (buffer_empty(b)) {
-        /* response line */
-        buffer_append_literal(b, "HTTP/1.1 ");
-        buffer_append_str(b, status_str);
-        buffer_append_literal(b, "\r\nServer: fancy beta");
-        buffer_append_literal(b, "\r\nContent-Type: ");
-
-        if (rqst->status_code == STATUS_OK) {
-            buffer_append(b, rqst->content_type,
-                         strlen(rqst->content_type));
-            buffer_append_literal(b, "\r\nContent-Length: ");
-            int n = sprintf(buffer_begin_write(b), "%ld", rqst->sbuf.st_size);
+    /* a file in memory, the headers are rendered by an earlier response */
+    if (f != NULL && f->header.data != NULL && rqst->content_encoding == NULL
+        && status == STATUS_OK) {
+        append_template(b, &f->header, status_lines[STATUS_OK].len);
+        goto connection;
+    }
+
+    /* response line, Server and Date */
+    buffer_append_str(b, &status_lines[status]);
+    buffer_append(b, http_date(), HTTP_TIME_LEN);
+
+    if (status == STATUS_NOT_MODIFIED) {
+        /* no body, the validators tell what the client has is fresh */
+        make_validators(b, f);
+        if (rqst->vary_encoding) {
+            buffer_append_literal(b, "\r\nVary: Accept-Encoding");
+        }
+    }
+    else if (status == STATUS_OK || status == STATUS_PARTIAL_CONTENT) {
+        buffer_ensure_writable_bytes(b, 128);
+        if (rqst->n_ranges > 1) {
+            n = sprintf(buffer_begin_write(b),
+                        "\r\nContent-Type: multipart/byteranges; boundary=%020lu"
+                        "\r\nContent-Length: %ld",
+                        rqst->boundary, request_multipart_length(rqst));
+        }
+        else {
+            buffer_append_str(b, &rqst->content_type->header);
+            n = sprintf(buffer_begin_write(b), "%ld", rqst->sbuf.st_size);
+        }
+        buffer_has_writen(b, (size_t)n);
+
+        if (rqst->n_ranges == 1) {
+            buffer_ensure_writable_bytes(b, 96);
+            n = sprintf(buffer_begin_write(b), "\r\nContent-Range: bytes %ld-%ld/%ld",
+                        rqst->ranges[0].start, rqst->ranges[0].end, f->st.st_size);
             buffer_has_writen(b, (size_t)n);
-        } else {
-            buffer_append_literal(b, "text/html; charset=utf-8");
-            buffer_append_crlf(b);
-            buffer_append_str(b, status_str);
         }
+        if (f != NULL) {
+            buffer_append_literal(b, "\r\nAccept-Ranges: bytes");
+            make_validators(b, f);
+        }
+        if (rqst->content_encoding != NULL) {
+            buffer_append_literal(b, "\r\nContent-Encoding: ");
+            buffer_append(b, rqst->content_encoding, strlen(rqst->content_encoding));
+        }
+        if (rqst->vary_encoding) {
+            buffer_append_literal(b, "\r\nVary: Accept-Encoding");
+        }
+    } else {
+        buffer_append_literal(b, "\r\nContent-Type: text/html; charset=utf-8");
+        buffer_append_literal(b, "\r\nContent-Length: ");
+        buffer_ensure_writable_bytes(b, 32);
+        n = sprintf(buffer_begin_write(b), "%zu", status_str->len);
+        buffer_has_writen(b, (size_t)n);
+
+        /* 416 tells the size */
+        if (status == STATUS_RANGE_NOT_SATISFIABLE && f != NULL) {
+            buffer_ensure_writable_bytes(b, 64);
+            n = sprintf(buffer_begin_write(b), "\r\nContent-Range: bytes */%ld",
+                        f->st.st_size);
+            buffer_has_writen(b, (size_t)n);
+        }
+    }
 
-        if (rqst->should_keep_alive) {
-            buffer_append_literal(b, "\r\nConnection: keep-alive\r\n\r\n");
-        } else {
-            buffer_append_literal(b, "\r\nConnection: close\r\n\r\n");
+    if (f != NULL && f->body != NULL && rqst->content_encoding == NULL
+        && status == STATUS_OK) {
+        file_cache_set_header(f, buffer_peek(b) + start, buffer_readable_bytes(b) - start);
+    }
+
+    connection:
+    if (rqst->should_keep_alive) {
+        buffer_append_literal(b, "\r\nConnection: keep-alive\r\n\r\n");
+    } else {
+        buffer_append_literal(b, "\r\nConnection: close\r\n\r\n");
+    }
+
+    if (status != STATUS_OK && status != STATUS_PARTIAL_CONTENT
+        && status != STATUS_NOT_MODIFIED) {
+        buffer_append_str(b, status_str);
+    }
+}
+
+/* one copy, then the date at date_offset */
+static void append_template(buffer *b, string *tmpl, size_t date_offset)
+{
+    char *p;
+
+    buffer_ensure_writable_bytes(b, tmpl->len);
+    p = buffer_begin_write(b);
+    memcpy(p, tmpl->data, tmpl->len);
+    memcpy(p + date_offset, http_date(), HTTP_TIME_LEN);
+    buffer_has_writen(b, tmpl->len);
+}
+
+/* the status lines, and the error responses which have nothing else */
+static int make_templates()
+{
+    static const char   server[] = "\r\nServer: fancy beta\r\nDate: ";
+    string              *status_str;
+    char                *p;
+    size_t              size;
+
+    if (status_lines[0].data != NULL) {
+        return FCY_OK;
+    }
+
+    for (int i = 0; i < STATUS_COUNT; ++i) {
+        status_str = &status_code_out_str[i];
+
+        size = sizeof("HTTP/1.1 ") - 1 + status_str->len + sizeof(server) - 1;
+        p = malloc(size + 1);
+        if (p == NULL) {
+            return FCY_ERROR;
         }
+        sprintf(p, "HTTP/1.1 %s%s", status_str->data, server);
+        status_lines[i].data = p;
+        status_lines[i].len = size;
 
-        if (rqst->status_code != STATUS_OK) {
-            buffer_append_str(b, status_str);
+        if (i == STATUS_OK || i == STATUS_PARTIAL_CONTENT || i == STATUS_NOT_MODIFIED
+            || i == STATUS_RANGE_NOT_SATISFIABLE) {
+            continue;
         }
+
+        size += HTTP_TIME_LEN + 128 + status_str->len;
+        p = malloc(size);
+        if (p == NULL) {
+            return FCY_ERROR;
+        }
+        error_pages[i].data = p;
+        error_pages[i].len = (size_t)snprintf(p, size,
+                "%s%*s\r\nContent-Type: text/html; charset=utf-8"
+                "\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                status_lines[i].data, HTTP_TIME_LEN, "", status_str->len, status_str->data);
+        assert(error_pages[i].len < size);
     }
+    return FCY_OK;
+}
 
-    CONN_WRITE(conn, b,
-              close_connection(conn));
+static void make_validators(buffer *b, cached_file *f)
+{
+    buffer_append_literal(b, "\r\nETag: ");
+    buffer_append(b, f->etag, (size_t)f->etag_len);
+    buffer_append_literal(b, "\r\nLast-Modified: ");
+    buffer_ensure_writable_bytes(b, HTTP_TIME_LEN + 1);
+    http_time(buffer_begin_write(b), f->st.st_mtime);
+    buffer_has_writen(b, HTTP_TIME_LEN);
+}
 
-    if (rqst->send_fd > 0) {
-        ev->handler = send_file_h;
-    } else {
-        conn_disable_write(conn);
-        ev->handler = finalize_request_h;
+/* copy the file behind the response headers, the file is released */
+static int inline_static_file(request *rqst)
+{
+    buffer  *b = rqst->header_out;
+    size_t  size = (size_t)rqst->sbuf.st_size;
+    size_t  done = 0;
+    ssize_t n;
+
+    buffer_ensure_writable_bytes(b, size);
+    while (done < size) {
+        n = pread(rqst->send_fd, buffer_begin_write(b) + done, size - done,
+                  rqst->send_offset + (off_t)done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            /* file changed, let sendfile do what it can */
+            return FCY_ERROR;
+        }
+        done += n;
     }
+    buffer_has_writen(b, size);
 
-    ev->handler(ev);
+    request_close_file(rqst);
+    return FCY_OK;
 }
 
 static void send_file_h(event *ev)
@@ -585,9 +1008,20 @@ static void send_file_h(event *ev)
     request     *rqst = conn->app;
     struct stat *sbuf = &rqst->sbuf;
 
-    CONN_SEND_FILE(conn, rqst->send_fd, sbuf,
+    CONN_SEND_FILE(conn, rqst->send_fd, &rqst->send_offset, sbuf,
                   close_connection(conn));
 
+    /* multipart/byteranges: the next part, or the closing boundary */
+    if (rqst->n_ranges > 1) {
+        ++rqst->range_index;
+        if (!request_multipart_next(rqst, rqst->header_out)) {
+            request_close_file(rqst);
+        }
+        ev->handler = write_response_headers_h;
+        write_response_headers_h(ev);
+        return;
+    }
+
     conn_disable_write(conn);
     finalize_request_h(ev);
 }
@@ -596,64 +1030,285 @@ static void finalize_request_h(event *ev)
 {
     connection  *conn = ev->conn;
     request     *rqst = conn->app;
-    upstream    *upstm = conn->peer->app;
 
     if (rqst->is_static || rqst->status_code != STATUS_OK) {
         LOG_DEBUG("%s response \"%s\"",
                   conn_str(conn), status_code_out_str[rqst->status_code].data);
     }
     else {
+        upstream *upstm = conn->peer->app;
         LOG_DEBUG("%s response \"%s\"",
                   conn_str(conn), upstm->parser.response_line.data);
     }
 
-    if (!rqst->should_keep_alive || conn->app_count >= keep_alive_requests) {
+    if (!rqst->should_keep_alive
+        || conn->info->app_count >= rqst->srv->keep_alive_requests) {
         close_connection(conn);
         return;
     }
 
+    if (conn->limited) {
+        conn_limit_rate(conn, 0, 0);
+    }
+    request_reset(rqst);
     conn_enable_read(conn, read_request_headers_h);
+    next_request(conn);
+}
 
-    timer_add(&conn->read, (timer_msec)request_timeout);
+static void next_request(connection *conn)
+{
+    request     *rqst = conn->app;
 
-    assert(buffer_empty(rqst->header_in));
-    request_reset(rqst);
+    /* nothing pipelined, write what is batched and wait.
+     * responses are owed until then, it is not idle yet */
+    if (buffer_empty(rqst->header_in)) {
+        if (buffer_empty(rqst->header_out)) {
+            keepalive_idle(conn);
+            return;
+        }
+        timer_add(&conn->read, (timer_msec)request_server(conn)->request_timeout);
+        /* may close the connection */
+        conn_enable_write(conn, flush_response_h);
+        flush_response_h(&conn->write);
+        return;
+    }
+
+    timer_add(&conn->read, (timer_msec)request_server(conn)->request_timeout);
+
+    /* batch is full, or the stack is deep enough:
+     * go on from the event loop after writing */
+    if (buffer_readable_bytes(rqst->header_out) >= HTTP_PIPELINE_BATCH
+        || pipeline_depth >= HTTP_PIPELINE_DEPTH) {
+        conn_enable_write(conn, flush_pipeline_h);
+        return;
+    }
+
+    ++pipeline_depth;
+    parse_request_h(&conn->read);
+    --pipeline_depth;
 }
 
-static void close_connection(connection *conn)
+/* write batched responses while waiting for input */
+static void flush_response_h(event *ev)
 {
-    /* close peer connection first */
-    connection *peer = conn->peer;
+    connection  *conn = ev->conn;
+    request     *rqst = conn->app;
 
-    if (peer->app) {
-        upstream_destroy(peer->app);
+    CONN_WRITE(conn, rqst->header_out,
+               close_connection(conn));
+
+    conn_disable_write(conn);
+    request_push(rqst);
+
+    /* no part of the next request meanwhile */
+    if (buffer_empty(rqst->header_in) && conn->read.timer_set) {
+        timer_del(&conn->read);
+        keepalive_idle(conn);
     }
-    if (peer->read.timer_set) {
-        timer_del(&peer->read);
+}
+
+/* nothing is owed to the client, the connection may be reclaimed */
+static void keepalive_idle(connection *conn)
+{
+    timer_add(&conn->read, keepalive_timer(conn));
+    conn_set_idle(conn, 1);
+
+    /* out of connections: accept_h can reclaim this one now */
+    if (accept_disabled) {
+        accept_enable();
     }
-    if (peer->write.timer_set) {
-        timer_del(&peer->write);
+}
+
+/* write batched responses, then parse the next pipelined request */
+static void flush_pipeline_h(event *ev)
+{
+    connection  *conn = ev->conn;
+    request     *rqst = conn->app;
+
+    CONN_WRITE(conn, rqst->header_out,
+               close_connection(conn));
+
+    conn_disable_write(conn);
+    request_push(rqst);
+    parse_request_h(&conn->read);
+}
+
+static int http2_preface(buffer *in)
+{
+    size_t n = buffer_readable_bytes(in);
+
+    if (n > HTTP2_PREFACE_LEN) {
+        n = HTTP2_PREFACE_LEN;
+    }
+    if (memcmp(buffer_peek(in), HTTP2_PREFACE, n) != 0) {
+        return FCY_ERROR;
     }
-    if (peer->sockfd >= 0) {
-        CHECK(close(peer->sockfd));
+    return n == HTTP2_PREFACE_LEN ? FCY_OK : FCY_AGAIN;
+}
+
+void close_connection(connection *conn)
+{
+    /* close peer connection first */
+    connection *peer = conn->peer;
+
+    if (peer != NULL) {
+        if (peer->app) {
+            upstream_destroy(peer->app);
+        }
+        if (peer->read.timer_set) {
+            timer_del(&peer->read);
+        }
+        if (peer->write.timer_set) {
+            timer_del(&peer->write);
+        }
+        if (peer->sockfd >= 0) {
+            CHECK(close(peer->sockfd));
+        }
     }
 
     /* close connection */
-    if (conn->app) {
+    if (conn->app && conn->http2) {
+        http2_destroy(conn->app);
+    }
+    else if (conn->app) {
         request_destroy(conn->app);
     }
     if (conn->read.timer_set) {
         timer_del(&conn->read);
     }
+    /* waiting for limit_rate */
+    if (conn->write.timer_set) {
+        timer_del(&conn->write);
+    }
     /* epoll will automaticly remove fd */
     CHECK(close(conn->sockfd));
 
     conn_free(conn);
 
     LOG_DEBUG("%s [down]", conn_str(conn));
+
+    if (accept_disabled) {
+        accept_enable();
+    }
+}
+
+static connection *reclaim_idle_connection()
+{
+    connection *conn = conn_idle_oldest();
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    LOG_DEBUG("%s reclaim idle connection", conn_str(conn));
+    close_connection(conn);
+    ++idle_reclaimed;
+
+    return conn_get();
+}
+
+static timer_msec keepalive_timer(connection *conn)
+{
+    int         used = conn_used();
+    int         half = worker_connections / 2;
+    int         keepalive_timeout = request_server(conn)->keepalive_timeout;
+    timer_msec  timeout, min;
+
+    if (used <= half) {
+        return (timer_msec)keepalive_timeout;
+    }
+
+    /* from keepalive_timeout at half full down to a tenth when full */
+    min = (timer_msec)keepalive_timeout / 10;
+    timeout = (timer_msec)keepalive_timeout * (worker_connections - used)
+              / (worker_connections - half);
+
+    return timeout > min ? timeout : min;
+}
+
+/* the server of the last request, the default one before Host is known */
+static server *request_server(connection *conn)
+{
+    request *rqst = conn->app;
+
+    return rqst != NULL && rqst->srv != NULL ? rqst->srv : conn_server(conn);
+}
+
+static void accept_disable()
+{
+    if (accept_disabled) {
+        return;
+    }
+
+    for (size_t i = 0; i < listenings->size; ++i) {
+        listening *ls = array_at(listenings, i);
+
+        conn_disable_read(ls->conn);
+
+        /* SO_REUSEPORT only balances between open sockets, close ours so that
+         * new connections go to the other workers. without tcp_migrate_req the
+         * pending connections would be reset, so they wait in the backlog */
+        if (accept_migrate) {
+            CHECK(close(ls->conn->sockfd));
+            ls->conn->sockfd = -1;
+        }
+    }
+
+    accept_disabled = 1;
+    accept_disabled_since = current_msec();
+    ++accept_disabled_times;
+}
+
+static void accept_enable()
+{
+    timer_msec  elapsed;
+
+    assert(accept_disabled);
+
+    for (size_t i = 0; i < listenings->size; ++i) {
+        listening *ls = array_at(listenings, i);
+
+        if (ls->conn->sockfd == -1) {
+            ls->conn->sockfd = tcp_listen(ls->port);
+            if (ls->conn->sockfd == FCY_ERROR) {
+                /* try again on the next closed connection */
+                ls->conn->sockfd = -1;
+                return;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < listenings->size; ++i) {
+        listening *ls = array_at(listenings, i);
+        conn_enable_accept(ls->conn, accept_h);
+    }
+
+    accept_disabled = 0;
+    elapsed = current_msec() - accept_disabled_since;
+    accept_disabled_msec += elapsed;
+
+    LOG_INFO("accept resumed after %lums, saturated %lu times, %lums in total, "
+             "%lu idle connections reclaimed",
+             elapsed, accept_disabled_times, accept_disabled_msec, idle_reclaimed);
+}
+
+static int accept_migrate_enabled()
+{
+    char    c = '0';
+    int     fd;
+
+    fd = open("/proc/sys/net/ipv4/tcp_migrate_req", O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    if (read(fd, &c, 1) != 1) {
+        c = '0';
+    }
+    CHECK(close(fd));
+
+    return c == '1';
 }
 
-static int tcp_listen()
+static int tcp_listen(int port)
 {
     int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (listenfd == -1) {
@@ -669,18 +1324,20 @@ static int tcp_listen()
     bzero(&servaddr, sizeof(servaddr));
     servaddr.sin_family         = AF_INET;
     servaddr.sin_addr.s_addr    = htonl(INADDR_ANY);
-    servaddr.sin_port           = htons((uint16_t)listen_on);
+    servaddr.sin_port           = htons((uint16_t)port);
 
     socklen_t addrlen = sizeof(servaddr);
     int err = bind(listenfd, (struct sockaddr*)&servaddr, addrlen);
     if (err == -1) {
         LOG_SYSERR("bind failed");
+        CHECK(close(listenfd));
         return FCY_ERROR;
     }
 
     err = listen(listenfd, 1024);
     if (err == -1) {
         LOG_SYSERR("listen failed");
+        CHECK(close(listenfd));
         return FCY_ERROR;
     }
 
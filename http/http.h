@@ -5,6 +5,11 @@
 #ifndef FANCY_HTTP_H
 #define FANCY_HTTP_H
 
+#include "connection.h"
+
 int accept_init();
 
+/* the peer and the app go with it */
+void close_connection(connection *conn);
+
 #endif //FANCY_HTTP_H
@@ -0,0 +1,1944 @@
+//
+// Created by frank on 17-6-14.
+//
+
+#include "log.h"
+#include "base.h"
+#include "timer.h"
+#include "http.h"
+#include "http2.h"
+
+/* frame types */
+#define FRAME_DATA              0x0
+#define FRAME_HEADERS           0x1
+#define FRAME_PRIORITY          0x2
+#define FRAME_RST_STREAM        0x3
+#define FRAME_SETTINGS          0x4
+#define FRAME_PUSH_PROMISE      0x5
+#define FRAME_PING              0x6
+#define FRAME_GOAWAY            0x7
+#define FRAME_WINDOW_UPDATE     0x8
+#define FRAME_CONTINUATION      0x9
+
+/* frame flags */
+#define FLAG_END_STREAM         0x01
+#define FLAG_ACK                0x01
+#define FLAG_END_HEADERS        0x04
+#define FLAG_PADDED             0x08
+#define FLAG_PRIORITY           0x20
+
+/* error codes */
+#define H2_NO_ERROR             0x0
+#define H2_PROTOCOL_ERROR       0x1
+#define H2_INTERNAL_ERROR       0x2
+#define H2_FLOW_CONTROL_ERROR   0x3
+#define H2_STREAM_CLOSED        0x5
+#define H2_FRAME_SIZE_ERROR     0x6
+#define H2_REFUSED_STREAM       0x7
+#define H2_COMPRESSION_ERROR    0x9
+#define H2_ENHANCE_YOUR_CALM    0xb
+
+/* settings */
+#define SETTINGS_ENABLE_PUSH            0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+
+/* pseudo headers of a request */
+#define PSEUDO_METHOD           0x1
+#define PSEUDO_SCHEME           0x2
+#define PSEUDO_PATH             0x4
+#define PSEUDO_AUTHORITY        0x8
+
+static http2 *h2_create(connection *c);
+static void h2_start(http2 *h2, http2_stream *upgraded);
+
+/* connection handler */
+static void h2_read_h(event *);
+static void h2_write_h(event *);
+static u_int h2_process(http2 *h2);
+static void h2_fatal(http2 *h2, u_int code);
+static void h2_set_timer(http2 *h2);
+static int h2_wait_client(http2 *h2);
+static server *h2_server(http2 *h2);
+static void h2_push(http2 *h2);
+static void h2_wakeup(http2 *h2);
+
+/* frames, a non-zero return is a connection error */
+static u_int h2_frame_data(http2 *h2, u_char flags, u_int id, u_char *p, size_t len);
+static u_int h2_frame_headers(http2 *h2, u_char flags, u_int id, u_char *p, size_t len);
+static u_int h2_frame_rst_stream(http2 *h2, u_int id, u_char *p, size_t len);
+static u_int h2_frame_settings(http2 *h2, u_char flags, u_int id, u_char *p, size_t len);
+static u_int h2_frame_ping(http2 *h2, u_char flags, u_int id, u_char *p, size_t len);
+static u_int h2_frame_window_update(http2 *h2, u_int id, u_char *p, size_t len);
+static u_int h2_frame_continuation(http2 *h2, u_char flags, u_int id, u_char *p, size_t len);
+static u_int h2_header_block(http2 *h2, u_int id, u_char flags, u_char *p, u_char *end);
+static u_int h2_apply_settings(http2 *h2, u_char *p, size_t len);
+
+/* output */
+static void h2_frame_head(u_char *h, size_t len, u_char type, u_char flags, u_int id);
+static void h2_append_frame(http2 *h2, size_t len, u_char type, u_char flags,
+                            u_int id, const void *payload);
+static void h2_send_settings(http2 *h2);
+static void h2_send_rst_stream(http2 *h2, u_int id, u_int code);
+static void h2_send_window_update(http2 *h2, u_int id, size_t increment);
+static size_t h2_max_buffered(http2 *h2);
+static void h2_consume(http2 *h2, size_t n);
+static void h2_send_goaway(http2 *h2, u_int code);
+static int h2_send(http2 *h2);
+static int h2_produce(http2 *h2);
+static int h2_send_file(http2 *h2);
+
+/* streams */
+static http2_stream *h2_stream_create(http2 *h2, u_int id, mem_pool *pool, request *r);
+static http2_stream *h2_stream_find(http2 *h2, u_int id);
+static void h2_stream_headers(http2_stream *s, u_char flags);
+static void h2_stream_request(http2_stream *s);
+static void h2_stream_static(http2_stream *s);
+static void h2_stream_return(http2_stream *s);
+static void h2_validators(http2 *h2, cached_file *f);
+static void h2_stream_error_page(http2_stream *s, int status_code);
+static void h2_stream_ready(http2_stream *s);
+static void h2_stream_done(http2_stream *s);
+static void h2_stream_reset(http2_stream *s, u_int code);
+static void h2_stream_close(http2_stream *s);
+static void h2_stream_release_body(http2_stream *s);
+static mem_pool *h2_stream_body_pool(http2_stream *s);
+static void h2_on_header(void *user, string *name, string *value);
+static void h2_ignore_header(void *user, string *name, string *value);
+static void h2_begin_headers(http2 *h2, int status);
+static void h2_send_headers(http2_stream *s);
+
+/* proxy, one upstream connection per stream */
+static void h2_proxy(http2_stream *s);
+static void h2_upstream_connect_h(event *);
+static void h2_upstream_write_h(event *);
+static void h2_upstream_read_header_h(event *);
+static void h2_upstream_read_body_h(event *);
+static void h2_upstream_respond(http2_stream *s);
+static void h2_upstream_error(http2_stream *s);
+static void h2_peer_close(http2_stream *s);
+
+static int base64url_decode(const char *s, size_t len, u_char *out, size_t *n);
+
+int http2_init(connection *c, request *r)
+{
+    http2   *h2 = h2_create(c);
+
+    if (h2 == NULL) {
+        return FCY_ERROR;
+    }
+
+    buffer_transfer(h2->in, r->header_in);
+    request_destroy(r);
+
+    LOG_DEBUG("%s h2c with prior knowledge", conn_str(c));
+
+    h2_start(h2, NULL);
+    return FCY_OK;
+}
+
+int http2_upgrade(connection *c, request *r)
+{
+    http2           *h2;
+    http2_stream    *s;
+    string          *settings;
+    u_char          payload[768];
+    size_t          n;
+
+    settings = http_headers_get(&r->headers, HEADER_HTTP2_SETTINGS);
+    if (settings == NULL || settings->len > sizeof(payload) / 3 * 4
+        || base64url_decode(settings->data, settings->len, payload, &n) == FCY_ERROR
+        || n % 6 != 0) {
+        return FCY_ERROR;
+    }
+
+    h2 = h2_create(c);
+    if (h2 == NULL) {
+        return FCY_ERROR;
+    }
+
+    /* acknowledged by the 101 */
+    if (h2_apply_settings(h2, payload, n) != H2_NO_ERROR) {
+        mem_pool_destroy(h2->pool);
+        return FCY_ERROR;
+    }
+
+    buffer_append_literal(h2->out, "HTTP/1.1 101 Switching Protocols\r\n"
+                                   "Connection: Upgrade\r\n"
+                                   "Upgrade: h2c\r\n\r\n");
+
+    if (!buffer_empty(r->header_in)) {
+        buffer_transfer(h2->in, r->header_in);
+    }
+    c->app = NULL;
+
+    LOG_DEBUG("%s upgrade to h2c", conn_str(c));
+
+    /* the request is half closed, its strings stay in its own pool */
+    h2->last_stream_id = 1;
+    s = h2_stream_create(h2, 1, r->pool, r);
+    if (s == NULL) {
+        LOG_FATAL("stream create failed, run out of memory");
+    }
+    s->end_stream = 1;
+    r->should_keep_alive = 0;
+
+    h2_start(h2, s);
+    return FCY_OK;
+}
+
+void http2_destroy(http2 *h2)
+{
+    connection      *c = h2->conn;
+    http2_stream    *s;
+
+    h2->sending = NULL;
+    while (!list_empty(&h2->streams)) {
+        s = link_data(list_head(&h2->streams), http2_stream, node);
+        h2_stream_close(s);
+    }
+
+    c->app = NULL;
+    c->http2 = 0;
+    mem_pool_destroy(h2->pool);
+}
+
+static http2 *h2_create(connection *c)
+{
+    mem_pool    *p;
+    http2       *h2;
+
+    p = mem_pool_create(HTTP_POOL_SIZE);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    h2 = pcalloc(p, sizeof(http2));
+    if (h2 == NULL) {
+        mem_pool_destroy(p);
+        return NULL;
+    }
+
+    h2->in = buffer_create(p, 2 * HTTP2_OUT_BATCH);
+    h2->out = buffer_create(p, 2 * HTTP2_OUT_BATCH);
+    h2->block_in = buffer_create(p, HTTP_BUFFER_SIZE);
+    h2->block_out = buffer_create(p, HTTP_BUFFER_SIZE);
+    if (h2->in == NULL || h2->out == NULL
+        || h2->block_in == NULL || h2->block_out == NULL) {
+        mem_pool_destroy(p);
+        return NULL;
+    }
+
+    hpack_init(&h2->hpack);
+    h2->max_frame_size = HTTP2_MAX_FRAME_SIZE;
+    h2->initial_window = HTTP2_DEFAULT_WINDOW;
+    h2->send_window = HTTP2_DEFAULT_WINDOW;
+    h2->recv_window = HTTP2_DEFAULT_WINDOW;
+    list_init(&h2->streams);
+    list_init(&h2->ready);
+
+    h2->conn = c;
+    h2->pool = p;
+    return h2;
+}
+
+/* take over the connection, frames are written behind TCP_CORK.
+ * the upgraded stream is answered right after SETTINGS */
+static void h2_start(http2 *h2, http2_stream *upgraded)
+{
+    connection  *c = h2->conn;
+    int         on = 1;
+
+    assert(c->app == NULL);
+    c->app = h2;
+    c->http2 = 1;
+
+    CHECK(setsockopt(c->sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)));
+
+    if (c->read.timer_set) {
+        timer_del(&c->read);
+    }
+    c->read.handler = h2_read_h;
+
+    h2_send_settings(h2);
+
+    if (upgraded != NULL) {
+        h2_stream_request(upgraded);
+    }
+
+    if (!buffer_empty(h2->in)) {
+        u_int err = h2_process(h2);
+        if (err != H2_NO_ERROR) {
+            h2_fatal(h2, err);
+            return;
+        }
+    }
+    if (h2_send(h2) == FCY_OK) {
+        h2_set_timer(h2);
+    }
+}
+
+static void h2_read_h(event *ev)
+{
+    connection  *c = ev->conn;
+    http2       *h2 = c->app;
+    u_int       err;
+
+    /* idle for keepalive_timeout, or a stream waits on the client
+     * for request_timeout */
+    if (ev->timeout) {
+        ev->timeout = 0;
+        if (h2->busy) {
+            LOG_WARN("%s h2c request timeout (%dms)",
+                     conn_str(c), h2_server(h2)->request_timeout);
+        }
+        else {
+            LOG_DEBUG("%s h2c idle timeout", conn_str(c));
+        }
+        h2_fatal(h2, H2_NO_ERROR);
+        return;
+    }
+
+    switch (conn_read(c, h2->in)) {
+        case FCY_AGAIN:
+            return;
+        case FCY_ERROR:
+            close_connection(c);
+            return;
+        default:
+            break;
+    }
+
+    err = h2_process(h2);
+    if (err != H2_NO_ERROR) {
+        LOG_INFO("%s h2c connection error %u", conn_str(c), err);
+        h2_fatal(h2, err);
+        return;
+    }
+
+    if (h2_send(h2) == FCY_OK) {
+        h2_set_timer(h2);
+    }
+}
+
+static void h2_write_h(event *ev)
+{
+    http2 *h2 = ev->conn->app;
+
+    if (h2_send(h2) == FCY_OK) {
+        h2_set_timer(h2);
+    }
+}
+
+/* every complete frame in the input */
+static u_int h2_process(http2 *h2)
+{
+    buffer  *in = h2->in;
+    u_char  *p, type, flags;
+    size_t  len;
+    u_int   id, err;
+
+    if (!h2->preface) {
+        if (buffer_readable_bytes(in) < HTTP2_PREFACE_LEN) {
+            return memcmp(buffer_peek(in), HTTP2_PREFACE, buffer_readable_bytes(in)) == 0
+                   ? H2_NO_ERROR : H2_PROTOCOL_ERROR;
+        }
+        if (memcmp(buffer_peek(in), HTTP2_PREFACE, HTTP2_PREFACE_LEN) != 0) {
+            return H2_PROTOCOL_ERROR;
+        }
+        buffer_retrieve(in, HTTP2_PREFACE_LEN);
+        h2->preface = 1;
+    }
+
+    while (buffer_readable_bytes(in) >= HTTP2_FRAME_HEADER_SIZE) {
+
+        p = (u_char*)buffer_peek(in);
+        len = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+        type = p[3];
+        flags = p[4];
+        id = ((u_int)p[5] << 24 | (u_int)p[6] << 16 | (u_int)p[7] << 8 | p[8]) & 0x7fffffff;
+
+        if (len > HTTP2_MAX_FRAME_SIZE) {
+            return H2_FRAME_SIZE_ERROR;
+        }
+        if (buffer_readable_bytes(in) < HTTP2_FRAME_HEADER_SIZE + len) {
+            break;
+        }
+        p += HTTP2_FRAME_HEADER_SIZE;
+
+        /* the first frame is SETTINGS, a header block is not interleaved */
+        if ((!h2->settings && type != FRAME_SETTINGS)
+            || (h2->block_stream_id != 0 && type != FRAME_CONTINUATION)) {
+            return H2_PROTOCOL_ERROR;
+        }
+
+        switch (type) {
+            case FRAME_DATA:
+                err = h2_frame_data(h2, flags, id, p, len);
+                break;
+            case FRAME_HEADERS:
+                err = h2_frame_headers(h2, flags, id, p, len);
+                break;
+            case FRAME_PRIORITY:
+                /* streams are served round robin */
+                err = id == 0 ? H2_PROTOCOL_ERROR
+                              : len != 5 ? H2_FRAME_SIZE_ERROR : H2_NO_ERROR;
+                break;
+            case FRAME_RST_STREAM:
+                err = h2_frame_rst_stream(h2, id, p, len);
+                break;
+            case FRAME_SETTINGS:
+                err = h2_frame_settings(h2, flags, id, p, len);
+                break;
+            case FRAME_PUSH_PROMISE:
+                err = H2_PROTOCOL_ERROR;
+                break;
+            case FRAME_PING:
+                err = h2_frame_ping(h2, flags, id, p, len);
+                break;
+            case FRAME_GOAWAY:
+                err = id != 0 ? H2_PROTOCOL_ERROR : H2_NO_ERROR;
+                h2->goaway = 1;
+                break;
+            case FRAME_WINDOW_UPDATE:
+                err = h2_frame_window_update(h2, id, p, len);
+                break;
+            case FRAME_CONTINUATION:
+                err = h2_frame_continuation(h2, flags, id, p, len);
+                break;
+            default:
+                /* unknown frames are ignored */
+                err = H2_NO_ERROR;
+                break;
+        }
+
+        buffer_retrieve(in, HTTP2_FRAME_HEADER_SIZE + len);
+        if (err != H2_NO_ERROR) {
+            return err;
+        }
+    }
+
+    return H2_NO_ERROR;
+}
+
+/* GOAWAY and close, what can be written is written */
+static void h2_fatal(http2 *h2, u_int code)
+{
+    connection *c = h2->conn;
+
+    h2_send_goaway(h2, code);
+    if (h2->sending == NULL) {
+        conn_write(c, h2->out);
+    }
+    close_connection(c);
+}
+
+/* the idle timer runs while there is no stream. while a stream waits on
+ * the client, request_timeout starts over on every read and write */
+static void h2_set_timer(http2 *h2)
+{
+    event *ev = &h2->conn->read;
+
+    if (h2->n_streams == 0) {
+        if (h2->busy && ev->timer_set) {
+            timer_del(ev);
+        }
+        h2->busy = 0;
+        if (!ev->timer_set) {
+            timer_add(ev, (timer_msec)h2_server(h2)->keepalive_timeout);
+        }
+        return;
+    }
+
+    if (ev->timer_set) {
+        timer_del(ev);
+    }
+    h2->busy = h2_wait_client(h2) ? 1 : 0;
+    if (h2->busy) {
+        timer_add(ev, (timer_msec)h2_server(h2)->request_timeout);
+    }
+}
+
+/* the client owes a frame, or does not read what is sent.
+ * streams waiting on an upstream have the upstream timeouts */
+static int h2_wait_client(http2 *h2)
+{
+    http2_stream    *s;
+    list_node       *node;
+
+    if (h2->conn->write.active || h2->block_stream_id != 0) {
+        return 1;
+    }
+
+    for (node = h2->streams.next; node != &h2->streams; node = node->next) {
+        s = link_data(node, http2_stream, node);
+        if (!s->end_stream && !s->responded) {
+            return 1;
+        }
+        if (s->responded && s->data_left > 0
+            && (s->send_window <= 0 || h2->send_window <= 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the default server until a stream is routed */
+static server *h2_server(http2 *h2)
+{
+    return h2->srv != NULL ? h2->srv : conn_server(h2->conn);
+}
+
+/* send what TCP_CORK holds back */
+static void h2_push(http2 *h2)
+{
+    int off = 0, on = 1;
+
+    CHECK(setsockopt(h2->conn->sockfd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off)));
+    CHECK(setsockopt(h2->conn->sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)));
+}
+
+/* out is written from the event loop, the caller may be deep in h2_process */
+static void h2_wakeup(http2 *h2)
+{
+    if (!h2->conn->write.active) {
+        conn_enable_write(h2->conn, h2_write_h);
+    }
+}
+
+static u_int h2_frame_data(http2 *h2, u_char flags, u_int id, u_char *p, size_t len)
+{
+    http2_stream    *s;
+    request         *r;
+    size_t          size = len;
+
+    if (id == 0) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    if (flags & FLAG_PADDED) {
+        if (len == 0 || p[0] >= len) {
+            return H2_PROTOCOL_ERROR;
+        }
+        size = len - 1 - p[0];
+        ++p;
+    }
+
+    /* the peer keeps to the windows it is given */
+    if ((long)len > h2->recv_window) {
+        return H2_FLOW_CONTROL_ERROR;
+    }
+    h2->recv_window -= len;
+
+    s = h2_stream_find(h2, id);
+    if (s == NULL) {
+        /* a closed stream, or an idle one */
+        h2_consume(h2, len);
+        return id > h2->last_stream_id ? H2_PROTOCOL_ERROR : H2_NO_ERROR;
+    }
+    if (s->end_stream || (long)len > s->recv_window) {
+        h2_consume(h2, len);
+        h2_stream_reset(s, s->end_stream ? H2_STREAM_CLOSED : H2_FLOW_CONTROL_ERROR);
+        return H2_NO_ERROR;
+    }
+
+    /* a stream holds client_max_body_size at most,
+     * h2_max_buffered bounds the bodies of all of them */
+    s->recv_window -= len;
+    if (len > 0 && !(flags & FLAG_END_STREAM)) {
+        s->recv_window += len;
+        h2_send_window_update(h2, id, len);
+    }
+    h2_consume(h2, len);
+
+    /* answered early, the rest of the body is dropped */
+    if (!s->responded) {
+        r = s->r;
+        s->body_size += size;
+
+        if (r->srv->client_max_body_size > 0
+            && s->body_size > (size_t)r->srv->client_max_body_size) {
+            LOG_WARN("%s h2c stream %u body too large", conn_str(h2->conn), id);
+            h2_stream_error_page(s, STATUS_PAYLOAD_TOO_LARGE);
+        }
+        else if (h2->buffered + size > h2_max_buffered(h2)) {
+            LOG_WARN("%s h2c stream %u refused, too many bodies buffered",
+                     conn_str(h2->conn), id);
+            h2_stream_reset(s, H2_REFUSED_STREAM);
+            return H2_NO_ERROR;
+        }
+        else if (size > 0) {
+            if (r->body_in == NULL) {
+                r->body_in = buffer_create(h2_stream_body_pool(s), HTTP_BUFFER_SIZE);
+                if (r->body_in == NULL) {
+                    LOG_FATAL("buffer create failed, run out of memory");
+                }
+            }
+            buffer_append(r->body_in, (char*)p, size);
+            s->buffered += size;
+            h2->buffered += size;
+        }
+    }
+
+    if (flags & FLAG_END_STREAM) {
+        s->end_stream = 1;
+        if (!s->responded) {
+            h2_stream_request(s);
+        }
+    }
+
+    return H2_NO_ERROR;
+}
+
+static u_int h2_frame_headers(http2 *h2, u_char flags, u_int id, u_char *p, size_t len)
+{
+    u_char *end = p + len;
+
+    if (id == 0) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    if (flags & FLAG_PADDED) {
+        if (len == 0 || p[0] >= len) {
+            return H2_PROTOCOL_ERROR;
+        }
+        end -= p[0];
+        ++p;
+    }
+
+    /* stream dependency and weight */
+    if (flags & FLAG_PRIORITY) {
+        if (end - p < 5) {
+            return H2_PROTOCOL_ERROR;
+        }
+        p += 5;
+    }
+
+    if (!(flags & FLAG_END_HEADERS)) {
+        buffer_retrieve_all(h2->block_in);
+        buffer_append(h2->block_in, (char*)p, end - p);
+        h2->block_stream_id = id;
+        h2->block_flags = flags;
+        return H2_NO_ERROR;
+    }
+
+    return h2_header_block(h2, id, flags, p, end);
+}
+
+static u_int h2_frame_rst_stream(http2 *h2, u_int id, u_char *p, size_t len)
+{
+    http2_stream *s;
+
+    (void)p;
+
+    if (len != 4) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+    if (id == 0 || id > h2->last_stream_id) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    s = h2_stream_find(h2, id);
+    if (s != NULL) {
+        LOG_DEBUG("%s h2c stream %u reset by peer", conn_str(h2->conn), id);
+        s->end_stream = 1;
+        h2_stream_close(s);
+    }
+    return H2_NO_ERROR;
+}
+
+static u_int h2_frame_settings(http2 *h2, u_char flags, u_int id, u_char *p, size_t len)
+{
+    u_int err;
+
+    if (id != 0) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    if (flags & FLAG_ACK) {
+        return len == 0 ? H2_NO_ERROR : H2_FRAME_SIZE_ERROR;
+    }
+    if (len % 6 != 0) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+
+    err = h2_apply_settings(h2, p, len);
+    if (err != H2_NO_ERROR) {
+        return err;
+    }
+    h2->settings = 1;
+
+    h2_append_frame(h2, 0, FRAME_SETTINGS, FLAG_ACK, 0, NULL);
+    return H2_NO_ERROR;
+}
+
+static u_int h2_frame_ping(http2 *h2, u_char flags, u_int id, u_char *p, size_t len)
+{
+    if (id != 0) {
+        return H2_PROTOCOL_ERROR;
+    }
+    if (len != 8) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+    if (!(flags & FLAG_ACK)) {
+        h2_append_frame(h2, 8, FRAME_PING, FLAG_ACK, 0, p);
+    }
+    return H2_NO_ERROR;
+}
+
+static u_int h2_frame_window_update(http2 *h2, u_int id, u_char *p, size_t len)
+{
+    http2_stream    *s;
+    long            increment;
+
+    if (len != 4) {
+        return H2_FRAME_SIZE_ERROR;
+    }
+    increment = ((long)p[0] << 24 | (long)p[1] << 16 | (long)p[2] << 8 | p[3]) & 0x7fffffff;
+
+    if (id == 0) {
+        if (increment == 0) {
+            return H2_PROTOCOL_ERROR;
+        }
+        h2->send_window += increment;
+        return h2->send_window > HTTP2_MAX_WINDOW ? H2_FLOW_CONTROL_ERROR : H2_NO_ERROR;
+    }
+
+    s = h2_stream_find(h2, id);
+    if (s == NULL) {
+        return id > h2->last_stream_id ? H2_PROTOCOL_ERROR : H2_NO_ERROR;
+    }
+    if (increment == 0) {
+        h2_stream_reset(s, H2_PROTOCOL_ERROR);
+        return H2_NO_ERROR;
+    }
+
+    s->send_window += increment;
+    if (s->send_window > HTTP2_MAX_WINDOW) {
+        h2_stream_reset(s, H2_FLOW_CONTROL_ERROR);
+        return H2_NO_ERROR;
+    }
+    h2_stream_ready(s);
+    return H2_NO_ERROR;
+}
+
+static u_int h2_frame_continuation(http2 *h2, u_char flags, u_int id, u_char *p, size_t len)
+{
+    buffer  *b = h2->block_in;
+    u_int   err;
+
+    if (h2->block_stream_id == 0 || id != h2->block_stream_id) {
+        return H2_PROTOCOL_ERROR;
+    }
+    if (buffer_readable_bytes(b) + len > HTTP2_MAX_HEADER_BLOCK) {
+        return H2_ENHANCE_YOUR_CALM;
+    }
+
+    buffer_append(b, (char*)p, len);
+    if (!(flags & FLAG_END_HEADERS)) {
+        return H2_NO_ERROR;
+    }
+
+    h2->block_stream_id = 0;
+    err = h2_header_block(h2, id, h2->block_flags,
+                          (u_char*)buffer_peek(b), (u_char*)buffer_begin_write(b));
+    buffer_retrieve_all(b);
+    return err;
+}
+
+/* a complete header block, decoded even when it is not wanted
+ * so that the dynamic table stays in step with the peer */
+static u_int h2_header_block(http2 *h2, u_int id, u_char flags, u_char *p, u_char *end)
+{
+    http2_stream    *s;
+    mem_pool        *pool;
+    int             err;
+
+    /* trailers */
+    s = h2_stream_find(h2, id);
+    if (s != NULL) {
+        if (hpack_decode(&h2->hpack, p, end, s->pool, h2_ignore_header, NULL) == FCY_ERROR) {
+            return H2_COMPRESSION_ERROR;
+        }
+        if (s->end_stream || !(flags & FLAG_END_STREAM)) {
+            h2_stream_reset(s, s->end_stream ? H2_STREAM_CLOSED : H2_PROTOCOL_ERROR);
+            return H2_NO_ERROR;
+        }
+        s->end_stream = 1;
+        if (!s->responded) {
+            h2_stream_request(s);
+        }
+        return H2_NO_ERROR;
+    }
+
+    if ((id & 1) == 0) {
+        return H2_PROTOCOL_ERROR;
+    }
+
+    if (id <= h2->last_stream_id || h2->goaway || h2->n_streams >= HTTP2_MAX_STREAMS) {
+        pool = mem_pool_create(HTTP2_STREAM_POOL_SIZE);
+        if (pool == NULL) {
+            return H2_INTERNAL_ERROR;
+        }
+        err = hpack_decode(&h2->hpack, p, end, pool, h2_ignore_header, NULL);
+        mem_pool_destroy(pool);
+        if (err == FCY_ERROR) {
+            return H2_COMPRESSION_ERROR;
+        }
+
+        if (id > h2->last_stream_id) {
+            h2->last_stream_id = id;
+            if (!h2->goaway) {
+                h2_send_rst_stream(h2, id, H2_REFUSED_STREAM);
+            }
+        }
+        return H2_NO_ERROR;
+    }
+
+    h2->last_stream_id = id;
+
+    s = h2_stream_create(h2, id, NULL, NULL);
+    if (s == NULL) {
+        return H2_INTERNAL_ERROR;
+    }
+    if (hpack_decode(&h2->hpack, p, end, s->pool, h2_on_header, s) == FCY_ERROR) {
+        return H2_COMPRESSION_ERROR;
+    }
+
+    h2_stream_headers(s, flags);
+    return H2_NO_ERROR;
+}
+
+static u_int h2_apply_settings(http2 *h2, u_char *p, size_t len)
+{
+    list_node       *node;
+    http2_stream    *s;
+    u_int           id;
+    long            value, delta;
+
+    for (; len >= 6; p += 6, len -= 6) {
+        id = (u_int)p[0] << 8 | p[1];
+        value = (long)p[2] << 24 | (long)p[3] << 16 | (long)p[4] << 8 | p[5];
+
+        switch (id) {
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                break;
+
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+                if (value > HTTP2_MAX_WINDOW) {
+                    return H2_FLOW_CONTROL_ERROR;
+                }
+                delta = value - h2->initial_window;
+                h2->initial_window = value;
+                for (node = h2->streams.next; node != &h2->streams; node = node->next) {
+                    s = link_data(node, http2_stream, node);
+                    if (s->send_window + delta > HTTP2_MAX_WINDOW) {
+                        return H2_FLOW_CONTROL_ERROR;
+                    }
+                    s->send_window += delta;
+                    h2_stream_ready(s);
+                }
+                break;
+
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < HTTP2_MAX_FRAME_SIZE || value > 0xffffff) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                h2->max_frame_size = (size_t)value;
+                break;
+
+            default:
+                /* the encoder never indexes, the table size does not matter */
+                break;
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+static void h2_frame_head(u_char *h, size_t len, u_char type, u_char flags, u_int id)
+{
+    h[0] = (u_char)(len >> 16);
+    h[1] = (u_char)(len >> 8);
+    h[2] = (u_char)len;
+    h[3] = type;
+    h[4] = flags;
+    h[5] = (u_char)(id >> 24 & 0x7f);
+    h[6] = (u_char)(id >> 16);
+    h[7] = (u_char)(id >> 8);
+    h[8] = (u_char)id;
+}
+
+static void h2_append_frame(http2 *h2, size_t len, u_char type, u_char flags,
+                            u_int id, const void *payload)
+{
+    u_char head[HTTP2_FRAME_HEADER_SIZE];
+
+    h2_frame_head(head, len, type, flags, id);
+    buffer_append(h2->out, (char*)head, sizeof(head));
+    if (len > 0) {
+        buffer_append(h2->out, payload, len);
+    }
+}
+
+static void h2_send_settings(http2 *h2)
+{
+    u_char p[6] = {0, SETTINGS_MAX_CONCURRENT_STREAMS, 0, 0, 0, HTTP2_MAX_STREAMS};
+
+    h2_append_frame(h2, sizeof(p), FRAME_SETTINGS, 0, 0, p);
+}
+
+static void h2_send_rst_stream(http2 *h2, u_int id, u_int code)
+{
+    u_char p[4] = {(u_char)(code >> 24), (u_char)(code >> 16),
+                   (u_char)(code >> 8), (u_char)code};
+
+    h2_append_frame(h2, sizeof(p), FRAME_RST_STREAM, 0, id, p);
+}
+
+static void h2_send_window_update(http2 *h2, u_int id, size_t increment)
+{
+    u_char p[4] = {(u_char)(increment >> 24 & 0x7f), (u_char)(increment >> 16),
+                   (u_char)(increment >> 8), (u_char)increment};
+
+    h2_append_frame(h2, sizeof(p), FRAME_WINDOW_UPDATE, 0, id, p);
+}
+
+static size_t h2_max_buffered(http2 *h2)
+{
+    size_t  max = (size_t)h2_server(h2)->client_max_body_size;
+
+    return max > HTTP2_MAX_BUFFERED ? max : HTTP2_MAX_BUFFERED;
+}
+
+/* n bytes of DATA are stored or dropped, the connection window is opened again */
+static void h2_consume(http2 *h2, size_t n)
+{
+    if (n > 0) {
+        h2_send_window_update(h2, 0, n);
+        h2->recv_window += n;
+    }
+}
+
+static void h2_send_goaway(http2 *h2, u_int code)
+{
+    u_int   id = h2->last_stream_id;
+    u_char  p[8] = {(u_char)(id >> 24 & 0x7f), (u_char)(id >> 16),
+                    (u_char)(id >> 8), (u_char)id,
+                    (u_char)(code >> 24), (u_char)(code >> 16),
+                    (u_char)(code >> 8), (u_char)code};
+
+    h2_append_frame(h2, sizeof(p), FRAME_GOAWAY, 0, 0, p);
+}
+
+/* write out and the DATA frames of ready streams,
+ * FCY_ERROR if the connection is closed */
+static int h2_send(http2 *h2)
+{
+    connection  *c = h2->conn;
+    int         err;
+
+    for (;;) {
+        if (h2->sending != NULL) {
+            err = h2_send_file(h2);
+            if (err != FCY_OK) {
+                goto again;
+            }
+        }
+
+        err = conn_write(c, h2->out);
+        if (err != FCY_OK) {
+            goto again;
+        }
+
+        if (!h2_produce(h2)) {
+            break;
+        }
+    }
+
+    if (c->write.active) {
+        conn_disable_write(c);
+    }
+    h2_push(h2);
+
+    if (h2->goaway && h2->n_streams == 0) {
+        close_connection(c);
+        return FCY_ERROR;
+    }
+    return FCY_OK;
+
+    again:
+    if (err == FCY_ERROR) {
+        close_connection(c);
+        return FCY_ERROR;
+    }
+    if (!c->write.active) {
+        conn_enable_write(c, h2_write_h);
+    }
+    return FCY_OK;
+}
+
+/* one DATA frame from each ready stream in turn, while out is not full.
+ * a file frame for sendfile starts only when out is empty,
+ * 0 if there is nothing to write */
+static int h2_produce(http2 *h2)
+{
+    http2_stream    *s;
+    list_node       *node;
+    size_t          n;
+    u_char          flags, *head;
+    ssize_t         got;
+
+    while (!list_empty(&h2->ready) && h2->send_window > 0
+           && buffer_readable_bytes(h2->out) < HTTP2_OUT_BATCH) {
+
+        node = list_head(&h2->ready);
+        s = link_data(node, http2_stream, ready_node);
+
+        if (s->send_window <= 0) {
+            list_remove(node);
+            s->ready = 0;
+            continue;
+        }
+
+        n = s->data_left;
+        n = n < h2->max_frame_size ? n : h2->max_frame_size;
+        n = n < (size_t)s->send_window ? n : (size_t)s->send_window;
+        n = n < (size_t)h2->send_window ? n : (size_t)h2->send_window;
+        flags = n == s->data_left ? FLAG_END_STREAM : 0;
+
+        if (s->data == NULL && n >= HTTP2_SENDFILE_MIN) {
+            if (!buffer_empty(h2->out)) {
+                break;
+            }
+            h2_frame_head(h2->frame_head, n, FRAME_DATA, flags, s->id);
+            h2->head_sent = 0;
+            h2->file_left = n;
+            h2->sending = s;
+        }
+        else {
+            buffer_ensure_writable_bytes(h2->out, HTTP2_FRAME_HEADER_SIZE + n);
+            head = (u_char*)buffer_begin_write(h2->out);
+            h2_frame_head(head, n, FRAME_DATA, flags, s->id);
+
+            if (s->data != NULL) {
+                memcpy(head + HTTP2_FRAME_HEADER_SIZE, s->data, n);
+                s->data += n;
+            }
+            else {
+                got = pread(s->r->send_fd, head + HTTP2_FRAME_HEADER_SIZE, n, s->file_offset);
+                if (got != (ssize_t)n) {
+                    /* file changed */
+                    LOG_ERROR("%s h2c stream %u read file error", conn_str(h2->conn), s->id);
+                    h2_stream_reset(s, H2_INTERNAL_ERROR);
+                    continue;
+                }
+                s->file_offset += n;
+            }
+            buffer_has_writen(h2->out, HTTP2_FRAME_HEADER_SIZE + n);
+        }
+
+        s->data_left -= n;
+        s->send_window -= n;
+        h2->send_window -= n;
+
+        list_remove(node);
+        s->ready = 0;
+        if (s->data_left > 0) {
+            h2_stream_ready(s);
+        }
+        else if (h2->sending != s) {
+            h2_stream_done(s);
+        }
+
+        if (h2->sending != NULL) {
+            return 1;
+        }
+    }
+
+    return !buffer_empty(h2->out);
+}
+
+static int h2_send_file(http2 *h2)
+{
+    http2_stream    *s = h2->sending;
+    int             fd = h2->conn->sockfd;
+    ssize_t         n;
+
+    while (h2->head_sent < HTTP2_FRAME_HEADER_SIZE) {
+        n = write(fd, h2->frame_head + h2->head_sent,
+                  HTTP2_FRAME_HEADER_SIZE - h2->head_sent);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return FCY_AGAIN;
+            }
+            LOG_SYSERR("%s write error", conn_str(h2->conn));
+            return FCY_ERROR;
+        }
+        h2->head_sent += n;
+    }
+
+    while (h2->file_left > 0) {
+        n = sendfile(fd, s->r->send_fd, &s->file_offset, h2->file_left);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return FCY_AGAIN;
+            }
+            LOG_SYSERR("%s sendfile error", conn_str(h2->conn));
+            return FCY_ERROR;
+        }
+        if (n == 0) {
+            /* the file is truncated, the frame can't be finished */
+            LOG_ERROR("%s h2c stream %u file truncated", conn_str(h2->conn), s->id);
+            return FCY_ERROR;
+        }
+        h2->file_left -= n;
+    }
+
+    h2->sending = NULL;
+    if (s->closed) {
+        h2_stream_close(s);
+    }
+    else if (s->data_left == 0) {
+        h2_stream_done(s);
+    }
+    return FCY_OK;
+}
+
+/* pool and r are given for the stream of an upgrade */
+static http2_stream *h2_stream_create(http2 *h2, u_int id, mem_pool *pool, request *r)
+{
+    http2_stream    *s;
+    int             own = pool == NULL;
+
+    if (own) {
+        pool = mem_pool_create(HTTP2_STREAM_POOL_SIZE);
+        if (pool == NULL) {
+            return NULL;
+        }
+    }
+
+    s = pcalloc(pool, sizeof(http2_stream));
+    if (s == NULL) {
+        goto error;
+    }
+
+    if (own) {
+        r = pcalloc(pool, sizeof(request));
+        if (r == NULL || request_init_stream(r, h2->conn, pool) == FCY_ERROR) {
+            goto error;
+        }
+    }
+
+    s->id = id;
+    s->r = r;
+    s->pool = pool;
+    s->send_window = h2->initial_window;
+    s->recv_window = HTTP2_DEFAULT_WINDOW;
+    s->h2 = h2;
+
+    list_insert_head(h2->streams.prev, &s->node);
+    ++h2->n_streams;
+
+    /* not idle, h2_set_timer picks the timer when the frames are done */
+    if (h2->conn->read.timer_set) {
+        timer_del(&h2->conn->read);
+    }
+
+    /* GOAWAY once keep_alive_requests streams are taken */
+    if (h2->conn->info->app_count >= h2_server(h2)->keep_alive_requests
+        && !h2->goaway) {
+        h2->goaway = 1;
+        h2_send_goaway(h2, H2_NO_ERROR);
+    }
+
+    return s;
+
+    error:
+    if (own) {
+        mem_pool_destroy(pool);
+    }
+    return NULL;
+}
+
+static http2_stream *h2_stream_find(http2 *h2, u_int id)
+{
+    list_node       *node;
+    http2_stream    *s;
+
+    /* newest first */
+    for (node = h2->streams.prev; node != &h2->streams; node = node->prev) {
+        s = link_data(node, http2_stream, node);
+        if (s->id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/* the header block of a new stream is decoded */
+static void h2_stream_headers(http2_stream *s, u_char flags)
+{
+    request *r = s->r;
+    int     err;
+
+    if (s->malformed
+        || (s->pseudo & (PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH))
+           != (PSEUDO_METHOD | PSEUDO_SCHEME | PSEUDO_PATH)) {
+        h2_stream_reset(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    /* :authority stands for Host */
+    r->parser.version = HTTP_V11;
+    r->has_host_header = 1;
+    s->end_stream = (flags & FLAG_END_STREAM) != 0;
+
+    /* the length is known at END_STREAM,
+     * it is forwarded with Content-Length like a decoded chunked body */
+    if (!r->has_content_length_header
+        && (r->parser.method == METHOD_POST || !s->end_stream)) {
+        r->is_chunked = 1;
+    }
+
+    /* the server is chosen even for a bad request */
+    err = check_request_header(r);
+    s->h2->srv = r->srv;
+    if (err == FCY_ERROR) {
+        LOG_INFO("%s h2c stream %u bad request header, status %d",
+                 conn_str(s->h2->conn), s->id, r->status_code);
+        h2_stream_error_page(s, r->status_code);
+        return;
+    }
+
+    /* one upstream connection per request */
+    r->should_keep_alive = 0;
+
+    if (s->end_stream) {
+        h2_stream_request(s);
+    }
+}
+
+/* the request is complete */
+static void h2_stream_request(http2_stream *s)
+{
+    request *r = s->r;
+
+    if (r->has_content_length_header && s->body_size != (size_t)r->content_length) {
+        h2_stream_reset(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (r->is_chunked) {
+        r->content_length = (long)s->body_size;
+    }
+
+    if (r->is_static) {
+        h2_stream_static(s);
+    }
+    else if (r->status_code == STATUS_OK) {
+        h2_proxy(s);
+    }
+    else {
+        h2_stream_error_page(s, r->status_code);
+    }
+}
+
+static void h2_stream_static(http2_stream *s)
+{
+    http2       *h2 = s->h2;
+    request     *r = s->r;
+    char        length[32];
+    char        *body = NULL;
+    int         n;
+
+    if (r->loc->return_code != 0) {
+        h2_stream_return(s);
+        return;
+    }
+    else if (r->loc->status) {
+        body = palloc(s->pool, 1024);
+        if (body == NULL || request_status_page(r, body, 1024) == -1) {
+            h2_stream_error_page(s, STATUS_INTARNAL_SEARVE_ERROR);
+            return;
+        }
+    }
+    else {
+        /* no multipart/byteranges in h2c, more ranges are the whole file */
+        r->single_range = 1;
+        if (open_static_file(r) == FCY_ERROR) {
+            LOG_INFO("%s h2c stream %u open static failed", conn_str(h2->conn), s->id);
+            h2_stream_error_page(s, r->status_code);
+            return;
+        }
+    }
+
+    LOG_DEBUG("%s h2c stream %u request \"%s\" %ld bytes",
+              conn_str(h2->conn), s->id, r->uri.data, r->sbuf.st_size);
+
+    /* 304, the validators and no body */
+    if (r->status_code == STATUS_NOT_MODIFIED) {
+        h2_begin_headers(h2, 304);
+        h2_validators(h2, r->file);
+        if (r->vary_encoding) {
+            hpack_encode_header(h2->block_out, "vary", 4, "Accept-Encoding", 15);
+        }
+        s->data_left = 0;
+        h2_send_headers(s);
+        return;
+    }
+
+    n = sprintf(length, "%ld", r->sbuf.st_size);
+
+    h2_begin_headers(h2, r->n_ranges == 1 ? 206 : 200);
+    hpack_encode_header(h2->block_out, "content-type", 12,
+                        r->content_type->name, strlen(r->content_type->name));
+    hpack_encode_header(h2->block_out, "content-length", 14, length, (size_t)n);
+    if (r->n_ranges == 1) {
+        char range[96];
+        n = sprintf(range, "bytes %ld-%ld/%ld", r->ranges[0].start,
+                    r->ranges[0].end, r->file->st.st_size);
+        hpack_encode_header(h2->block_out, "content-range", 13, range, (size_t)n);
+    }
+    if (r->file != NULL) {
+        hpack_encode_header(h2->block_out, "accept-ranges", 13, "bytes", 5);
+        h2_validators(h2, r->file);
+    }
+    if (r->content_encoding != NULL) {
+        hpack_encode_header(h2->block_out, "content-encoding", 16,
+                            r->content_encoding, strlen(r->content_encoding));
+    }
+    if (r->vary_encoding) {
+        hpack_encode_header(h2->block_out, "vary", 4, "Accept-Encoding", 15);
+    }
+
+    s->data = body;
+    s->data_left = (size_t)r->sbuf.st_size;
+    s->file_offset = r->send_offset;
+    h2_send_headers(s);
+}
+
+/* return <code> [text|url] of the location */
+static void h2_stream_return(http2_stream *s)
+{
+    http2       *h2 = s->h2;
+    location    *loc = s->r->loc;
+    string      *text = &loc->return_text;
+    char        length[32];
+    int         n;
+
+    h2_begin_headers(h2, loc->return_code);
+    s->data_left = 0;
+    if (RETURN_REDIRECT(loc->return_code)) {
+        hpack_encode_header(h2->block_out, "location", 8, text->data, text->len);
+    }
+    else if (loc->return_code != 204 && loc->return_code != 304) {
+        n = sprintf(length, "%zu", text->len);
+        hpack_encode_header(h2->block_out, "content-type", 12,
+                            "text/plain; charset=utf-8", 25);
+        hpack_encode_header(h2->block_out, "content-length", 14, length, (size_t)n);
+        s->data = text->data;
+        s->data_left = text->len;
+    }
+    h2_send_headers(s);
+}
+
+static void h2_validators(http2 *h2, cached_file *f)
+{
+    char modified[HTTP_TIME_LEN + 1];
+
+    http_time(modified, f->st.st_mtime);
+    hpack_encode_header(h2->block_out, "etag", 4, f->etag, (size_t)f->etag_len);
+    hpack_encode_header(h2->block_out, "last-modified", 13, modified, HTTP_TIME_LEN);
+}
+
+static void h2_stream_error_page(http2_stream *s, int status_code)
+{
+    http2   *h2 = s->h2;
+    string  *status_str = &status_code_out_str[status_code];
+    char    length[32];
+    int     n;
+
+    if (s->responded) {
+        h2_stream_reset(s, H2_INTERNAL_ERROR);
+        return;
+    }
+
+    n = sprintf(length, "%zu", status_str->len);
+
+    h2_begin_headers(h2, atoi(status_str->data));
+    hpack_encode_header(h2->block_out, "content-type", 12,
+                        "text/html; charset=utf-8", 24);
+    hpack_encode_header(h2->block_out, "content-length", 14, length, (size_t)n);
+
+    /* 416 tells the size */
+    if (status_code == STATUS_RANGE_NOT_SATISFIABLE && s->r->file != NULL) {
+        char range[64];
+        n = sprintf(range, "bytes */%ld", s->r->file->st.st_size);
+        hpack_encode_header(h2->block_out, "content-range", 13, range, (size_t)n);
+    }
+
+    s->data = status_str->data;
+    s->data_left = status_str->len;
+    h2_send_headers(s);
+}
+
+static void h2_stream_ready(http2_stream *s)
+{
+    http2 *h2 = s->h2;
+
+    if (!s->ready && s->responded && s->data_left > 0 && s->send_window > 0) {
+        list_insert_head(h2->ready.prev, &s->ready_node);
+        s->ready = 1;
+    }
+}
+
+/* the response is sent as a whole */
+static void h2_stream_done(http2_stream *s)
+{
+    http2 *h2 = s->h2;
+
+    LOG_DEBUG("%s h2c stream %u done", conn_str(h2->conn), s->id);
+
+    /* the rest of the request body is not wanted */
+    if (!s->end_stream) {
+        h2_send_rst_stream(h2, s->id, H2_NO_ERROR);
+    }
+    h2_stream_close(s);
+}
+
+static void h2_stream_reset(http2_stream *s, u_int code)
+{
+    LOG_DEBUG("%s h2c stream %u reset, error %u", conn_str(s->h2->conn), s->id, code);
+
+    h2_send_rst_stream(s->h2, s->id, code);
+    h2_stream_close(s);
+}
+
+static void h2_stream_close(http2_stream *s)
+{
+    http2   *h2 = s->h2;
+
+    if (s->ready) {
+        list_remove(&s->ready_node);
+        s->ready = 0;
+    }
+
+    /* a frame is half written */
+    if (h2->sending == s) {
+        s->closed = 1;
+        return;
+    }
+
+    list_remove(&s->node);
+    --h2->n_streams;
+    h2_stream_release_body(s);
+
+    if (s->peer != NULL) {
+        h2_peer_close(s);
+    }
+    request_close_file(s->r);
+    if (s->body_pool != NULL) {
+        mem_pool_destroy(s->body_pool);
+    }
+    mem_pool_destroy(s->pool);
+}
+
+/* the body is sent upstream or dropped */
+static void h2_stream_release_body(http2_stream *s)
+{
+    s->h2->buffered -= s->buffered;
+    s->buffered = 0;
+}
+
+/* the body and the upstream may be megabytes */
+static mem_pool *h2_stream_body_pool(http2_stream *s)
+{
+    if (s->body_pool == NULL) {
+        s->body_pool = mem_pool_create(HTTP_POOL_SIZE);
+        if (s->body_pool == NULL) {
+            LOG_FATAL("mem pool create failed, run out of memory");
+        }
+    }
+    return s->body_pool;
+}
+
+static void h2_on_header(void *user, string *name, string *value)
+{
+    http2_stream    *s = user;
+    request         *r = s->r;
+    int             id;
+
+    if (s->malformed) {
+        return;
+    }
+
+    if (name->len > 0 && name->data[0] == ':') {
+        if (s->regular) {
+            s->malformed = 1;
+        }
+        else if (strcmp(name->data, ":method") == 0 && !(s->pseudo & PSEUDO_METHOD)) {
+            s->pseudo |= PSEUDO_METHOD;
+            /* unknown methods are not implemented either */
+            r->parser.method = METHOD_CONNECT;
+            for (int i = METHOD_GET; i <= METHOD_CONNECT; ++i) {
+                if (strcmp(value->data, method_str[i].data) == 0) {
+                    r->parser.method = (unsigned)i;
+                    break;
+                }
+            }
+        }
+        else if (strcmp(name->data, ":path") == 0 && !(s->pseudo & PSEUDO_PATH)) {
+            s->pseudo |= PSEUDO_PATH;
+            if (request_set_uri(r, value) == FCY_ERROR) {
+                s->malformed = 1;
+            }
+        }
+        else if (strcmp(name->data, ":scheme") == 0 && !(s->pseudo & PSEUDO_SCHEME)) {
+            s->pseudo |= PSEUDO_SCHEME;
+        }
+        else if (strcmp(name->data, ":authority") == 0 && !(s->pseudo & PSEUDO_AUTHORITY)) {
+            s->pseudo |= PSEUDO_AUTHORITY;
+            request_add_header(r, HEADER_HOST, &header_name_str[HEADER_HOST], value);
+        }
+        else {
+            s->malformed = 1;
+        }
+        return;
+    }
+
+    s->regular = 1;
+
+    for (size_t i = 0; i < name->len; ++i) {
+        if (isupper(name->data[i])) {
+            s->malformed = 1;
+            return;
+        }
+    }
+
+    /* connection specific headers are not allowed */
+    id = http_header_id(name->data, name->len);
+    switch (id) {
+        case HEADER_CONNECTION:
+        case HEADER_KEEP_ALIVE:
+        case HEADER_TRANSFER_ENCODING:
+        case HEADER_UPGRADE:
+            s->malformed = 1;
+            return;
+        case HEADER_TE:
+            if (strcmp(value->data, "trailers") != 0) {
+                s->malformed = 1;
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+    request_add_header(r, id, name, value);
+}
+
+static void h2_ignore_header(void *user, string *name, string *value)
+{
+    (void)user;
+    (void)name;
+    (void)value;
+}
+
+/* block_out starts with :status */
+static void h2_begin_headers(http2 *h2, int status)
+{
+    buffer_retrieve_all(h2->block_out);
+    hpack_encode_status(h2->block_out, status);
+    hpack_encode_header(h2->block_out, "server", 6, "fancy beta", 10);
+    hpack_encode_header(h2->block_out, "date", 4, http_date(), HTTP_TIME_LEN);
+}
+
+/* HEADERS and CONTINUATION of block_out, the body is set already */
+static void h2_send_headers(http2_stream *s)
+{
+    http2   *h2 = s->h2;
+    buffer  *b = h2->block_out;
+    char    *p = buffer_peek(b);
+    size_t  left = buffer_readable_bytes(b), n;
+    u_char  type = FRAME_HEADERS, flags;
+
+    flags = s->data_left == 0 ? FLAG_END_STREAM : 0;
+    do {
+        n = left < h2->max_frame_size ? left : h2->max_frame_size;
+        if (n == left) {
+            flags |= FLAG_END_HEADERS;
+        }
+        h2_append_frame(h2, n, type, flags, s->id, p);
+        p += n;
+        left -= n;
+        type = FRAME_CONTINUATION;
+        flags = 0;
+    } while (left > 0);
+
+    buffer_retrieve_all(b);
+    s->responded = 1;
+
+    if (s->data_left == 0) {
+        h2_stream_done(s);
+    }
+    else {
+        h2_stream_ready(s);
+    }
+}
+
+static void h2_proxy(http2_stream *s)
+{
+    http2           *h2 = s->h2;
+    request         *r = s->r;
+    peer_connection *peer;
+    upstream        *upstm;
+    int             err;
+
+    LOG_DEBUG("%s h2c stream %u upstream %s \"%s\"", conn_str(h2->conn), s->id,
+              method_str[r->parser.method].data, r->uri.data);
+
+    peer = conn_get_stream_peer(h2->conn);
+    if (peer == NULL) {
+        LOG_WARN("%s not enough peer connections", conn_str(h2->conn));
+        h2_stream_error_page(s, STATUS_SERVICE_UNAVAILABLE);
+        return;
+    }
+    peer->info->addr = r->loc->proxy_pass;
+    s->peer = peer;
+
+    if (r->body_in == NULL) {
+        r->body_in = buffer_create(h2_stream_body_pool(s), HTTP_BUFFER_SIZE);
+    }
+    upstm = upstream_create(peer, h2_stream_body_pool(s));
+    if (r->body_in == NULL || upstm == NULL) {
+        LOG_FATAL("upstream create error");
+    }
+    upstm->user = s;
+    request_headers_htop(r, upstm->header_out);
+
+    peer->sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (peer->sockfd == -1) {
+        LOG_SYSERR("create socket error");
+        h2_upstream_error(s);
+        return;
+    }
+
+    inter:
+    err = connect(peer->sockfd, &peer->info->addr, sizeof(peer->info->addr));
+    if (err == -1) {
+        switch (errno) {
+            case EINTR:
+                goto inter;
+
+            case EINPROGRESS:
+                conn_enable_write(peer, h2_upstream_connect_h);
+                timer_add(&peer->write, (timer_msec)s->r->srv->upstream_timeout);
+                return;
+
+            default:
+                LOG_SYSERR("connect error");
+                h2_upstream_error(s);
+                return;
+        }
+    }
+
+    conn_enable_write(peer, h2_upstream_write_h);
+    h2_upstream_write_h(&peer->write);
+}
+
+static void h2_upstream_connect_h(event *ev)
+{
+    peer_connection *peer = ev->conn;
+    upstream        *upstm = peer->app;
+    http2_stream    *s = upstm->user;
+    int             conn_err;
+    socklen_t       err_len = sizeof(int);
+
+    if (ev->timeout) {
+        LOG_WARN("%s upstream connect timeout", conn_str(s->h2->conn));
+        h2_upstream_error(s);
+        return;
+    }
+
+    CHECK(getsockopt(peer->sockfd, SOL_SOCKET, SO_ERROR, &conn_err, &err_len));
+    if (conn_err != 0) {
+        LOG_ERROR("%s upstream connect error: %s", conn_str(s->h2->conn), strerror(conn_err));
+        h2_upstream_error(s);
+        return;
+    }
+
+    timer_del(ev);
+    ev->handler = h2_upstream_write_h;
+    h2_upstream_write_h(ev);
+}
+
+static void h2_upstream_write_h(event *ev)
+{
+    peer_connection *peer = ev->conn;
+    upstream        *upstm = peer->app;
+    http2_stream    *s = upstm->user;
+    int             err;
+
+    err = conn_write(peer, upstm->header_out);
+    if (err == FCY_OK) {
+        err = conn_write(peer, s->r->body_in);
+    }
+    if (err == FCY_AGAIN) {
+        return;
+    }
+    if (err == FCY_ERROR) {
+        h2_upstream_error(s);
+        return;
+    }
+
+    h2_stream_release_body(s);
+
+    conn_disable_write(peer);
+    conn_enable_read(peer, h2_upstream_read_header_h);
+    timer_add(&peer->read, (timer_msec)s->r->srv->upstream_timeout);
+
+    h2_upstream_read_header_h(&peer->read);
+}
+
+static void h2_upstream_read_header_h(event *ev)
+{
+    peer_connection *peer = ev->conn;
+    upstream        *upstm = peer->app;
+    http2_stream    *s = upstm->user;
+    buffer          *b = upstm->header_in;
+
+    if (ev->timeout) {
+        LOG_WARN("%s upstream response timeout (%dms)",
+                 conn_str(s->h2->conn), s->r->srv->upstream_timeout);
+        h2_upstream_error(s);
+        return;
+    }
+
+    switch (conn_read(peer, b)) {
+        case FCY_AGAIN:
+            return;
+        case FCY_ERROR:
+            h2_upstream_error(s);
+            return;
+        default:
+            break;
+    }
+
+    switch (upstream_parse(upstm)) {
+        case FCY_AGAIN:
+            return;
+        case FCY_ERROR:
+            LOG_WARN("%s parse upstream response error", conn_str(s->h2->conn));
+            h2_upstream_error(s);
+            return;
+        default:
+            break;
+    }
+
+    buffer_retrieve(b, upstm->parser.where);
+
+    if (upstm->content_length > HTTP_MAX_CONTENT_LENGTH) {
+        LOG_WARN("%s upstream content length too long, %ld bytes",
+                 conn_str(s->h2->conn), upstm->content_length);
+        h2_upstream_error(s);
+        return;
+    }
+
+    if (!buffer_empty(b)) {
+        upstm->avoid_read_body = 1;
+        buffer_transfer(upstm->body_in, b);
+    }
+
+    ev->handler = h2_upstream_read_body_h;
+    h2_upstream_read_body_h(ev);
+}
+
+static void h2_upstream_read_body_h(event *ev)
+{
+    peer_connection *peer = ev->conn;
+    upstream        *upstm = peer->app;
+    http2_stream    *s = upstm->user;
+    buffer          *b = upstm->body_in;
+
+    if (ev->timeout) {
+        LOG_WARN("%s upstream response timeout", conn_str(s->h2->conn));
+        h2_upstream_error(s);
+        return;
+    }
+
+    if (upstm->has_content_length_header || upstm->is_chunked) {
+        if (upstm->avoid_read_body) {
+            upstm->avoid_read_body = 0;
+        }
+        else {
+            switch (conn_read(peer, b)) {
+                case FCY_AGAIN:
+                    return;
+                case FCY_ERROR:
+                    h2_upstream_error(s);
+                    return;
+                default:
+                    break;
+            }
+        }
+    }
+
+    if (upstm->has_content_length_header) {
+        if (buffer_readable_bytes(b) < (size_t)upstm->content_length) {
+            return;
+        }
+    }
+    else if (upstm->is_chunked) {
+        switch (upstream_read_chunked(upstm)) {
+            case FCY_ERROR:
+                LOG_ERROR("upstream_read_chunked error");
+                h2_upstream_error(s);
+                return;
+            case FCY_AGAIN:
+                if (upstm->reader.size > HTTP_MAX_CONTENT_LENGTH) {
+                    LOG_WARN("%s upstream chunked body too long", conn_str(s->h2->conn));
+                    h2_upstream_error(s);
+                }
+                return;
+            default:
+                break;
+        }
+    }
+
+    h2_upstream_respond(s);
+}
+
+/* upstream headers as HEADERS, less the connection specific ones */
+static void h2_upstream_respond(http2_stream *s)
+{
+    http2       *h2 = s->h2;
+    upstream    *upstm = s->peer->app;
+    buffer      *b;
+    size_t      size;
+    char        length[32];
+    int         n;
+
+    upstream_gzip(upstm, s->r);
+    b = upstm->body_in;
+    size = buffer_readable_bytes(b);
+    if (upstm->has_content_length_header && size > (size_t)upstm->content_length) {
+        size = (size_t)upstm->content_length;
+    }
+
+    h2_begin_headers(h2, atoi(upstm->parser.response_line.data + 9));
+    for (size_t i = 0; i < upstm->headers.list->size; ++i) {
+        http_header *hd = array_at(upstm->headers.list, i);
+        switch (hd->id) {
+            case HEADER_CONNECTION:
+            case HEADER_KEEP_ALIVE:
+            case HEADER_TRANSFER_ENCODING:
+            case HEADER_UPGRADE:
+            case HEADER_TRAILER:
+            case HEADER_SERVER:
+            case HEADER_DATE:
+            case HEADER_CONTENT_LENGTH:
+                continue;
+            default:
+                hpack_encode_header(h2->block_out, hd->name.data, hd->name.len,
+                                    hd->value.data, hd->value.len);
+                break;
+        }
+    }
+    if (upstm->gzipped) {
+        hpack_encode_header(h2->block_out, "content-encoding", 16, "gzip", 4);
+    }
+    if (upstm->vary_encoding) {
+        hpack_encode_header(h2->block_out, "vary", 4, "Accept-Encoding", 15);
+    }
+    n = sprintf(length, "%zu", size);
+    hpack_encode_header(h2->block_out, "content-length", 14, length, (size_t)n);
+
+    LOG_DEBUG("%s h2c stream %u response \"%s\"",
+              conn_str(h2->conn), s->id, upstm->parser.response_line.data);
+
+    /* the body stays in the body pool */
+    h2_peer_close(s);
+
+    s->data = buffer_peek(b);
+    s->data_left = size;
+    h2_send_headers(s);
+
+    h2_wakeup(h2);
+}
+
+static void h2_upstream_error(http2_stream *s)
+{
+    http2 *h2 = s->h2;
+
+    h2_peer_close(s);
+    h2_stream_error_page(s, STATUS_INTARNAL_SEARVE_ERROR);
+    h2_wakeup(h2);
+}
+
+static void h2_peer_close(http2_stream *s)
+{
+    peer_connection *peer = s->peer;
+
+    if (peer->read.timer_set) {
+        timer_del(&peer->read);
+    }
+    if (peer->write.timer_set) {
+        timer_del(&peer->write);
+    }
+    /* epoll removes the fd */
+    if (peer->sockfd >= 0) {
+        CHECK(close(peer->sockfd));
+    }
+    conn_free_stream_peer(peer);
+    s->peer = NULL;
+}
+
+/* HTTP2-Settings, padding is optional */
+static int base64url_decode(const char *s, size_t len, u_char *out, size_t *n)
+{
+    u_int   bits = 0, v;
+    int     nbits = 0;
+    size_t  o = 0;
+
+    for (size_t i = 0; i < len && s[i] != '='; ++i) {
+        char c = s[i];
+
+        if (c >= 'A' && c <= 'Z') {
+            v = (u_int)(c - 'A');
+        }
+        else if (c >= 'a' && c <= 'z') {
+            v = (u_int)(c - 'a' + 26);
+        }
+        else if (c >= '0' && c <= '9') {
+            v = (u_int)(c - '0' + 52);
+        }
+        else if (c == '-' || c == '+') {
+            v = 62;
+        }
+        else if (c == '_' || c == '/') {
+            v = 63;
+        }
+        else {
+            return FCY_ERROR;
+        }
+
+        bits = bits << 6 | v;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            out[o++] = (u_char)(bits >> nbits);
+        }
+    }
+
+    *n = o;
+    return FCY_OK;
+}
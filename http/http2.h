@@ -0,0 +1,127 @@
+//
+// Created by frank on 17-6-14.
+// cleartext http/2 (h2c), by prior knowledge or Upgrade: h2c.
+// streams are requests of their own and go through the same
+// static file and proxy paths, one upstream connection per proxied stream
+//
+
+#ifndef FANCY_HTTP2_H
+#define FANCY_HTTP2_H
+
+#include "base.h"
+#include "buffer.h"
+#include "list.h"
+#include "connection.h"
+#include "request.h"
+#include "upstream.h"
+#include "hpack.h"
+
+#define HTTP2_PREFACE           "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN       (sizeof(HTTP2_PREFACE) - 1)
+
+#define HTTP2_FRAME_HEADER_SIZE 9
+#define HTTP2_MAX_FRAME_SIZE    16384   /* ours, the default */
+#define HTTP2_DEFAULT_WINDOW    65535
+#define HTTP2_MAX_WINDOW        0x7fffffff
+#define HTTP2_MAX_STREAMS       128
+#define HTTP2_MAX_HEADER_BLOCK  (64 * 1024)
+
+#define HTTP2_STREAM_POOL_SIZE  (32 * 1024)
+
+/* request bodies held by a connection until they go upstream, a stream
+ * going over this or client_max_body_size is refused, the client may retry */
+#define HTTP2_MAX_BUFFERED      (1024 * 1024)
+
+/* DATA frames are batched in out up to this size,
+ * a file frame at least HTTP2_SENDFILE_MIN long goes by sendfile */
+#define HTTP2_OUT_BATCH         (64 * 1024)
+#define HTTP2_SENDFILE_MIN      (16 * 1024)
+
+typedef struct http2        http2;
+typedef struct http2_stream http2_stream;
+
+struct http2_stream {
+
+    u_int           id;
+
+    unsigned        end_stream:1;   /* the peer is done sending */
+    unsigned        responded:1;    /* HEADERS are queued */
+    unsigned        ready:1;        /* in the ready list */
+    unsigned        closed:1;       /* waiting for its file frame */
+    unsigned        regular:1;      /* a regular header is decoded */
+    unsigned        malformed:1;
+    unsigned        pseudo:4;       /* pseudo headers decoded */
+
+    long            send_window;
+    long            recv_window;
+    size_t          body_size;      /* received DATA */
+    size_t          buffered;       /* of it in body_in, not sent upstream yet */
+
+    request         *r;
+    mem_pool        *pool;
+    mem_pool        *body_pool;     /* request body and upstream, lazily */
+
+    /* response body, from memory or from send_fd of r */
+    char            *data;
+    size_t          data_left;
+    off_t           file_offset;
+
+    peer_connection *peer;
+
+    http2           *h2;
+    list_node       node;           /* streams */
+    list_node       ready_node;     /* ready, round robin */
+};
+
+struct http2 {
+
+    unsigned        preface:1;      /* the client preface is received */
+    unsigned        settings:1;     /* and the SETTINGS after it */
+    unsigned        goaway:1;       /* no more streams */
+    unsigned        busy:1;         /* the timer is request_timeout, not idle */
+
+    connection      *conn;
+    server          *srv;           /* of the last stream, its timeouts apply */
+    mem_pool        *pool;
+    buffer          *in;
+    buffer          *out;
+    buffer          *block_in;      /* header block, until END_HEADERS */
+    buffer          *block_out;     /* encoded response headers */
+
+    hpack           hpack;
+
+    /* peer settings */
+    size_t          max_frame_size;
+    long            initial_window;
+
+    long            send_window;
+    long            recv_window;
+    size_t          buffered;       /* request bodies of the streams */
+
+    u_int           last_stream_id;
+    int             n_streams;
+    list            streams;
+    list            ready;
+
+    /* HEADERS waiting for CONTINUATION */
+    u_int           block_stream_id;
+    u_char          block_flags;
+
+    /* DATA frame going out by sendfile, out is written after it */
+    http2_stream    *sending;
+    u_char          frame_head[HTTP2_FRAME_HEADER_SIZE];
+    size_t          head_sent;
+    size_t          file_left;
+};
+
+/* prior knowledge, the preface is at the head of header_in of r,
+ * r is destroyed. FCY_ERROR if nothing is changed */
+int http2_init(connection *c, request *r);
+
+/* r asked for Upgrade: h2c and becomes stream 1,
+ * what follows it in header_in is http/2. FCY_ERROR if nothing is changed */
+int http2_upgrade(connection *c, request *r);
+
+void http2_destroy(http2 *h2);
+
+#endif //FANCY_HTTP2_H
@@ -0,0 +1,348 @@
+//
+// Created by frank on 17-6-10.
+//
+
+#include "http_header.h"
+
+/* (len, first, last) is distinct for every known name,
+ * a collision in header_hash would be reported by -Woverride-init */
+#define HEADER_HASH_SIZE    128
+#define HEADER_HASH(len, f, l) \
+    (((len) + (f) * 4 + (l) * 24) & (HEADER_HASH_SIZE - 1))
+
+#define OFF_T_MAX           LLONG_MAX   /* off_t is 64 bits */
+
+string header_name_str[] = {
+#define XX(id, name, f, l) string(name),
+        HTTP_HEADER_MAP(XX)
+#undef XX
+};
+
+/* slot -> 1 + id, 0 for empty */
+static const u_char header_hash[HEADER_HASH_SIZE] = {
+#define XX(id, name, f, l) [HEADER_HASH(sizeof(name) - 1, f, l)] = HEADER_##id + 1,
+        HTTP_HEADER_MAP(XX)
+#undef XX
+};
+
+int http_header_id(const char *name, size_t len)
+{
+    int     id;
+
+    if (len == 0) {
+        return HEADER_OTHER;
+    }
+
+    id = header_hash[HEADER_HASH(len, name[0] | 0x20, name[len - 1] | 0x20)];
+    if (id == 0) {
+        return HEADER_OTHER;
+    }
+
+    --id;
+    if (header_name_str[id].len != len
+        || strncasecmp(header_name_str[id].data, name, len) != 0) {
+        return HEADER_OTHER;
+    }
+    return id;
+}
+
+int http_headers_init(http_headers *h, mem_pool *p)
+{
+    h->list = array_create(p, 10, sizeof(http_header));
+    if (h->list == NULL) {
+        return FCY_ERROR;
+    }
+    memset(h->index, 0, sizeof(h->index));
+    return FCY_OK;
+}
+
+void http_headers_clear(http_headers *h)
+{
+    h->list->size = 0;
+    memset(h->index, 0, sizeof(h->index));
+}
+
+http_header *http_headers_add(http_headers *h, int id, string *name, string *value)
+{
+    http_header *hd;
+
+    hd = array_alloc(h->list);
+    if (hd == NULL) {
+        return NULL;
+    }
+    hd->id = id;
+    hd->name = *name;
+    hd->value = *value;
+
+    /* 只索引第一个, 位置超出u_char的不索引 */
+    if (id != HEADER_OTHER && h->index[id] == 0 && h->list->size <= UCHAR_MAX) {
+        h->index[id] = (u_char)h->list->size;
+    }
+    return hd;
+}
+
+string *http_headers_get(http_headers *h, int id)
+{
+    http_header *hd;
+
+    assert(id >= 0 && id < HEADER_KNOWN);
+
+    if (h->index[id] == 0) {
+        return NULL;
+    }
+    hd = array_at(h->list, h->index[id] - 1);
+    return &hd->value;
+}
+
+void http_time(char *buf, time_t t)
+{
+    static const char   *week[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char   *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm           tm;
+
+    /* not strftime, the locale does not matter */
+    gmtime_r(&t, &tm);
+    snprintf(buf, HTTP_TIME_LEN + 1, "%s, %02u %s %04u %02u:%02u:%02u GMT",
+             week[tm.tm_wday], (u_int)tm.tm_mday % 100, months[tm.tm_mon],
+             (u_int)(tm.tm_year + 1900) % 10000, (u_int)tm.tm_hour % 100,
+             (u_int)tm.tm_min % 100, (u_int)tm.tm_sec % 100);
+}
+
+int http_accept_encoding(string *value, const char *coding, size_t len)
+{
+    const char  *p = value->data, *end = value->data + value->len;
+    const char  *token, *q;
+    size_t      n;
+    int         star = 0;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            ++p;
+        }
+        token = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            ++p;
+        }
+        n = (size_t)(p - token);
+
+        /* the parameters, only q matters */
+        int accepted = 1;
+        while (p < end && *p != ',') {
+            if (*p == ';') {
+                q = p + 1;
+                while (q < end && (*q == ' ' || *q == '\t')) {
+                    ++q;
+                }
+                if (end - q >= 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+                    q += 2;
+                    /* 0, 0.0, 0.00, 0.000 */
+                    accepted = 0;
+                    for (; q < end && *q != ',' && *q != ';' && *q != ' '; ++q) {
+                        if (*q != '0' && *q != '.') {
+                            accepted = 1;
+                        }
+                    }
+                    p = q;
+                    continue;
+                }
+            }
+            ++p;
+        }
+
+        if (n == len && strncasecmp(token, coding, len) == 0) {
+            return accepted;
+        }
+        if (n == 1 && token[0] == '*') {
+            star = accepted;
+        }
+    }
+    return star;
+}
+
+int http_parse_range(string *value, off_t size, http_range *ranges, int max)
+{
+    const char  *p = value->data, *end = value->data + value->len;
+    off_t       start, last;
+    int         n = 0, suffix;
+
+    if (value->len < 6 || strncasecmp(p, "bytes=", 6) != 0) {
+        return -1;
+    }
+    p += 6;
+
+    for ( ;; ) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+
+        start = last = -1;
+        suffix = p < end && *p == '-';
+        if (!suffix) {
+            if (p == end || !isdigit(*p)) {
+                return -1;
+            }
+            for (start = 0; p < end && isdigit(*p); ++p) {
+                if (start > (OFF_T_MAX - 9) / 10) {
+                    return -1;
+                }
+                start = start * 10 + (*p - '0');
+            }
+            if (p == end || *p != '-') {
+                return -1;
+            }
+        }
+        ++p;
+
+        if (p < end && isdigit(*p)) {
+            for (last = 0; p < end && isdigit(*p); ++p) {
+                if (last > (OFF_T_MAX - 9) / 10) {
+                    return -1;
+                }
+                last = last * 10 + (*p - '0');
+            }
+        }
+        else if (suffix) {
+            return -1;
+        }
+
+        if (suffix) {
+            /* the last bytes, "-0" is not satisfiable */
+            if (last > 0 && size > 0) {
+                start = last < size ? size - last : 0;
+                last = size - 1;
+            }
+            else {
+                start = -1;
+            }
+        }
+        else if (last != -1 && last < start) {
+            return -1;
+        }
+        else if (last == -1 || last >= size) {
+            last = size - 1;
+        }
+
+        if (start != -1 && start < size) {
+            if (n == max) {
+                return -1;
+            }
+            ranges[n].start = start;
+            ranges[n].end = last;
+            ++n;
+        }
+
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+        if (p == end) {
+            break;
+        }
+        if (*p++ != ',') {
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+const char *http_date()
+{
+    static char     date[HTTP_TIME_LEN + 1];
+    static time_t   last = -1;
+    time_t          now = time(NULL);
+
+    if (now != last) {
+        http_time(date, now);
+        last = now;
+    }
+    return date;
+}
+
+time_t http_parse_time(string *value)
+{
+    static const char   *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    /* '0' a digit, 'a' a letter */
+    static const char   *format = "aaa, 00 aaa 0000 00:00:00 GMT";
+    const char          *p = value->data;
+    struct tm           tm;
+    int                 mon;
+
+    if (value->len != HTTP_TIME_LEN) {
+        return -1;
+    }
+    for (int i = 0; i < HTTP_TIME_LEN; ++i) {
+        if (format[i] == '0' ? !isdigit(p[i])
+            : format[i] == 'a' ? !isalpha(p[i]) : p[i] != format[i]) {
+            return -1;
+        }
+    }
+
+    for (mon = 0; mon < 12 && memcmp(months + mon * 3, p + 8, 3) != 0; ++mon) {
+    }
+    if (mon == 12) {
+        return -1;
+    }
+
+    bzero(&tm, sizeof(tm));
+    tm.tm_mday = (p[5] - '0') * 10 + p[6] - '0';
+    tm.tm_mon = mon;
+    tm.tm_year = (p[12] - '0') * 1000 + (p[13] - '0') * 100
+                 + (p[14] - '0') * 10 + p[15] - '0' - 1900;
+    tm.tm_hour = (p[17] - '0') * 10 + p[18] - '0';
+    tm.tm_min = (p[20] - '0') * 10 + p[21] - '0';
+    tm.tm_sec = (p[23] - '0') * 10 + p[24] - '0';
+    if (tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23
+        || tm.tm_min > 59 || tm.tm_sec > 60) {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+int http_etag(char *buf, struct stat *st)
+{
+    /* 3 * 16 hex digits at most */
+    return snprintf(buf, HTTP_ETAG_LEN, "\"%lx-%lx-%lx\"", (u_long)st->st_ino,
+                    (u_long)st->st_mtime, (u_long)st->st_size);
+}
+
+int http_etag_match(string *value, const char *etag, size_t len, int weak)
+{
+    const char  *p = value->data, *end = value->data + value->len, *tag;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            ++p;
+        }
+        if (p == end) {
+            break;
+        }
+        if (*p == '*') {
+            return 1;
+        }
+
+        tag = p;
+        if (end - p > 2 && p[0] == 'W' && p[1] == '/') {
+            p += 2;
+        }
+        if (*p != '"') {
+            return 0;
+        }
+        p = memchr(p + 1, '"', (size_t)(end - p - 1));
+        if (p == NULL) {
+            return 0;
+        }
+        ++p;
+
+        /* ours are strong, a weak one matches by weak comparison only */
+        if (*tag == 'W') {
+            if (weak && (size_t)(p - tag - 2) == len && memcmp(tag + 2, etag, len) == 0) {
+                return 1;
+            }
+        }
+        else if ((size_t)(p - tag) == len && memcmp(tag, etag, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
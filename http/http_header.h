@@ -0,0 +1,137 @@
+//
+// Created by frank on 17-6-10.
+// well-known header names, dispatched by id,
+// and a per-message index for lookup by id
+//
+
+#ifndef FANCY_HTTP_HEADER_H
+#define FANCY_HTTP_HEADER_H
+
+#include "base.h"
+
+/* XX(id, name, first char, last char), chars in lower case */
+#define HTTP_HEADER_MAP(XX)                                             \
+    XX(HOST,                "Host",                 'h', 't')           \
+    XX(CONNECTION,          "Connection",           'c', 'n')           \
+    XX(CONTENT_LENGTH,      "Content-Length",       'c', 'h')           \
+    XX(TRANSFER_ENCODING,   "Transfer-Encoding",    't', 'g')           \
+    XX(CONTENT_TYPE,        "Content-Type",         'c', 'e')           \
+    XX(CONTENT_ENCODING,    "Content-Encoding",     'c', 'g')           \
+    XX(CONTENT_RANGE,       "Content-Range",        'c', 'e')           \
+    XX(ACCEPT,              "Accept",               'a', 't')           \
+    XX(ACCEPT_ENCODING,     "Accept-Encoding",      'a', 'g')           \
+    XX(ACCEPT_LANGUAGE,     "Accept-Language",      'a', 'e')           \
+    XX(ACCEPT_RANGES,       "Accept-Ranges",        'a', 's')           \
+    XX(USER_AGENT,          "User-Agent",           'u', 't')           \
+    XX(REFERER,             "Referer",              'r', 'r')           \
+    XX(COOKIE,              "Cookie",               'c', 'e')           \
+    XX(SET_COOKIE,          "Set-Cookie",           's', 'e')           \
+    XX(IF_MODIFIED_SINCE,   "If-Modified-Since",    'i', 'e')           \
+    XX(IF_UNMODIFIED_SINCE, "If-Unmodified-Since",  'i', 'e')           \
+    XX(IF_NONE_MATCH,       "If-None-Match",        'i', 'h')           \
+    XX(IF_MATCH,            "If-Match",             'i', 'h')           \
+    XX(IF_RANGE,            "If-Range",             'i', 'e')           \
+    XX(RANGE,               "Range",                'r', 'e')           \
+    XX(DATE,                "Date",                 'd', 'e')           \
+    XX(LAST_MODIFIED,       "Last-Modified",        'l', 'd')           \
+    XX(ETAG,                "ETag",                 'e', 'g')           \
+    XX(VARY,                "Vary",                 'v', 'y')           \
+    XX(UPGRADE,             "Upgrade",              'u', 'e')           \
+    XX(KEEP_ALIVE,          "Keep-Alive",           'k', 'e')           \
+    XX(CACHE_CONTROL,       "Cache-Control",        'c', 'l')           \
+    XX(EXPECT,              "Expect",               'e', 't')           \
+    XX(AUTHORIZATION,       "Authorization",        'a', 'n')           \
+    XX(LOCATION,            "Location",             'l', 'n')           \
+    XX(SERVER,              "Server",               's', 'r')           \
+    XX(EXPIRES,             "Expires",              'e', 's')           \
+    XX(PRAGMA,              "Pragma",               'p', 'a')           \
+    XX(TE,                  "TE",                   't', 'e')           \
+    XX(TRAILER,             "Trailer",              't', 'r')           \
+    XX(HTTP2_SETTINGS,      "HTTP2-Settings",       'h', 's')           \
+    XX(X_FORWARDED_FOR,     "X-Forwarded-For",      'x', 'r')           \
+    XX(X_REAL_IP,           "X-Real-IP",            'x', 'p')           \
+    XX(ORIGIN,              "Origin",               'o', 'n')           \
+
+enum {
+#define XX(id, name, f, l) HEADER_##id,
+    HTTP_HEADER_MAP(XX)
+#undef XX
+    HEADER_KNOWN,
+};
+
+/* not a well-known name */
+#define HEADER_OTHER    HEADER_KNOWN
+
+extern string header_name_str[];
+
+/* id of the name, HEADER_OTHER if unknown, costs one hash and one compare */
+int http_header_id(const char *name, size_t len);
+
+typedef struct http_header  http_header;
+typedef struct http_headers http_headers;
+
+struct http_header {
+    int         id;
+    string      name;
+    string      value;
+};
+
+struct http_headers {
+    array       *list;                  /* of http_header, in arrival order */
+    u_char      index[HEADER_KNOWN];    /* 1 + position of the first one, 0 if absent */
+};
+
+int http_headers_init(http_headers *h, mem_pool *p);
+void http_headers_clear(http_headers *h);
+http_header *http_headers_add(http_headers *h, int id, string *name, string *value);
+
+/* value of the first header with this id, NULL if absent */
+string *http_headers_get(http_headers *h, int id);
+
+/* Accept-Encoding takes the coding, "gzip, deflate;q=0.5, br;q=0":
+ * a coding with q=0 is refused, "*" stands for the ones not listed */
+int http_accept_encoding(string *value, const char *coding, size_t len);
+
+typedef struct http_range      http_range;
+typedef struct content_type    content_type;
+
+/* "\r\nContent-Type: text/css\r\nContent-Length: " is rendered at
+ * compile time, the length is all that is left to a response */
+struct content_type {
+    const char  *name;
+    string      header;
+};
+#define content_type(name) \
+    {name, string("\r\nContent-Type: " name "\r\nContent-Length: ")}
+
+struct http_range {
+    off_t       start;
+    off_t       end;        /* the last byte, not past it */
+};
+
+/* "bytes=0-99, 200-, -50" of a file of size bytes, at most max ranges.
+ * the number of satisfiable ones, 0 for none, -1 if the header is to be
+ * ignored: not bytes, bad syntax, or more than max */
+int http_parse_range(string *value, off_t size, http_range *ranges, int max);
+
+/* "Sun, 06 Nov 1994 08:49:37 GMT", buf has HTTP_TIME_LEN + 1 bytes */
+#define HTTP_TIME_LEN   29
+void http_time(char *buf, time_t t);
+
+/* now, rendered once a second */
+const char *http_date();
+
+/* the other way round, -1 if it is not in that format. the obsolete
+ * rfc 850 and asctime formats are not taken, a condition with one is
+ * ignored */
+time_t http_parse_time(string *value);
+
+/* "\"inode-mtime-size\"", buf has HTTP_ETAG_LEN bytes, the length is returned */
+#define HTTP_ETAG_LEN   64
+int http_etag(char *buf, struct stat *st);
+
+/* etag is in the list of If-None-Match or If-Range, "*" matches all.
+ * the weak comparison takes "W/" tags as well */
+int http_etag_match(string *value, const char *etag, size_t len, int weak);
+
+#endif //FANCY_HTTP_HEADER_H
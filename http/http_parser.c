@@ -2,9 +2,8 @@
 // Created by frank on 17-5-24.
 //
 
-#include <ctype.h>
-#include <assert.h>
 #include "base.h"
+#include "http_scan.h"
 #include "http_parser.h"
 
 string method_str[] = {
@@ -17,7 +16,7 @@ string method_str[] = {
         string("CONNECT"),
 };
 
-string status_code_out_str[] = {
+string status_code_out_str[STATUS_COUNT] = {
         string("200 OK"),
         string("400 Bad Request"),
         string("403 Forbidden"),
@@ -29,6 +28,10 @@ string status_code_out_str[] = {
         string("431 Request Header Fields Too Large"),
         string("500 Internal Server Error"),
         string("501 Not Implemented"),
+        string("503 Service Unavailable"),
+        string("206 Partial Content"),
+        string("416 Range Not Satisfiable"),
+        string("304 Not Modified"),
 };
 
 enum {
@@ -62,6 +65,7 @@ enum {
 };
 
 static int parse_request(http_parser *ps, char *beg, char *end);
+static int parse_request_fast(http_parser *ps, char *beg, char *end);
 static int parse_request_line(http_parser *ps, char *beg, char *end);
 static int parse_uri(http_parser *ps, char *beg, char *end);
 
@@ -70,6 +74,14 @@ static int parse_response_line(http_parser *ps, char *beg, char *end);
 
 static int parse_headers(http_parser *ps, char *beg, char *end);
 
+static inline uint32_t word4(const char *p)
+{
+    uint32_t    w;
+
+    memcpy(&w, p, 4);
+    return w;
+}
+
 int parser_execute(http_parser *ps, char *beg, char *end)
 {
     if (ps->type == HTTP_PARSE_REQUEST) {
@@ -80,10 +92,29 @@ int parser_execute(http_parser *ps, char *beg, char *end)
     }
 }
 
+int parser_execute_uri(http_parser *ps, char *beg, char *end)
+{
+    return parse_uri(ps, beg, end);
+}
+
 static int parse_request(http_parser *ps, char *beg, char *end)
 {
+    char    *last;
+
     assert(ps->state != error_);
 
+    /* 头部已经完整到达, 一次解析完, 否则走可恢复的状态机.
+     * 通常读到的恰好是一个完整的头部, 先看结尾 */
+    if (ps->state == start_ && ps->where == 0 && end - beg >= 4) {
+        if (word4(end - 4) == word4("\r\n\r\n")) {
+            return parse_request_fast(ps, beg, end);
+        }
+        last = memmem(beg, end - beg, "\r\n\r\n", 4);
+        if (last != NULL) {
+            return parse_request_fast(ps, beg, last + 4);
+        }
+    }
+
     if (ps->state < line_done_) {
         switch (parse_request_line(ps, beg, end)) {
             case FCY_AGAIN:
@@ -117,6 +148,141 @@ static int parse_request(http_parser *ps, char *beg, char *end)
     return FCY_OK;
 }
 
+/* first 4 bytes of each method, with the space for GET */
+static const char method_word[][4] = {
+        [METHOD_GET] = "GET ",
+        [METHOD_HEAD] = "HEAD",
+        [METHOD_POST] = "POST",
+        [METHOD_OPTIONS] = "OPTI",
+        [METHOD_DELETE] = "DELE",
+        [METHOD_TRACE] = "TRAC",
+        [METHOD_CONNECT] = "CONN",
+};
+
+/* [beg, end) is a complete header block ending with "\r\n\r\n",
+ * so every scan below stops at a '\r' before end */
+static int parse_request_fast(http_parser *ps, char *beg, char *end)
+{
+    char        *p = beg, *q;
+    size_t      len;
+
+    /* method */
+    switch (*p) {
+        case 'G': ps->method = METHOD_GET; break;
+        case 'H': ps->method = METHOD_HEAD; break;
+        case 'P': ps->method = METHOD_POST; break;
+        case 'O': ps->method = METHOD_OPTIONS; break;
+        case 'D': ps->method = METHOD_DELETE; break;
+        case 'T': ps->method = METHOD_TRACE; break;
+        case 'C': ps->method = METHOD_CONNECT; break;
+        default:
+            goto error;
+    }
+    len = method_str[ps->method].len;
+    if (word4(p) != word4(method_word[ps->method])
+        || (len > 4 && memcmp(p + 4, method_str[ps->method].data + 4, len - 4) != 0)
+        || p[len] != ' ') {
+        goto error;
+    }
+    p += len + 1;
+
+    /* uri */
+    while (*p == ' ') {
+        ++p;
+    }
+    if (*p != '/') {
+        goto error;
+    }
+    q = http_scan_uri(p + 1, end);
+    if (*q != ' ') {
+        p = q;
+        goto error;
+    }
+    *q = '\0';
+    if (parse_uri(ps, p, q) == FCY_ERROR) {
+        p = q;
+        goto error;
+    }
+    p = q + 1;
+
+    /* version */
+    while (*p == ' ') {
+        ++p;
+    }
+    if ((word4(p) | 0x20202020) != word4("http")
+        || p[4] != '/' || p[5] != '1' || p[6] != '.') {
+        goto error;
+    }
+    if (p[7] == '0') {
+        ps->version = HTTP_V10;
+    }
+    else if (p[7] == '1') {
+        ps->version = HTTP_V11;
+    }
+    else {
+        goto error;
+    }
+    p += 8;
+    while (*p == ' ') {
+        ++p;
+    }
+    if (p[0] != '\r' || p[1] != '\n') {
+        goto error;
+    }
+    p += 2;
+
+    /* headers */
+    while (*p != '\r') {
+        string  *name = &ps->last_header_name;
+        string  *value = &ps->last_header_value;
+
+        if (!isgraph((u_char)*p)) {
+            goto error;
+        }
+        q = http_scan_name(p + 1, end);
+        if (*q != ':') {
+            p = q;
+            goto error;
+        }
+        name->data = p;
+        name->len = q - p;
+        ps->header_id = http_header_id(name->data, name->len);
+        *q = '\0';
+
+        p = q + 1;
+        while (*p == ' ') {
+            ++p;
+        }
+        if (iscntrl((u_char)*p)) {
+            goto error;
+        }
+        q = http_scan_value(p + 1, end);
+        if (q[0] != '\r' || q[1] != '\n') {
+            p = q;
+            goto error;
+        }
+        value->data = p;
+        value->len = q - p;
+        *q = '\0';
+        if (ps->header_cb != NULL) {
+            ps->header_cb(ps->user, ps->header_id, name, value);
+        }
+        p = q + 2;
+    }
+
+    if (p[1] != '\n') {
+        goto error;
+    }
+    ps->where = p + 2 - beg;
+    ps->state = all_done_;
+    return FCY_OK;
+
+    error:
+    ps->where = p - beg;
+    ps->state = error_;
+    return FCY_ERROR;
+}
+
 static int parse_request_line(http_parser *ps, char *beg, char *end)
 {
     unsigned    state = ps->state;
@@ -158,6 +324,9 @@ static int parse_request_line(http_parser *ps, char *beg, char *end)
                     }
                 }
 
+                if (c != ' ') {
+                    goto error;
+                }
                 state = space_before_uri_;
                 break;
             }
@@ -167,25 +336,27 @@ static int parse_request_line(http_parser *ps, char *beg, char *end)
                     break;
                 }
                 if (c == '/') {
-                    ps->uri_start = p;
+                    ps->uri_start = p - beg;
                     state = uri_;
                     break;
                 }
                 goto error;
 
             case uri_:
-                if (c == ' ') {
+                /* skip to ' ' or control character */
+                p = http_scan_uri(p, end);
+                if (p == end) {
+                    goto done;
+                }
+                if (*p == ' ') {
                     /* set uri str */
                     *p = '\0';
-                    if (parse_uri(ps, ps->uri_start, p) == FCY_ERROR) {
+                    if (parse_uri(ps, beg + ps->uri_start, p) == FCY_ERROR) {
                         goto error;
                     }
                     state = space_before_version_;
                     break;
                 }
-                if (!iscntrl(c)) {
-                    break;
-                }
                 goto error;
 
             case space_before_version_:
@@ -303,22 +474,27 @@ static int parse_headers(http_parser *ps, char *beg, char *end)
                     break;
                 }
                 if (isgraph(c)) {
-                    ps->last_header_name.data = p;
+                    ps->name_start = p - beg;
                     state = name_;
                     break;
                 }
                 goto error;
 
             case name_:
-                if (c == ':') {
+                /* skip to ':' or !isgraph */
+                p = http_scan_name(p, end);
+                if (p == end) {
+                    goto done;
+                }
+                if (*p == ':') {
+                    ps->last_header_name.data = beg + ps->name_start;
                     ps->last_header_name.len = p - ps->last_header_name.data;
+                    ps->header_id = http_header_id(ps->last_header_name.data,
+                                                   ps->last_header_name.len);
                     *p = '\0';
                     state = space_before_value_;
                     break;
                 }
-                if (isgraph(c)) {
-                    break;
-                }
                 goto error;
 
             case space_before_value_:
@@ -326,27 +502,31 @@ static int parse_headers(http_parser *ps, char *beg, char *end)
                     break;
                 }
                 if (!iscntrl(c)) {
-                    ps->last_header_value.data = p;
+                    ps->value_start = p - beg;
                     state = value_;
                     break;
                 }
                 goto error;
 
             case value_:
-                if (c == '\r') {
+                /* skip to '\r' or other control character */
+                p = http_scan_value(p, end);
+                if (p == end) {
+                    goto done;
+                }
+                if (*p == '\r') {
+                    ps->last_header_name.data = beg + ps->name_start;
+                    ps->last_header_value.data = beg + ps->value_start;
                     ps->last_header_value.len = p - ps->last_header_value.data;
                     *p = '\0';
                     if (ps->header_cb != NULL) {
-                        ps->header_cb(ps->user,
+                        ps->header_cb(ps->user, ps->header_id,
                                       &ps->last_header_name,
                                       &ps->last_header_value);
                     }
                     state = header_almost_done_;
                     break;
                 }
-                if (!iscntrl(c)) {
-                    break;
-                }
                 goto error;
 
             case header_almost_done_:
@@ -385,123 +565,145 @@ static int parse_headers(http_parser *ps, char *beg, char *end)
     return FCY_ERROR;
 }
 
+static inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/* 一个段结束, [seg, *u)是这个段, "."和".."就地去掉,
+ * ".."越过根目录是错误 */
+static int resolve_segment(char *beg, char *seg, char **u)
+{
+    size_t  len = *u - seg;
+
+    if (len == 1 && seg[0] == '.') {
+        *u = seg;
+    }
+    else if (len == 2 && seg[0] == '.' && seg[1] == '.') {
+        if (seg - 1 == beg) {
+            return FCY_ERROR;
+        }
+        seg -= 1;
+        while (seg[-1] != '/') {
+            --seg;
+        }
+        *u = seg;
+    }
+    return FCY_OK;
+}
+
+/* 一遍完成规范化: 解码%XX, 去掉"."和"..", 合并重复的'/',
+ * '?'之后是args, 不解码, '#'之后丢弃. 结果就地写回, 不长于原来 */
 static int parse_uri(http_parser *ps, char *beg, char *end)
 {
-    int     hex1, hex2;
+    char    *p = beg;
     char    *u = beg;
-    char    *last_dot = NULL;
-    enum { /* local */
-        start_ = 0,
-        after_slash_,
-        quote_,
-        args_,
-    } state = start_;
+    char    *q, *seg, *last_dot;
+    int     c, hex1, hex2;
+    string  uri, suffix, args;
 
     /* 注意，此时uri已经读完了，不需要考虑FCY_AGAIN的情况 */
-    char *p = u;
-    for (; p < end; ++p) {
-
-        char c = *p;
-        switch (state) {
-            case start_:
-                if (c == '/') {
-                    *u++ = '/';
-                    state = after_slash_;
-                    break;
-                }
-                goto error;
+    if (p == end || *p != '/') {
+        goto error;
+    }
+    ++p;
+    ++u;
+    seg = u;
+    str_null(&args);
 
-            case after_slash_:
-                switch (c) {
-                    case '/':
-                        *u++ = '/';
-                        last_dot = NULL;
-                        break;
-                    case '#':
-                        goto done;
-                    case '?':
-                        // 暂时不用
-                        // r->has_args = 1;
-                        *u++ = '?';
-                        state = args_;
-                        break;
-                    case '%':
-                        state = quote_;
-                        break;
-                    case '.':
-                        last_dot = u;
-                        *u++ = '.';
-                        break;
-                    default:
-                        *u++ = c;
-                        break;
-                }
-                break;
+    for ( ;; ) {
 
-            case quote_:
-                if (isdigit(c)) {
-                    hex1 = c - '0';
-                }
-                else {
-                    hex1 = (c | 0x20);
-                    if (hex1 >= 'a' && hex1 <= 'f') {
-                        hex1 = hex1 - 'a' + 10;
-                    }
-                    else {
-                        goto error;
-                    }
-                }
+        /* 普通字符成段拷贝, 没有解码过时u == p, 不用拷贝 */
+        q = http_scan_path(p, end);
+        if (u != p) {
+            memmove(u, p, q - p);
+        }
+        u += q - p;
+        p = q;
 
-                c = *++p;
+        if (p == end) {
+            break;
+        }
 
-                if (isdigit(c)) {
-                    hex2 = c - '0';
+        c = (u_char)*p++;
+        switch (c) {
+            case '%':
+                if (end - p < 2
+                    || (hex1 = hex_value(p[0])) < 0
+                    || (hex2 = hex_value(p[1])) < 0) {
+                    goto error;
                 }
-                else {
-                    hex2 = (c | 0x20);
-                    if (hex2 >= 'a' && hex2 <= 'f') {
-                        hex2 = hex2 - 'a' + 10;
-                    }
-                    else {
-                        goto error;
-                    }
+                p += 2;
+                c = (hex1 << 4) + hex2;
+                if (c == '\0') {
+                    goto error;
+                }
+                /* 解码出的'/'也是分隔符, 其余都是数据 */
+                if (c != '/') {
+                    *u++ = (char)c;
+                    continue;
                 }
-
-                *u++ = (char)((hex1 << 4) + hex2);
-                state = after_slash_;
                 break;
 
-            case args_:
-                switch (c) {
-                    case '#':
-                        goto done;
-                    default:
-                        *u++ = c;
-                        break;
-                }
+            case '/':
                 break;
 
+            case '?':
+                args.data = p;
+                q = memchr(p, '#', end - p);
+                args.len = (q == NULL ? end : q) - p;
+                args.data[args.len] = '\0';
+                goto done;
+
+            case '#':
+                goto done;
+
             default:
-                assert(0);
+                /* ' ' or control character */
+                goto error;
         }
-    }
 
-    string     uri;
-    string     suffix;
+        /* 一个段结束 */
+        if (resolve_segment(beg, seg, &u) == FCY_ERROR) {
+            goto error;
+        }
+        if (u[-1] != '/') {
+            *u++ = '/';
+        }
+        seg = u;
+    }
 
     done:
+    if (resolve_segment(beg, seg, &u) == FCY_ERROR) {
+        goto error;
+    }
     *u = '\0';
+
     uri.data = beg;
     uri.len = u - beg;
+
+    /* 后缀只看最后一段 */
+    for (seg = u; seg[-1] != '/'; --seg) {
+        /* void */
+    }
+    last_dot = memrchr(seg, '.', u - seg);
     if (last_dot == NULL) {
         str_null(&suffix);
     }
     else {
-        suffix.len = end - last_dot;
         suffix.data = last_dot;
+        suffix.len = u - last_dot;
     }
+
     if (ps->uri_cb != NULL) {
-        ps->uri_cb(ps->user, &uri, &suffix);
+        ps->uri_cb(ps->user, &uri, &suffix, &args);
     }
     return FCY_OK;
 
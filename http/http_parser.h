@@ -3,6 +3,7 @@
 //
 
 #include "buffer.h"
+#include "http_header.h"
 
 #ifndef FANCY_PARSE_HEADERS_H
 #define FANCY_PARSE_HEADERS_H
@@ -32,14 +33,20 @@ extern string method_str[];
 #define STATUS_REQUEST_HEADER_FIELD_TOO_LARGE   8
 #define STATUS_INTARNAL_SEARVE_ERROR            9
 #define STATUS_NOT_IMPLEMENTED                  10
-extern string status_code_out_str[];
+#define STATUS_SERVICE_UNAVAILABLE              11
+#define STATUS_PARTIAL_CONTENT                  12
+#define STATUS_RANGE_NOT_SATISFIABLE            13
+#define STATUS_NOT_MODIFIED                     14
+#define STATUS_COUNT                            15
+extern string status_code_out_str[STATUS_COUNT];
 
 #define HTTP_V10                    0
 #define HTTP_V11                    1
 
 typedef struct http_parser http_parser;
-typedef void(*http_header_callback)(void *user, string *name, string *value);
-typedef void(*http_uri_callback)(void *user, string *uri, string *suffix);
+typedef void(*http_header_callback)(void *user, int id, string *name, string *value);
+/* uri is the normalized path, args the raw query string without '?' */
+typedef void(*http_uri_callback)(void *user, string *uri, string *suffix, string *args);
 
 struct http_parser {
 
@@ -51,13 +58,19 @@ struct http_parser {
     unsigned            method:8;
     unsigned            version:4;
 
+    unsigned            header_id:8;    /* of the header being parsed */
+
     string             response_line;
 
     string             last_header_name;
     string             last_header_value;
 
     size_t              where;
-    char                *uri_start;
+
+    /* offsets from beg, the buffer may move between two calls */
+    size_t              uri_start;
+    size_t              name_start;
+    size_t              value_start;
 
     http_header_callback    header_cb;
     http_uri_callback       uri_cb;
@@ -67,4 +80,7 @@ struct http_parser {
 
 int parser_execute(http_parser *ps, char *beg, char *end);
 
+/* a uri alone, as :path of http/2. *end is written */
+int parser_execute_uri(http_parser *ps, char *beg, char *end);
+
 #endif //FANCY_PARSE_HEADERS_H
@@ -0,0 +1,175 @@
+//
+// Created by frank on 17-6-8.
+//
+
+#include <immintrin.h>
+#include "base.h"
+#include "http_scan.h"
+
+/* bytes to stop at, one table per token */
+static const u_char stop_uri[256] = {
+        [0x00 ... 0x20] = 1, [0x7f] = 1,
+};
+
+static const u_char stop_path[256] = {
+        [0x00 ... 0x20] = 1, [0x7f] = 1,
+        ['%'] = 1, ['/'] = 1, ['?'] = 1, ['#'] = 1,
+};
+
+static const u_char stop_name[256] = {
+        [0x00 ... 0x20] = 1, [':'] = 1, [0x7f ... 0xff] = 1,
+};
+
+static const u_char stop_value[256] = {
+        [0x00 ... 0x1f] = 1, [0x7f] = 1,
+};
+
+static char *scan_uri_resolve(char *p, char *end);
+static char *scan_path_resolve(char *p, char *end);
+static char *scan_name_resolve(char *p, char *end);
+static char *scan_value_resolve(char *p, char *end);
+
+char *(*http_scan_uri)(char *p, char *end) = scan_uri_resolve;
+char *(*http_scan_path)(char *p, char *end) = scan_path_resolve;
+char *(*http_scan_name)(char *p, char *end) = scan_name_resolve;
+char *(*http_scan_value)(char *p, char *end) = scan_value_resolve;
+
+static inline char *scan_table(const u_char *table, char *p, char *end)
+{
+    while (p < end && !table[(u_char)*p]) {
+        ++p;
+    }
+    return p;
+}
+
+static char *scan_uri_scalar(char *p, char *end)
+{
+    return scan_table(stop_uri, p, end);
+}
+
+static char *scan_path_scalar(char *p, char *end)
+{
+    return scan_table(stop_path, p, end);
+}
+
+static char *scan_name_scalar(char *p, char *end)
+{
+    return scan_table(stop_name, p, end);
+}
+
+static char *scan_value_scalar(char *p, char *end)
+{
+    return scan_table(stop_value, p, end);
+}
+
+/* PCMPESTRI with byte ranges, 16 bytes a step */
+#define SCAN_SSE42(name, ranges)                                            \
+__attribute__((target("sse4.2")))                                           \
+static char *scan_##name##_sse42(char *p, char *end)                        \
+{                                                                           \
+    static const char r[16] = ranges;                                       \
+    const __m128i   set = _mm_loadu_si128((const __m128i*)r);               \
+    int             idx;                                                    \
+                                                                            \
+    for (; end - p >= 16; p += 16) {                                        \
+        __m128i v = _mm_loadu_si128((const __m128i*)p);                     \
+        idx = _mm_cmpestri(set, sizeof(ranges) - 1, v, 16,                  \
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES               \
+                           | _SIDD_LEAST_SIGNIFICANT);                      \
+        if (idx != 16) {                                                    \
+            return p + idx;                                                 \
+        }                                                                   \
+    }                                                                       \
+    return scan_table(stop_##name, p, end);                                 \
+}
+
+SCAN_SSE42(uri, "\x00\x20\x7f\x7f")
+SCAN_SSE42(path, "\x00\x20##%%//??\x7f\x7f")
+SCAN_SSE42(name, "\x00\x20::\x7f\xff")
+SCAN_SSE42(value, "\x00\x1f\x7f\x7f")
+
+/* unsigned compares through min/max, 32 bytes a step */
+#define AVX2_LE(v, c) \
+    _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8((char)(c))), v)
+#define AVX2_GE(v, c) \
+    _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8((char)(c))), v)
+#define AVX2_EQ(v, c) \
+    _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)(c)))
+
+#define SCAN_AVX2(name, stop)                                               \
+__attribute__((target("avx2")))                                             \
+static char *scan_##name##_avx2(char *p, char *end)                         \
+{                                                                           \
+    u_int   mask;                                                           \
+                                                                            \
+    for (; end - p >= 32; p += 32) {                                        \
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);                  \
+        mask = (u_int)_mm256_movemask_epi8(stop);                           \
+        if (mask != 0) {                                                    \
+            return p + __builtin_ctz(mask);                                 \
+        }                                                                   \
+    }                                                                       \
+    return scan_table(stop_##name, p, end);                                 \
+}
+
+SCAN_AVX2(uri, _mm256_or_si256(AVX2_LE(v, 0x20), AVX2_EQ(v, 0x7f)))
+SCAN_AVX2(path, _mm256_or_si256(_mm256_or_si256(AVX2_LE(v, 0x20), AVX2_EQ(v, 0x7f)),
+                                _mm256_or_si256(_mm256_or_si256(AVX2_EQ(v, '%'), AVX2_EQ(v, '/')),
+                                                _mm256_or_si256(AVX2_EQ(v, '?'), AVX2_EQ(v, '#')))))
+SCAN_AVX2(name, _mm256_or_si256(_mm256_or_si256(AVX2_LE(v, 0x20), AVX2_GE(v, 0x7f)),
+                                AVX2_EQ(v, ':')))
+SCAN_AVX2(value, _mm256_or_si256(AVX2_LE(v, 0x1f), AVX2_EQ(v, 0x7f)))
+
+int http_scan_use(int level)
+{
+    int scan_level;
+
+    __builtin_cpu_init();
+
+    if (level >= HTTP_SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+        http_scan_uri = scan_uri_avx2;
+        http_scan_path = scan_path_avx2;
+        http_scan_name = scan_name_avx2;
+        http_scan_value = scan_value_avx2;
+        scan_level = HTTP_SCAN_AVX2;
+    }
+    else if (level >= HTTP_SCAN_SSE42 && __builtin_cpu_supports("sse4.2")) {
+        http_scan_uri = scan_uri_sse42;
+        http_scan_path = scan_path_sse42;
+        http_scan_name = scan_name_sse42;
+        http_scan_value = scan_value_sse42;
+        scan_level = HTTP_SCAN_SSE42;
+    }
+    else {
+        http_scan_uri = scan_uri_scalar;
+        http_scan_path = scan_path_scalar;
+        http_scan_name = scan_name_scalar;
+        http_scan_value = scan_value_scalar;
+        scan_level = HTTP_SCAN_SCALAR;
+    }
+    return scan_level;
+}
+
+static char *scan_uri_resolve(char *p, char *end)
+{
+    http_scan_use(HTTP_SCAN_AVX2);
+    return http_scan_uri(p, end);
+}
+
+static char *scan_path_resolve(char *p, char *end)
+{
+    http_scan_use(HTTP_SCAN_AVX2);
+    return http_scan_path(p, end);
+}
+
+static char *scan_name_resolve(char *p, char *end)
+{
+    http_scan_use(HTTP_SCAN_AVX2);
+    return http_scan_name(p, end);
+}
+
+static char *scan_value_resolve(char *p, char *end)
+{
+    http_scan_use(HTTP_SCAN_AVX2);
+    return http_scan_value(p, end);
+}
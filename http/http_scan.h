@@ -0,0 +1,33 @@
+//
+// Created by frank on 17-6-8.
+// skip runs of ordinary characters in http_parser,
+// 16 or 32 bytes at a time when the cpu allows
+//
+
+#ifndef FANCY_HTTP_SCAN_H
+#define FANCY_HTTP_SCAN_H
+
+#define HTTP_SCAN_SCALAR    0
+#define HTTP_SCAN_SSE42     1
+#define HTTP_SCAN_AVX2      2
+
+/* each returns the first byte in [p, end) which may not be skipped,
+ * or end if there is none */
+
+/* uri: ' ' or control character */
+extern char *(*http_scan_uri)(char *p, char *end);
+
+/* path of a uri: '%', '/', '?', '#', ' ' or control character */
+extern char *(*http_scan_path)(char *p, char *end);
+
+/* header name: ':' or anything !isgraph */
+extern char *(*http_scan_name)(char *p, char *end);
+
+/* header value: control character, '\r' included */
+extern char *(*http_scan_value)(char *p, char *end);
+
+/* the implementation is chosen from cpuid on first use,
+ * http_scan_use forces a lower level, returns the level in use */
+int http_scan_use(int level);
+
+#endif //FANCY_HTTP_SCAN_H
@@ -0,0 +1,177 @@
+//
+// Created by frank on 17-6-12.
+//
+
+#include "palloc.h"
+#include "location.h"
+
+typedef struct location_node location_node;
+
+struct location_node {
+
+    string          key;        /* edge label, points into a prefix */
+
+    location        *prefix;    /* location /key... */
+    location        *exact;     /* location = /key... */
+
+    u_char          *labels;    /* first byte of each child's key */
+    location_node   **children;
+    int             n;
+    int             capacity;
+};
+
+static mem_pool         *pool;
+
+static location_node *node_create(const char *key, size_t len);
+static int node_attach(location_node *parent, location_node *child);
+static location_node *node_child(location_node *node, char c, int *index);
+
+location_tree *location_tree_create()
+{
+    if (pool == NULL) {
+        pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+        if (pool == NULL) {
+            return NULL;
+        }
+    }
+    return pcalloc(pool, sizeof(location_node));
+}
+
+int location_add(location_tree *tree, location *loc)
+{
+    location_node   *node = tree, *child, *mid;
+    location        **slot;
+    const char      *key = loc->prefix.data;
+    size_t          len = loc->prefix.len, common;
+    int             index = 0;
+
+    while (len > 0) {
+        child = node_child(node, *key, &index);
+        if (child == NULL) {
+            child = node_create(key, len);
+            if (child == NULL || node_attach(node, child) == FCY_ERROR) {
+                return FCY_ERROR;
+            }
+            node = child;
+            break;
+        }
+
+        common = 1;
+        while (common < len && common < child->key.len
+               && key[common] == child->key.data[common]) {
+            ++common;
+        }
+
+        /* the edge ends inside key, split it */
+        if (common < child->key.len) {
+            mid = node_create(child->key.data, common);
+            if (mid == NULL) {
+                return FCY_ERROR;
+            }
+            child->key.data += common;
+            child->key.len -= common;
+            if (node_attach(mid, child) == FCY_ERROR) {
+                return FCY_ERROR;
+            }
+            node->children[index] = mid;
+            child = mid;
+        }
+
+        node = child;
+        key += common;
+        len -= common;
+    }
+
+    slot = loc->exact ? &node->exact : &node->prefix;
+    if (*slot != NULL) {
+        return FCY_ERROR;
+    }
+    *slot = loc;
+
+    return FCY_OK;
+}
+
+location *location_find(location_tree *tree, const char *uri, size_t len)
+{
+    location_node   *node = tree, *child;
+    location        *best = NULL;
+    int             index = 0;
+
+    for (;;) {
+        if (len == 0 && node->exact != NULL) {
+            return node->exact;
+        }
+        if (node->prefix != NULL) {
+            best = node->prefix;
+        }
+        if (len == 0) {
+            break;
+        }
+
+        child = node_child(node, *uri, &index);
+        if (child == NULL
+            || child->key.len > len
+            || memcmp(child->key.data, uri, child->key.len) != 0) {
+            break;
+        }
+        uri += child->key.len;
+        len -= child->key.len;
+        node = child;
+    }
+
+    return best;
+}
+
+static location_node *node_create(const char *key, size_t len)
+{
+    location_node *node = pcalloc(pool, sizeof(location_node));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->key.data = (char*)key;
+    node->key.len = len;
+    return node;
+}
+
+static int node_attach(location_node *parent, location_node *child)
+{
+    if (parent->n == parent->capacity) {
+        int             capacity = parent->capacity == 0 ? 2 : parent->capacity * 2;
+        u_char          *labels = palloc(pool, capacity);
+        location_node   **children = palloc(pool, capacity * sizeof(location_node*));
+
+        if (labels == NULL || children == NULL) {
+            return FCY_ERROR;
+        }
+        if (parent->n > 0) {
+            memcpy(labels, parent->labels, parent->n);
+            memcpy(children, parent->children, parent->n * sizeof(location_node*));
+        }
+        parent->labels = labels;
+        parent->children = children;
+        parent->capacity = capacity;
+    }
+
+    parent->labels[parent->n] = (u_char)child->key.data[0];
+    parent->children[parent->n] = child;
+    ++parent->n;
+
+    return FCY_OK;
+}
+
+static location_node *node_child(location_node *node, char c, int *index)
+{
+    u_char *label;
+
+    if (node->n == 0) {
+        return NULL;
+    }
+
+    label = memchr(node->labels, c, (size_t)node->n);
+    if (label == NULL) {
+        return NULL;
+    }
+
+    *index = (int)(label - node->labels);
+    return node->children[*index];
+}
@@ -0,0 +1,62 @@
+//
+// Created by frank on 17-6-12.
+// locations are routed through a radix tree on the uri path,
+// the longest prefix wins and an exact location beats any prefix
+//
+
+#ifndef FANCY_LOCATION_H
+#define FANCY_LOCATION_H
+
+#include "base.h"
+
+typedef struct location location;
+typedef struct location_node location_tree;
+
+struct location {
+
+    string     prefix;
+    unsigned    use_proxy:1;
+    unsigned    exact:1;            /* location = /uri */
+    unsigned    status:1;           /* counters instead of files */
+    unsigned    warmup:1;           /* small files are read in at startup */
+    unsigned    gzip_static:1;      /* a.css.br or a.css.gz for a.css if accepted */
+    unsigned    gzip:1;             /* compress proxied responses */
+
+    /* return <code> [text|url], the response is rendered at config time
+     * with Connection: close and keep-alive, the date is patched in */
+#define MAX_RETURN_TEXT 8192
+#define RETURN_REDIRECT(code) \
+    ((code) == 301 || (code) == 302 || (code) == 303 || (code) == 307 || (code) == 308)
+    int         return_code;        /* 0 if none */
+    string      return_text;        /* the body, or the url of a redirect */
+    string      return_response[2];
+    size_t      return_date;        /* offset of the date */
+
+    int         limit_rate;         /* bytes a second, 0 if not limited */
+    int         limit_rate_after;
+
+    union
+    {
+        struct {
+            int     root_dirfd;
+            string root;
+#define MAX_INDEX 10
+            string index[MAX_INDEX];
+        };
+        struct {
+            string proxy_pass_str;
+            struct sockaddr_in proxy_pass;
+        };
+    };
+};
+
+/* one tree per server, NULL if out of memory */
+location_tree *location_tree_create();
+
+/* loc must stay where it is, FCY_ERROR on a duplicate location */
+int location_add(location_tree *tree, location *loc);
+
+/* NULL if no location matches */
+location *location_find(location_tree *tree, const char *uri, size_t len);
+
+#endif //FANCY_LOCATION_H
@@ -9,6 +9,8 @@
 #include "http_parser.h"
 #include "connection.h"
 #include "request.h"
+#include "gzip.h"
+#include "aio.h"
 
 static const char *suffix_str[] = {
         "html", "txt", "xml", "asp", "css",
@@ -16,34 +18,42 @@ static const char *suffix_str[] = {
         "pdf", NULL,
 };
 
-static const char *content_type_str[] = {
-        "text/html; charset=utf-8",
-        "text/plain; charset=utf-8",
-        "text/xml",
-        "text/asp",
-        "text/css",
-        "image/gif",
-        "image/x-icon",
-        "image/png",
-        "image/jpeg",
-        "application/javascript",
-        "application/pdf",
-        NULL,
+static const content_type content_types[] = {
+        content_type("text/html; charset=utf-8"),
+        content_type("text/plain; charset=utf-8"),
+        content_type("text/xml"),
+        content_type("text/asp"),
+        content_type("text/css"),
+        content_type("image/gif"),
+        content_type("image/x-icon"),
+        content_type("image/png"),
+        content_type("image/jpeg"),
+        content_type("application/javascript"),
+        content_type("application/pdf"),
 };
 
 static void request_set_cork(connection *conn, int open);
+static void request_set_nodelay(connection *conn);
 static void request_set_parser(request *r);
 static void request_set_conn(request *r, connection *c);
 
-static void request_on_header(void *user, string *name, string *value);
-static void request_on_uri(void *user, string *uri, string *suffix);
-static const char *get_content_type(string *suffix);
+static void request_on_header(void *user, int id, string *name, string *value);
+static void request_on_uri(void *user, string *uri, string *suffix, string *args);
+static void request_append_uri(request *r, buffer *b);
+static const content_type *get_content_type(string *suffix);
+static void open_precompressed(request *r, cached_file *f);
+static int request_not_modified(request *r);
+static int request_range(request *r);
+static int multipart_header(request *r, int i, char *buf, size_t size);
 
 
 int request_init(mem_pool *pool)
 {
     (void)pool;
-    return FCY_OK;
+    if (gzip_init() == FCY_ERROR) {
+        return FCY_ERROR;
+    }
+    return file_cache_init();
 }
 
 request *request_create(connection *c)
@@ -74,14 +84,14 @@ request *request_create(connection *c)
         return NULL;
     }
 
-    r->headers = array_create(p, 10, sizeof(keyval));
-    if (r->headers == NULL) {
+    if (http_headers_init(&r->headers, p) == FCY_ERROR) {
         mem_pool_destroy(p);
         return NULL;
     }
 
     r->pool = p;
 
+    request_set_nodelay(c);
     request_set_cork(c, 1);
     request_set_parser(r);
     request_set_conn(r, c);
@@ -91,31 +101,39 @@ request *request_create(connection *c)
 
 void request_reset(request *r)
 {
-    request_set_cork(r->conn, 0);
-    request_set_cork(r->conn, 1);
-
-    if (r->send_fd > 0) {
-        close(r->send_fd);
-    }
-
     buffer *header_in = r->header_in;
     buffer *header_out = r->header_out;
     buffer *body_in = r->body_in;
     buffer *body_out = r->body_out;
-    array  *headers = r->headers;
+    http_headers headers = r->headers;
+
+    /* responses of pipelined requests may be batched in header_out,
+     * they are pushed after being written */
+    if (buffer_empty(header_out)) {
+        request_push(r);
+    }
+
+    request_close_file(r);
 
-    assert(buffer_empty(header_in));
-    assert(buffer_empty(header_out));
-    assert(buffer_empty(body_in));
     assert(buffer_empty(body_out));
 
+    /* bytes read past the body belong to the next pipelined request,
+     * header_in is empty in this case */
+    if ((r->has_content_length_header || r->is_chunked)
+        && buffer_readable_bytes(body_in) > (size_t)r->content_length) {
+        assert(buffer_empty(header_in));
+        buffer_retrieve(body_in, (size_t)r->content_length);
+        buffer_transfer(header_in, body_in);
+    }
+    buffer_retrieve_all(body_in);
 
-    headers->size = 0;
+    http_headers_clear(&headers);
 
     connection *conn = r->conn;
-    ++conn->app_count;
+    ++conn->info->app_count;
 
     mem_pool *pool = r->pool;
+    server *srv = r->srv;
 
     bzero(r, sizeof(request));
 
@@ -126,18 +144,24 @@ void request_reset(request *r)
     r->headers = headers;
     r->conn = conn;
     r->pool = pool;
+    /* the keep-alive timeouts are of the last server */
+    r->srv = srv;
     request_set_parser(r);
 }
 
+void request_push(request *r)
+{
+    request_set_cork(r->conn, 0);
+    request_set_cork(r->conn, 1);
+}
+
 void request_destroy(request *r)
 {
     /* 关闭TCP_CORK选项 */
     request_set_cork(r->conn, 0);
 
     r->conn->app = NULL;
-    if (r->send_fd > 0) {
-        CHECK(close(r->send_fd));
-    }
+    request_close_file(r);
 
     mem_pool_destroy(r->pool);
 }
@@ -160,7 +184,7 @@ void request_headers_htop(request *r, buffer *b)
     /* line */
     buffer_append_str(b, &method_str[p->method]);
     buffer_append_space(b);
-    buffer_append_str(b, &r->uri);
+    request_append_uri(r, b);
     buffer_append_space(b);
     buffer_append_literal(b, "HTTP/1.1\r\n");
 
@@ -182,12 +206,28 @@ void request_headers_htop(request *r, buffer *b)
         buffer_append_literal(b, "close\r\n");
     }
 
+    /* the body is decoded already */
+    if (r->is_chunked) {
+        buffer_append_literal(b, "Content-Length: ");
+        buffer_ensure_writable_bytes(b, 32);
+        int n = sprintf(buffer_begin_write(b), "%ld\r\n", r->content_length);
+        buffer_has_writen(b, (size_t)n);
+    }
+
     /* other headers */
-    for (size_t i = 0; i < r->headers->size; ++i) {
-        keyval *kv = array_at(r->headers, i);
-        buffer_append_str(b, &kv->key);
+    for (size_t i = 0; i < r->headers.list->size; ++i) {
+        http_header *hd = array_at(r->headers.list, i);
+        if (hd->id == HEADER_HOST || hd->id == HEADER_CONNECTION
+            || (hd->id == HEADER_TRANSFER_ENCODING && r->is_chunked)) {
+            continue;
+        }
+        if (r->upgrade_h2c && (hd->id == HEADER_UPGRADE
+                               || hd->id == HEADER_HTTP2_SETTINGS)) {
+            continue;
+        }
+        buffer_append_str(b, &hd->name);
         buffer_append_literal(b, ": ");
-        buffer_append_str(b, &kv->value);
+        buffer_append_str(b, &hd->value);
         buffer_append_crlf(b);
     }
     buffer_append_crlf(b);
@@ -195,19 +235,56 @@ void request_headers_htop(request *r, buffer *b)
 
 int request_read_chunked(request *r)
 {
-    (void)r;
-    // TODO
-    return FCY_ERROR;
+    int err;
+
+    assert(r->is_chunked);
+
+    err = chunk_reader_decode(&r->reader, r->body_in);
+    if (err == FCY_OK) {
+        r->content_length = (long)r->reader.size;
+    }
+    return err;
+}
+
+int request_init_stream(request *r, connection *c, mem_pool *pool)
+{
+    if (http_headers_init(&r->headers, pool) == FCY_ERROR) {
+        return FCY_ERROR;
+    }
+
+    r->pool = pool;
+    r->conn = c;
+    ++c->info->app_count;
+    request_set_parser(r);
+
+    return FCY_OK;
+}
+
+/* uri is nul terminated, it is decoded in place */
+int request_set_uri(request *r, string *uri)
+{
+    return parser_execute_uri(&r->parser, uri->data, uri->data + uri->len);
+}
+
+void request_add_header(request *r, int id, string *name, string *value)
+{
+    request_on_header(r, id, name, value);
 }
 
 int check_request_header(request *r)
 {
     http_parser *p= &r->parser;
 
+    /* the server by Host, then the location in it */
+    r->srv = server_find(r->conn->info->listening, r->host.data, r->host.len);
+    r->loc = location_find(r->srv->tree, r->uri.data, r->uri.len);
     if (r->loc == NULL) {
         r->status_code = STATUS_NOT_FOUND;
         return FCY_ERROR;
     }
+    if (!r->loc->use_proxy) {
+        r->is_static = 1;
+    }
 
     if (p->method != METHOD_GET && p->method != METHOD_POST) {
         r->status_code = STATUS_NOT_IMPLEMENTED;
@@ -226,8 +303,26 @@ int check_request_header(request *r)
     }
 
 
-    /* POST request must have Content-Length field */
-    if (p->method == METHOD_POST) {
+    /* only chunked is understood, and not together with Content-Length */
+    if (http_headers_get(&r->headers, HEADER_TRANSFER_ENCODING) != NULL) {
+        if (!r->is_chunked) {
+            r->status_code = STATUS_NOT_IMPLEMENTED;
+            return FCY_ERROR;
+        }
+        if (r->has_content_length_header) {
+            r->status_code = STATUS_BAD_REQUEST;
+            return FCY_ERROR;
+        }
+    }
+
+    if (r->has_content_length_header && r->srv->client_max_body_size > 0
+        && r->content_length > r->srv->client_max_body_size) {
+        r->status_code = STATUS_PAYLOAD_TOO_LARGE;
+        return FCY_ERROR;
+    }
+
+    /* POST request must have Content-Length field or a chunked body */
+    if (p->method == METHOD_POST && !r->is_chunked) {
         if (!r->has_content_length_header) {
             r->status_code = STATUS_LENGTH_REQUIRED;
             return FCY_ERROR;
@@ -249,9 +344,7 @@ int check_request_header(request *r)
 int open_static_file(request *r)
 {
     location        *loc = r->loc;
-    string         *uri = &r->uri;
-    struct stat     *sbuf = &r->sbuf;
-    int             err;
+    cached_file     *f;
 
     assert(r->is_static);
 
@@ -260,69 +353,308 @@ int open_static_file(request *r)
         return FCY_ERROR;
     }
 
-    char path[uri->len + 64];
-    char *path_base;
+    /* uri is normalized, no "..", no '\0' */
+    f = file_cache_open(loc, r->uri.data, r->uri.len);
+    if (f == NULL) {
+        r->status_code = STATUS_INTARNAL_SEARVE_ERROR;
+        return FCY_ERROR;
+    }
 
-    if (uri->len == 1) {
-        strcpy(path, "./");
-        path_base = path + 2;
+    if (f->status != STATUS_OK) {
+        r->status_code = f->status;
+        file_cache_release(f);
+        return FCY_ERROR;
     }
-    else {
-        strcpy(path, uri->data + 1);
-        path_base = path + uri->len - 1;
+
+    if (f->content_type == NULL) {
+        f->content_type = get_content_type(&f->suffix);
     }
 
-    err = fstatat(loc->root_dirfd, path, sbuf, 0);
-    if (err == -1) {
-        LOG_SYSERR("fstatat %s error", path);
-        r->status_code = STATUS_NOT_FOUND;
+    assert(r->content_type == NULL);
+    r->file = f;
+    r->send_fd = f->fd;
+    r->send_offset = 0;
+    r->sbuf = f->st;
+    r->suffix = f->suffix;
+    r->content_type = f->content_type;
+    r->status_code = STATUS_OK;
+
+    if (loc->gzip_static) {
+        r->vary_encoding = 1;
+        open_precompressed(r, f);
+    }
+
+    f = r->file;
+    if (f->etag_len == 0) {
+        f->etag_len = http_etag(f->etag, &f->st);
+    }
+    if (request_not_modified(r)) {
+        /* the file is kept for the validators, it is not sent */
+        r->status_code = STATUS_NOT_MODIFIED;
+        r->send_fd = 0;
+        r->sbuf.st_size = 0;
+        return FCY_OK;
+    }
+    return request_range(r);
+}
+
+/* If-None-Match, or If-Modified-Since without it */
+static int request_not_modified(request *r)
+{
+    cached_file *f = r->file;
+    string      *value;
+    time_t      t;
+
+    if (r->parser.method != METHOD_GET) {
+        return 0;
+    }
+
+    value = http_headers_get(&r->headers, HEADER_IF_NONE_MATCH);
+    if (value != NULL) {
+        return http_etag_match(value, f->etag, (size_t)f->etag_len, 1);
+    }
+
+    value = http_headers_get(&r->headers, HEADER_IF_MODIFIED_SINCE);
+    if (value == NULL) {
+        return 0;
+    }
+    t = http_parse_time(value);
+    return t != -1 && f->st.st_mtime <= t;
+}
+
+/* 206 for satisfiable ranges, 416 if none is, the whole file otherwise */
+static int request_range(request *r)
+{
+    static u_long   boundary;
+    string          *value, *if_range;
+    int             n, match;
+
+    value = http_headers_get(&r->headers, HEADER_RANGE);
+    if (value == NULL || r->parser.method != METHOD_GET) {
+        return FCY_OK;
+    }
+
+    /* a range of another version is not taken, the whole file is sent */
+    if_range = http_headers_get(&r->headers, HEADER_IF_RANGE);
+    if (if_range != NULL) {
+        if (if_range->len > 0 && (if_range->data[0] == '"' || if_range->data[0] == 'W')) {
+            match = http_etag_match(if_range, r->file->etag, (size_t)r->file->etag_len, 0);
+        }
+        else {
+            match = http_parse_time(if_range) == r->file->st.st_mtime;
+        }
+        if (!match) {
+            return FCY_OK;
+        }
+    }
+
+    n = http_parse_range(value, r->sbuf.st_size, r->ranges, HTTP_MAX_RANGES);
+    if (n == -1 || (n > 1 && r->single_range)) {
+        return FCY_OK;
+    }
+    if (n == 0) {
+        /* the file is kept for Content-Range, it is not sent */
+        r->status_code = STATUS_RANGE_NOT_SATISFIABLE;
+        r->send_fd = 0;
         return FCY_ERROR;
     }
 
-    if (sbuf->st_mode & S_IFDIR) {
+    r->status_code = STATUS_PARTIAL_CONTENT;
+    r->n_ranges = n;
+    r->range_index = 0;
+    r->send_offset = r->ranges[0].start;
+    r->sbuf.st_size = r->ranges[0].end - r->ranges[0].start + 1;
+    if (n > 1) {
+        r->boundary = ++boundary;
+    }
+    return FCY_OK;
+}
+
+off_t request_multipart_length(request *r)
+{
+    char    buf[256];
+    off_t   len = 0;
+
+    assert(r->n_ranges > 1);
+
+    for (int i = 0; i < r->n_ranges; ++i) {
+        len += multipart_header(r, i, buf, sizeof(buf));
+        len += r->ranges[i].end - r->ranges[i].start + 1;
+    }
+    return len + multipart_header(r, r->n_ranges, buf, sizeof(buf));
+}
+
+int request_multipart_next(request *r, buffer *b)
+{
+    int i = r->range_index, n;
+
+    buffer_ensure_writable_bytes(b, 256);
+    n = multipart_header(r, i, buffer_begin_write(b), buffer_writable_bytes(b));
+    buffer_has_writen(b, (size_t)n);
+
+    if (i == r->n_ranges) {
+        return 0;
+    }
+    r->send_offset = r->ranges[i].start;
+    r->sbuf.st_size = r->ranges[i].end - r->ranges[i].start + 1;
+    return 1;
+}
+
+/* the header of part i, the closing boundary for i == n_ranges */
+static int multipart_header(request *r, int i, char *buf, size_t size)
+{
+    int n;
+
+    if (i == r->n_ranges) {
+        n = snprintf(buf, size, "\r\n--%020lu--\r\n", r->boundary);
+    }
+    else {
+        n = snprintf(buf, size, "\r\n--%020lu\r\nContent-Type: %s\r\n"
+                                "Content-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                     r->boundary, r->content_type->name,
+                     r->ranges[i].start, r->ranges[i].end, r->file->st.st_size);
+    }
+    assert(n > 0 && (size_t)n < size);
+    return n;
+}
+
+/* a.css.br, then a.css.gz, sent with the type of a.css */
+static void open_precompressed(request *r, cached_file *f)
+{
+    static const struct {
+        const char  *coding;
+        size_t      len;
+        const char  *ext;
+    } codings[] = {
+        {"br", 2, ".br"},
+        {"gzip", 4, ".gz"},
+    };
+    string      *value;
+    cached_file *c;
+
+    value = http_headers_get(&r->headers, HEADER_ACCEPT_ENCODING);
+    if (value == NULL) {
+        return;
+    }
 
-        if (path_base[-1] != '/') {
-            *path_base++ = '/';
+    for (size_t i = 0; i < sizeof(codings) / sizeof(codings[0]); ++i) {
+        if (!http_accept_encoding(value, codings[i].coding, codings[i].len)) {
+            continue;
+        }
+        c = file_cache_open_sibling(r->loc, f, codings[i].ext);
+        if (c == NULL) {
+            continue;
+        }
+        if (c->status != STATUS_OK) {
+            file_cache_release(c);
+            continue;
         }
 
-        int found = 0;
-        for (int i = 0; loc->index[i].data != NULL; ++i) {
-            strcpy(path_base, loc->index[i].data);
-            err = fstatat(loc->root_dirfd, path, sbuf, 0);
-            if (err != -1) {
-                found = 1;
-                r->suffix.data = strchr(loc->index[i].data, '.');
-                r->suffix.len = strlen(r->suffix.data);
-                break;
-            }
+        file_cache_release(f);
+        r->file = c;
+        r->send_fd = c->fd;
+        r->sbuf = c->st;
+        r->content_encoding = codings[i].coding;
+        return;
+    }
+}
+
+
+void request_close_file(request *r)
+{
+    if (r->file != NULL) {
+        file_cache_release(r->file);
+        r->file = NULL;
+    }
+    r->send_fd = 0;
+}
+
+int request_render_return(location *loc, mem_pool *pool)
+{
+    static const struct {
+        int         code;
+        const char  *reason;
+    } reasons[] = {
+        {200, "OK"}, {204, "No Content"}, {301, "Moved Permanently"},
+        {302, "Found"}, {303, "See Other"}, {304, "Not Modified"},
+        {307, "Temporary Redirect"}, {308, "Permanent Redirect"},
+        {400, "Bad Request"}, {401, "Unauthorized"}, {403, "Forbidden"},
+        {404, "Not Found"}, {410, "Gone"}, {429, "Too Many Requests"},
+        {500, "Internal Server Error"}, {503, "Service Unavailable"},
+    };
+    const char  *reason = "";
+    string      *text = &loc->return_text;
+    size_t      size = 512 + text->len;
+    int         code = loc->return_code, n;
+    char        *p;
+
+    for (size_t i = 0; i < sizeof(reasons) / sizeof(reasons[0]); ++i) {
+        if (reasons[i].code == code) {
+            reason = reasons[i].reason;
+            break;
         }
+    }
 
-        if (!found) {
-            r->status_code = STATUS_NOT_FOUND;
+    for (int keep_alive = 0; keep_alive < 2; ++keep_alive) {
+        p = palloc(pool, size);
+        if (p == NULL) {
             return FCY_ERROR;
         }
-    }
 
+        n = snprintf(p, size, "HTTP/1.1 %d %s\r\nServer: fancy beta\r\nDate: %*s",
+                     code, reason, HTTP_TIME_LEN, "");
+        loc->return_date = (size_t)n - HTTP_TIME_LEN;
 
-    if (!S_ISREG(sbuf->st_mode) || !(S_IRUSR & sbuf->st_mode)) {
-        r->status_code = STATUS_FORBIDDEN;
-        return FCY_ERROR;
-    }
+        if (RETURN_REDIRECT(code)) {
+            n += snprintf(p + n, size - n, "\r\nLocation: %s\r\nContent-Length: 0",
+                          text->data);
+        }
+        else if (code != 204 && code != 304) {
+            n += snprintf(p + n, size - n, "%s%zu", content_types[1].header.data, text->len);
+        }
+        n += snprintf(p + n, size - n, "\r\nConnection: %s\r\n\r\n",
+                      keep_alive ? "keep-alive" : "close");
 
-    int fd = openat(loc->root_dirfd, path, O_RDONLY);
-    if (fd == -1) {
-        close(fd);
-        LOG_SYSERR("fstatat error");
-        r->status_code = STATUS_INTARNAL_SEARVE_ERROR;
-        return FCY_ERROR;
+        if (!RETURN_REDIRECT(code) && code != 204 && code != 304) {
+            memcpy(p + n, text->data, text->len);
+            n += text->len;
+        }
+        assert((size_t)n < size);
+
+        loc->return_response[keep_alive].data = p;
+        loc->return_response[keep_alive].len = (size_t)n;
     }
+    return FCY_OK;
+}
 
-    assert(r->content_type == NULL);
-    r->content_type = get_content_type(&r->suffix);
+int request_status_page(request *r, char *buf, size_t size)
+{
+    file_cache_stat *st = &file_cache_stats;
+    int             n;
+
+    n = snprintf(buf, size,
+                 "connections in use: %d\n"
+                 "open file cache: %lu entries\n"
+                 "hits misses expired revalidated invalidated evicted\n"
+                 "%lu %lu %lu %lu %lu %lu\n"
+                 "in memory: %lu files %zu bytes, %lu hits\n"
+                 "gzip: %lu responses %lu bytes in %lu bytes out %lu us, level %d\n"
+                 "sendfile: %lu warm %lu cold, %lu bytes read in %lu us\n",
+                 conn_used(), st->entries,
+                 st->hits, st->misses, st->expired, st->revalidated,
+                 st->invalidated, st->evicted,
+                 st->mem_entries, st->mem_size, st->mem_hits,
+                 gzip_stats.responses, gzip_stats.bytes_in, gzip_stats.bytes_out,
+                 gzip_stats.usec, gzip_level(),
+                 aio_stats.warm, aio_stats.cold, aio_stats.bytes, aio_stats.usec);
+    if (n < 0 || (size_t)n >= size) {
+        return -1;
+    }
 
-    r->send_fd = fd;
     r->status_code = STATUS_OK;
-    return FCY_OK;
+    r->content_type = &content_types[1];
+    r->sbuf.st_size = n;
+    return n;
 }
 
 static void request_set_cork(connection *conn, int open)
@@ -330,6 +662,13 @@ static void request_set_cork(connection *conn, int open)
     CHECK(setsockopt(conn->sockfd, IPPROTO_TCP, TCP_CORK, &open, sizeof(open)));
 }
 
+/* 去掉cork时剩下的不满一个MSS的数据立即发出, 不等前一个响应的ACK */
+static void request_set_nodelay(connection *conn)
+{
+    int on = 1;
+    CHECK(setsockopt(conn->sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)));
+}
+
 static void request_set_parser(request *r)
 {
     r->parser.type = HTTP_PARSE_REQUEST;
@@ -343,84 +682,111 @@ static void request_set_conn(request *r, connection *c)
     assert(c->app == NULL);  /* 同一时刻只允许一个app占用connection */
     r->conn = c;
     c->app = r;
-    ++c->app_count;
+    ++c->info->app_count;
 }
 
-static void request_on_header(void *user, string *name, string *value)
+static void request_on_header(void *user, int id, string *name, string *value)
 {
     request *r = user;
-    if (strcasecmp(name->data, "Host") == 0) {
-        r->has_host_header = 1;
-        r->host = *value;
-        return;
-    }
-    else if (strcasecmp(name->data, "Connection") == 0) {
-        r->has_connection_header = 1;
-        r->connection = *value;
-        if (strcasecmp(value->data, "Keep-alive") == 0) {
-            r->should_keep_alive = 1;
-        }
-        else {
-            r->should_keep_alive = 0;
-        }
-        return;
-    }
-    else if (strcasecmp(name->data, "Content-Length") == 0) {
-        r->has_content_length_header = 1;
-        r->content_length = atoi(value->data);
-    }
-    else if (strcasecmp(name->data, "Transfer-Encoding") == 0) {
-        if (strcasecmp(value->data, "chunked") == 0) {
-            r->is_chunked = 1;
-        }
+
+    switch (id) {
+        case HEADER_HOST:
+            r->has_host_header = 1;
+            r->host = *value;
+            break;
+
+        case HEADER_CONNECTION:
+            r->has_connection_header = 1;
+            r->connection = *value;
+            if (strcasecmp(value->data, "Keep-alive") == 0) {
+                r->should_keep_alive = 1;
+            }
+            else {
+                r->should_keep_alive = 0;
+            }
+            break;
+
+        case HEADER_CONTENT_LENGTH:
+            r->has_content_length_header = 1;
+            r->content_length = atoi(value->data);
+            break;
+
+        case HEADER_TRANSFER_ENCODING:
+            if (strcasecmp(value->data, "chunked") == 0) {
+                r->is_chunked = 1;
+            }
+            break;
+
+        case HEADER_UPGRADE:
+            if (strcasecmp(value->data, "h2c") == 0) {
+                r->upgrade_h2c = 1;
+            }
+            break;
+
+        default:
+            break;
     }
 
-    keyval *kv = array_alloc(r->headers);
-    if (kv == NULL) {
+    if (http_headers_add(&r->headers, id, name, value) == NULL) {
         LOG_ERROR("array alloc failed");
         exit(EXIT_FAILURE);
     }
-    kv->key = *name;
-    kv->value = *value;
 }
 
-static void request_on_uri(void *user, string *uri, string *suffix)
+static void request_on_uri(void *user, string *uri, string *suffix, string *args)
 {
     request *r = user;
-    location *loc = NULL;
 
     r->uri = *uri;
     r->suffix = *suffix;
+    r->args = *args;
+}
 
-    for (size_t i = 0; i < locations->size; ++i) {
-        loc = array_at(locations, i);
-        if (strncmp(uri->data, loc->prefix.data, loc->prefix.len) == 0) {
-            r->loc = loc;
-            if (!loc->use_proxy) {
-                r->is_static = 1;
-            }
-            else {
-                r->conn->peer->addr = loc->proxy_pass;
-            }
-            break;
+/* uri is decoded, escape again what may not appear in a path */
+static void request_append_uri(request *r, buffer *b)
+{
+    static const char   hex[] = "0123456789ABCDEF";
+    static const u_char keep[256] = {
+            ['a' ... 'z'] = 1, ['A' ... 'Z'] = 1, ['0' ... '9'] = 1,
+            ['-'] = 1, ['.'] = 1, ['_'] = 1, ['~'] = 1,
+            ['!'] = 1, ['$'] = 1, ['&'] = 1, ['\''] = 1, ['('] = 1, [')'] = 1,
+            ['*'] = 1, ['+'] = 1, [','] = 1, [';'] = 1, ['='] = 1,
+            [':'] = 1, ['@'] = 1, ['/'] = 1,
+    };
+    u_char  *p = (u_char*)r->uri.data;
+    u_char  *end = p + r->uri.len;
+    char    *u;
+
+    buffer_ensure_writable_bytes(b, r->uri.len * 3 + r->args.len + 1);
+    u = buffer_begin_write(b);
+
+    for (; p < end; ++p) {
+        if (keep[*p]) {
+            *u++ = *p;
+        }
+        else {
+            *u++ = '%';
+            *u++ = hex[*p >> 4];
+            *u++ = hex[*p & 0xf];
         }
     }
-
-    if (loc == NULL) {
-        r->status_code = STATUS_NOT_FOUND;
-        return;
+    if (r->args.data != NULL) {
+        *u++ = '?';
+        memcpy(u, r->args.data, r->args.len);
+        u += r->args.len;
     }
+    buffer_has_writen(b, u - buffer_begin_write(b));
 }
 
-static const char *get_content_type(string *suffix)
+static const content_type *get_content_type(string *suffix)
 {
-    if (suffix != NULL) {
+    if (suffix->data != NULL) {
         assert(*suffix->data == '.');
         for (int i = 0; suffix_str[i] != NULL; ++i) {
             if (strcmp(suffix->data + 1, suffix_str[i]) == 0) {
-                return content_type_str[i];
+                return &content_types[i];
             }
         }
     }
-    return content_type_str[0];
+    return &content_types[0];
 }
\ No newline at end of file
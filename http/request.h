@@ -10,14 +10,25 @@
 #include "event.h"
 #include "http_parser.h"
 #include "chunk_reader.h"
+#include "location.h"
+#include "server.h"
+#include "file_cache.h"
 
 #define HTTP_POOL_SIZE              (4096 * 1024)
 #define HTTP_BUFFER_SIZE            BUFFER_INIT_SIZE
 #define HTTP_MAX_CONTENT_LENGTH     (4000 * 1000)
 
+/* pipelined responses are batched in header_out up to this size,
+ * static files no larger than HTTP_PIPELINE_INLINE are copied in */
+#define HTTP_PIPELINE_BATCH         (64 * 1024)
+#define HTTP_PIPELINE_INLINE        (16 * 1024)
+#define HTTP_PIPELINE_DEPTH         32
+
+/* a Range header with more is ignored */
+#define HTTP_MAX_RANGES             16
+
 
 typedef struct request  request;
-typedef struct location location;
 
 struct request {
 
@@ -28,13 +39,18 @@ struct request {
     unsigned        has_content_length_header:1;
     unsigned        is_static:1;
     unsigned        is_chunked:1;
+    unsigned        upgrade_h2c:1;
+    unsigned        vary_encoding:1;    /* Vary: Accept-Encoding */
+    unsigned        single_range:1;     /* no multipart/byteranges */
 
-    string         uri;
+    string         uri;        /* normalized, decoded */
     string         suffix;
+    string         args;       /* as received, after '?' */
     string         host;
     string         connection;
-    array           *headers;   /* 其余的header */
+    http_headers    headers;    /* Host和Connection之外的也在其中 */
 
+    server          *srv;       /* chosen by Host, kept by request_reset */
     location        *loc;
 
     connection      *conn;
@@ -45,49 +61,60 @@ struct request {
     buffer          *body_in;
     buffer          *body_out;
 
+    cached_file     *file;      /* send_fd belongs to it */
     int             send_fd;
-    struct stat     sbuf;
+    off_t           send_offset;
+    struct stat     sbuf;       /* st_size is what is left to send */
+
+    /* 206, ranges[range_index] is being sent. one range is sent as it is,
+     * more as multipart/byteranges */
+    http_range      ranges[HTTP_MAX_RANGES];
+    int             n_ranges;
+    int             range_index;
+    u_long          boundary;
 
     int             status_code;
     long            content_length;
-    const char      *content_type;
+    const content_type  *content_type;
+    const char      *content_encoding;  /* NULL if sent as it is */
 
     http_parser     parser;
+    chunk_reader    reader;
 };
 
-struct location {
-
-    string     prefix;
-    unsigned    use_proxy:1;
-
-    union
-    {
-        struct {
-            int     root_dirfd;
-            string root;
-#define MAX_INDEX 10
-            string index[MAX_INDEX];
-        };
-        struct {
-            string proxy_pass_str;
-            struct sockaddr_in proxy_pass;
-        };
-    };
-};
-
-/* call before loop, empty currently */
+/* call before loop, sets up the open file cache */
 int request_init(mem_pool *pool);
 
 request *request_create(connection *c);
 void request_destroy(request *r);
 void request_reset(request *r); /* for keep_alive, avoid destroy */
+void request_push(request *r);  /* send what TCP_CORK holds back */
 int request_parse(request *r);
 void request_headers_htop(request *, buffer *);
 
+/* decode body_in in place, content_length is set when done */
 int request_read_chunked(request *r);
 
+/* a request of an http/2 stream on c, buffers are left to the caller */
+int request_init_stream(request *r, connection *c, mem_pool *pool);
+int request_set_uri(request *r, string *uri);
+void request_add_header(request *r, int id, string *name, string *value);
+
 /* process function */
 int check_request_header(request *r);
 int open_static_file(request *r);
+void request_close_file(request *r);
+
+/* multipart/byteranges: the Content-Length, and the next part.
+ * the next part header is appended to b and 1 returned, or the
+ * closing boundary and 0 after the last part */
+off_t request_multipart_length(request *r);
+int request_multipart_next(request *r, buffer *b);
+
+/* the responses of a return location, FCY_ERROR if out of memory */
+int request_render_return(location *loc, mem_pool *pool);
+
+/* the body of a status location, the length of it or -1 if size is short */
+int request_status_page(request *r, char *buf, size_t size);
 
 #endif //FANCY_REQUEST_H
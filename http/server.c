@@ -0,0 +1,216 @@
+//
+// Created by frank on 17-6-15.
+//
+
+#include "palloc.h"
+#include "server.h"
+
+array               *listenings;
+
+static mem_pool     *pool;
+
+static listening *listening_get(int port, server *srv);
+static void names_build(listening *ls, array *servers);
+static void name_add(server_name *table, u_int mask, string *name, server *srv);
+static server_name *name_lookup(server_name *table, u_int mask,
+                                const char *name, size_t len);
+static u_int name_hash(const char *p, size_t len);
+
+void server_init(array *servers)
+{
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    if (pool == NULL) {
+        fprintf(stderr, "mem_pool_create failed");
+        exit(EXIT_FAILURE);
+    }
+    listenings = array_create(pool, 4, sizeof(listening));
+    if (listenings == NULL) {
+        fprintf(stderr, "palloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < servers->size; ++i) {
+        server *srv = array_at(servers, i);
+
+        srv->tree = location_tree_create();
+        if (srv->tree == NULL) {
+            fprintf(stderr, "palloc failed");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t j = 0; j < srv->locations->size; ++j) {
+            location *loc = array_at(srv->locations, j);
+            if (location_add(srv->tree, loc) == FCY_ERROR) {
+                fprintf(stderr, "duplicate location %s%s",
+                        loc->exact ? "= " : "", loc->prefix.data);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        listening_get(srv->listen_on, srv);
+    }
+
+    /* the array does not move any more */
+    for (size_t i = 0; i < listenings->size; ++i) {
+        names_build(array_at(listenings, i), servers);
+    }
+}
+
+server *server_find(listening *ls, const char *host, size_t len)
+{
+    char        name[SERVER_MAX_NAME];
+    const char  *end;
+    server_name *sn;
+
+    if (ls->exact == NULL || len == 0) {
+        return ls->default_server;
+    }
+
+    /* [::1]:8080, example.com:8080, example.com. */
+    if (host[0] == '[') {
+        end = memchr(host, ']', len);
+        if (end != NULL) {
+            len = end - host + 1;
+        }
+    }
+    else {
+        end = memchr(host, ':', len);
+        if (end != NULL) {
+            len = end - host;
+        }
+    }
+    if (len > 0 && host[len - 1] == '.') {
+        --len;
+    }
+    if (len == 0 || len > SERVER_MAX_NAME) {
+        return ls->default_server;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        name[i] = (char)tolower(host[i]);
+    }
+
+    sn = name_lookup(ls->exact, ls->mask, name, len);
+    if (sn != NULL) {
+        return sn->srv;
+    }
+
+    /* the longest wildcard first, "*.example.com" does not match example.com */
+    for (size_t i = 1; i < len; ++i) {
+        if (name[i] == '.') {
+            sn = name_lookup(ls->wildcard, ls->mask, name + i, len - i);
+            if (sn != NULL) {
+                return sn->srv;
+            }
+        }
+    }
+
+    return ls->default_server;
+}
+
+static listening *listening_get(int port, server *srv)
+{
+    listening *ls;
+
+    for (size_t i = 0; i < listenings->size; ++i) {
+        ls = array_at(listenings, i);
+        if (ls->port == port) {
+            return ls;
+        }
+    }
+
+    ls = array_alloc(listenings);
+    if (ls == NULL) {
+        fprintf(stderr, "palloc failed");
+        exit(EXIT_FAILURE);
+    }
+    bzero(ls, sizeof(listening));
+    ls->port = port;
+    ls->default_server = srv;
+    return ls;
+}
+
+static void names_build(listening *ls, array *servers)
+{
+    size_t  n = 0, slots = 4;
+
+    for (size_t i = 0; i < servers->size; ++i) {
+        server *srv = array_at(servers, i);
+        if (srv->listen_on == ls->port) {
+            n += srv->names->size;
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+
+    /* at most half full */
+    while (slots < n * 2) {
+        slots *= 2;
+    }
+    ls->mask = (u_int)slots - 1;
+    ls->exact = pcalloc(pool, slots * sizeof(server_name));
+    ls->wildcard = pcalloc(pool, slots * sizeof(server_name));
+    if (ls->exact == NULL || ls->wildcard == NULL) {
+        fprintf(stderr, "too many server names on port %d", ls->port);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < servers->size; ++i) {
+        server *srv = array_at(servers, i);
+        if (srv->listen_on != ls->port) {
+            continue;
+        }
+        for (size_t j = 0; j < srv->names->size; ++j) {
+            string *name = array_at(srv->names, j);
+            if (name->data[0] == '.') {
+                name_add(ls->wildcard, ls->mask, name, srv);
+            }
+            else {
+                name_add(ls->exact, ls->mask, name, srv);
+            }
+        }
+    }
+}
+
+static void name_add(server_name *table, u_int mask, string *name, server *srv)
+{
+    u_int i = name_hash(name->data, name->len) & mask;
+
+    for (; table[i].name.data != NULL; i = (i + 1) & mask) {
+        if (table[i].name.len == name->len
+            && memcmp(table[i].name.data, name->data, name->len) == 0) {
+            if (table[i].srv != srv) {
+                fprintf(stderr, "conflicting server name %s", name->data);
+                exit(EXIT_FAILURE);
+            }
+            return;
+        }
+    }
+    table[i].name = *name;
+    table[i].srv = srv;
+}
+
+static server_name *name_lookup(server_name *table, u_int mask,
+                                const char *name, size_t len)
+{
+    u_int i = name_hash(name, len) & mask;
+
+    for (; table[i].name.data != NULL; i = (i + 1) & mask) {
+        if (table[i].name.len == len && memcmp(table[i].name.data, name, len) == 0) {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
+
+/* FNV-1a */
+static u_int name_hash(const char *p, size_t len)
+{
+    u_int h = 2166136261u;
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (u_char)p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
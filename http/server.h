@@ -0,0 +1,70 @@
+//
+// Created by frank on 17-6-15.
+// virtual servers: each server {} block owns its locations and timeouts,
+// servers on the same port share one listen socket and are told apart
+// by the Host header, exact names first, then wildcards "*.example.com"
+//
+
+#ifndef FANCY_SERVER_H
+#define FANCY_SERVER_H
+
+#include "base.h"
+#include "array.h"
+#include "connection.h"
+#include "location.h"
+
+#define SERVER_MAX_NAME     255     /* a longer Host goes to the default server */
+
+typedef struct server       server;
+typedef struct server_name  server_name;
+typedef struct listening    listening;
+
+struct server {
+
+    array           *names;         /* string, "*.example.com" is kept as ".example.com" */
+    array           *locations;     /* location, the tree points into it */
+    location_tree   *tree;
+
+    int             listen_on;
+    int             request_timeout;
+    int             upstream_timeout;
+    int             keep_alive_requests;
+    int             keepalive_timeout;
+    int             client_max_body_size;
+    int             http2;
+};
+
+struct server_name {
+    string          name;
+    server          *srv;
+};
+
+/* a port, the first server on it is the default one */
+struct listening {
+
+    int             port;
+    connection      *conn;
+    server          *default_server;
+
+    /* open addressing, mask + 1 slots, NULL name for an empty one */
+    server_name     *exact;
+    server_name     *wildcard;
+    u_int           mask;
+};
+
+extern array *listenings;
+
+/* after the config is read, servers must not move any more.
+ * builds location trees and name tables, exits on a conflict */
+void server_init(array *servers);
+
+/* never NULL, host as in the Host header, the port is ignored */
+server *server_find(listening *ls, const char *host, size_t len);
+
+/* the default server of the port c is accepted on, before Host is known */
+static inline server *conn_server(connection *c)
+{
+    return ((listening*)c->info->listening)->default_server;
+}
+
+#endif //FANCY_SERVER_H
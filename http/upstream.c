@@ -6,9 +6,11 @@
 #include "upstream.h"
 #include "request.h"
 #include "chunk_reader.h"
+#include "gzip.h"
 
 static void upstream_set_parser(upstream *u);
-static void upstream_on_header(void *user, string *name, string *value);
+static int gzip_type(string *type);
+static void upstream_on_header(void *user, int id, string *name, string *value);
 
 upstream *upstream_create(peer_connection *conn, mem_pool *p)
 {
@@ -19,8 +21,7 @@ upstream *upstream_create(peer_connection *conn, mem_pool *p)
         return NULL;
     }
 
-    u->headers = array_create(p, 10, sizeof(keyval));
-    if (u->headers == NULL) {
+    if (http_headers_init(&u->headers, p) == FCY_ERROR) {
         return NULL;
     }
 
@@ -48,7 +49,7 @@ void upstream_destroy(upstream *u)
     buffer_destroy(u->body_in);
     buffer_destroy(u->header_out);
     buffer_destroy(u->header_in);
-    array_destroy(u->headers);
+    array_destroy(u->headers.list);
 }
 
 int upstream_parse(upstream *u)
@@ -58,10 +59,9 @@ int upstream_parse(upstream *u)
     return parser_execute(&u->parser, beg, end);
 }
 
+/* appended, b may hold responses of earlier pipelined requests */
 void upstream_headers_htop(upstream *u, buffer *b)
 {
-    assert(buffer_empty(b));
-
     http_parser *p = &u->parser;
 
     /* line */
@@ -71,11 +71,36 @@ void upstream_headers_htop(upstream *u, buffer *b)
     buffer_append_literal(b, "\r\nServer: fancy beta");
     buffer_append_literal(b, "\r\nConnection: close\r\n");
 
-    for (size_t i = 0; i < u->headers->size; ++i) {
-        keyval *kv = array_at(u->headers, i);
-        buffer_append_str(b, &kv->key);
+    if (u->gzipped) {
+        buffer_append_literal(b, "Content-Encoding: gzip\r\n");
+    }
+    if (u->vary_encoding) {
+        buffer_append_literal(b, "Vary: Accept-Encoding\r\n");
+    }
+
+    /* de-chunked or compressed, the body is sent as a whole */
+    if (u->is_chunked || u->gzipped) {
+        buffer_append_literal(b, "Content-Length: ");
+        buffer_ensure_writable_bytes(b, 32);
+        int n = sprintf(buffer_begin_write(b), "%ld\r\n", u->content_length);
+        buffer_has_writen(b, (size_t)n);
+    }
+
+    for (size_t i = 0; i < u->headers.list->size; ++i) {
+        http_header *hd = array_at(u->headers.list, i);
+        if (hd->id == HEADER_CONNECTION || hd->id == HEADER_SERVER) {
+            continue;
+        }
+        if (u->is_chunked && (hd->id == HEADER_TRANSFER_ENCODING
+                              || hd->id == HEADER_TRAILER)) {
+            continue;
+        }
+        if (u->gzipped && hd->id == HEADER_CONTENT_LENGTH) {
+            continue;
+        }
+        buffer_append_str(b, &hd->name);
         buffer_append_literal(b, ": ");
-        buffer_append_str(b, &kv->value);
+        buffer_append_str(b, &hd->value);
         buffer_append_crlf(b);
     }
     buffer_append_crlf(b);
@@ -83,12 +108,83 @@ void upstream_headers_htop(upstream *u, buffer *b)
 
 int upstream_read_chunked(upstream *u)
 {
+    int err;
+
     assert(u->is_chunked);
 
-    char *beg = buffer_peek(u->body_in);
-    char *end = buffer_begin_write(u->body_in);
+    err = chunk_reader_decode(&u->reader, u->body_in);
+    if (err == FCY_OK) {
+        /* nothing is expected after the body */
+        buffer_unwrite(u->body_in, buffer_readable_bytes(u->body_in) - u->reader.size);
+        u->content_length = (long)u->reader.size;
+    }
+    return err;
+}
+
+void upstream_gzip(upstream *u, request *r)
+{
+    buffer  *b = u->body_in;
+    size_t  size = buffer_readable_bytes(b);
+    string  *type, *accept;
+
+    if (!r->loc->gzip) {
+        return;
+    }
+
+    /* 200 only, and not compressed already */
+    if (strncmp(u->parser.response_line.data + 9, "200", 3) != 0
+        || http_headers_get(&u->headers, HEADER_CONTENT_ENCODING) != NULL) {
+        return;
+    }
+    type = http_headers_get(&u->headers, HEADER_CONTENT_TYPE);
+    if (type == NULL || !gzip_type(type)) {
+        return;
+    }
+    u->vary_encoding = 1;
+
+    accept = http_headers_get(&r->headers, HEADER_ACCEPT_ENCODING);
+    if (accept == NULL || !http_accept_encoding(accept, "gzip", 4)) {
+        return;
+    }
 
-    return chunk_reader_execute(&u->reader, beg, end);
+    if (u->has_content_length_header && size > (size_t)u->content_length) {
+        size = (size_t)u->content_length;
+    }
+    if (size < (size_t)gzip_min_length) {
+        return;
+    }
+
+    buffer_retrieve_all(u->body_out);
+    if (gzip_begin(gzip_level()) == FCY_ERROR
+        || gzip_update(buffer_peek(b), size, u->body_out, 1) == FCY_ERROR) {
+        return;
+    }
+
+    u->body_in = u->body_out;
+    u->body_out = b;
+    u->content_length = (long)buffer_readable_bytes(u->body_in);
+    u->gzipped = 1;
+}
+
+/* "text/html; charset=utf-8", text/html is always compressed */
+static int gzip_type(string *type)
+{
+    size_t  len = 0;
+
+    while (len < type->len && type->data[len] != ';' && type->data[len] != ' ') {
+        ++len;
+    }
+
+    if (len == 9 && strncasecmp(type->data, "text/html", 9) == 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < gzip_types->size; ++i) {
+        string *t = array_at(gzip_types, i);
+        if (t->len == len && strncasecmp(type->data, t->data, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 static void upstream_set_parser(upstream *u)
@@ -98,31 +194,36 @@ static void upstream_set_parser(upstream *u)
     u->parser.user = u;
 }
 
-static void upstream_on_header(void *user, string *name, string *value)
+static void upstream_on_header(void *user, int id, string *name, string *value)
 {
     upstream *u = user;
-    if (strcasecmp(name->data, "Content-Length") == 0) {
-        u->has_content_length_header = 1;
-        u->content_length = atoi(value->data);
-    }
-    else if (strcasecmp(name->data, "Connection") == 0) {
-        u->connection = *value;
-        return;
-    }
-    else if (strcasecmp(name->data, "Server") == 0) {
-        u->server = *value;
-        return;
-    }
-    else if (strcasecmp(name->data, "Transfer-Encoding") == 0) {
-        if (strcasecmp(value->data, "chunked") == 0) {
-            u->is_chunked = 1;
-        }
+
+    switch (id) {
+        case HEADER_CONTENT_LENGTH:
+            u->has_content_length_header = 1;
+            u->content_length = atoi(value->data);
+            break;
+
+        case HEADER_CONNECTION:
+            u->connection = *value;
+            break;
+
+        case HEADER_SERVER:
+            u->has_server_header = 1;
+            u->server = *value;
+            break;
+
+        case HEADER_TRANSFER_ENCODING:
+            if (strcasecmp(value->data, "chunked") == 0) {
+                u->is_chunked = 1;
+            }
+            break;
+
+        default:
+            break;
     }
 
-    keyval *kv = array_alloc(u->headers);
-    if (kv == NULL) {
+    if (http_headers_add(&u->headers, id, name, value) == NULL) {
         LOG_FATAL("array_alloc error, run out of memory");
     }
-    kv->key = *name;
-    kv->value = *value;
-}
\ No newline at end of file
+}
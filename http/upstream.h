@@ -18,6 +18,8 @@ struct upstream {
     unsigned    has_content_length_header:1;
     unsigned    has_server_header:1;
     unsigned    is_chunked:1;
+    unsigned    gzipped:1;          /* body_in is compressed by us */
+    unsigned    vary_encoding:1;
 
     /* body may be read when read header
      * so first time call read_body, we don't need to read */
@@ -32,16 +34,23 @@ struct upstream {
 
     string      server;
     string      connection;
-    array       *headers;
+    http_headers    headers;
 
     http_parser     parser;
     chunk_reader    reader;
+
+    void            *user;      /* http/2 stream */
 };
 
 upstream *upstream_create(peer_connection *, mem_pool *);
 void upstream_destroy(upstream *);
 int upstream_parse(upstream *);
 void upstream_headers_htop(upstream *, buffer *);
+/* decode body_in in place, content_length is set when done */
 int upstream_read_chunked(upstream *);
 
+/* the whole body is in, compress it if r is in a "gzip on" location,
+ * takes gzip and the type is in gzip_types */
+void upstream_gzip(upstream *, request *r);
+
 #endif //FANCY_UPSTREAM_H
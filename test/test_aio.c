@@ -0,0 +1,88 @@
+//
+// Created by frank on 17-6-19.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "base.h"
+#include "log.h"
+#include "timer.h"
+#include "connection.h"
+#include "aio.h"
+
+/* config.c is not linked */
+int log_level           = LOG_LEVEL_WARN;
+int epoll_events        = 0;
+int sendfile_max_chunk  = 0;
+int write_budget        = 0;
+int aio_threads         = 1;
+
+static int          file_fd;
+static off_t        offset;
+static struct stat  st;
+
+static void send_h(event *ev);
+
+int main()
+{
+    char        path[] = "/tmp/test_aio.XXXXXX";
+    char        buf[64 * 1024];
+    int         sv[2];
+    size_t      size = 4 * 1024 * 1024, n;
+    mem_pool    *pool;
+    connection  *conn;
+
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    assert(pool != NULL);
+    assert(conn_pool_init(16, 16) == FCY_OK);
+    assert(event_init(pool, 16) == FCY_OK);
+    timer_init();
+    assert(aio_init() == FCY_OK);
+
+    file_fd = mkstemp(path);
+    assert(file_fd != -1);
+    memset(buf, 'a', sizeof(buf));
+    for (n = 0; n < size; n += sizeof(buf)) {
+        assert(write(file_fd, buf, sizeof(buf)) == sizeof(buf));
+    }
+    assert(fstat(file_fd, &st) == 0);
+
+    /* 刚写的在内存中, 最多看AIO_READ_SIZE */
+    assert(aio_resident(file_fd, 0, 100) == 100);
+    assert(aio_resident(file_fd, 5000, size - 5000) >= AIO_READ_SIZE - 8192);
+
+    /* 赶出内存后, 由线程读入, 读完再发 */
+    assert(fdatasync(file_fd) == 0);
+    assert(posix_fadvise(file_fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    if (aio_resident(file_fd, 0, size) == 0) {
+        assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+        conn = conn_get();
+        conn->sockfd = sv[0];
+        conn_enable_write(conn, send_h);
+        send_h(&conn->write);
+        assert(conn->aio && !conn->write.active && aio_stats.cold == 1);
+
+        while (st.st_size > 0) {
+            assert(event_process(1000) > 0);
+            while (read(sv[1], buf, sizeof(buf)) > 0) {
+            }
+        }
+        assert(aio_stats.cold >= 1 && aio_stats.warm >= 1);
+        assert(aio_stats.bytes >= AIO_READ_SIZE);
+        conn_disable_write(conn);
+        conn_free(conn);
+    }
+    else {
+        printf("page cache not dropped, threads not tried\n");
+    }
+
+    unlink(path);
+    printf("test aio passed\n");
+    return 0;
+}
+
+static void send_h(event *ev)
+{
+    CONN_SEND_FILE(ev->conn, file_fd, &offset, (&st), assert(0));
+}
@@ -0,0 +1,167 @@
+//
+// Created by frank on 17-6-11.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include "base.h"
+#include "buffer.h"
+#include "chunk_reader.h"
+
+#define BODY_SIZE       (1 << 20)
+#define BENCH_ROUNDS    50
+
+/* buffers grow inside one pool block */
+#define TEST_POOL_SIZE  (BODY_SIZE * 8)
+
+static const char tail[] = "GET /next HTTP/1.1\r\n\r\n";
+
+static const char *good_dataset[][2] = {
+        {"0\r\n\r\n", ""},
+        {"5\r\nhello\r\n0\r\n\r\n", "hello"},
+        {"5;name=value\r\nhello\r\n6 ; x\r\n world\r\n0\r\n\r\n", "hello world"},
+        {"A\r\n0123456789\r\n0\r\nExpires: never\r\nX-Sum: 1\r\n\r\n", "0123456789"},
+        {"00000003\r\nabc\r\n0\r\n\r\n", "abc"},
+};
+
+static const char *bad_dataset[] = {
+        "\r\n",
+        "zz\r\n",
+        "5\r\nhello0\r\n\r\n",
+        "5\nhello\r\n0\r\n\r\n",
+        "5\r\nhello\r\n0\r\n\rx",
+        "fffffffffffffffff\r\n",
+};
+
+static char *encode(const char *src, size_t len, size_t chunk, size_t *out_len);
+static int decode(buffer *b, const char *data, size_t len, size_t step, chunk_reader *cr);
+static void bench(const char *name, size_t chunk);
+
+int main()
+{
+    mem_pool        *p = mem_pool_create(TEST_POOL_SIZE);
+    buffer          *b = buffer_create(p, 64);
+    chunk_reader    cr;
+    char            *src, *enc;
+    size_t          len, steps[] = {1, 2, 7, 4096, SIZE_MAX};
+
+    /* 一次读入和分多次读入, 解码结果都一样, 之后的字节留在body之后 */
+    for (size_t i = 0; i < sizeof(good_dataset) / sizeof(*good_dataset); ++i) {
+        const char *in = good_dataset[i][0], *out = good_dataset[i][1];
+        char        data[256];
+
+        len = (size_t)sprintf(data, "%s%s", in, tail);
+        for (size_t s = 0; s < sizeof(steps) / sizeof(*steps); ++s) {
+            assert(decode(b, data, len, steps[s], &cr) == FCY_OK);
+            assert(cr.size == strlen(out));
+            assert(buffer_readable_bytes(b) == cr.size + strlen(tail));
+            assert(memcmp(buffer_peek(b), out, cr.size) == 0);
+            assert(memcmp(buffer_peek(b) + cr.size, tail, strlen(tail)) == 0);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(bad_dataset) / sizeof(*bad_dataset); ++i) {
+        for (size_t s = 0; s < sizeof(steps) / sizeof(*steps); ++s) {
+            assert(decode(b, bad_dataset[i], strlen(bad_dataset[i]),
+                          steps[s], &cr) == FCY_ERROR);
+        }
+    }
+
+    /* 大小不一的chunk */
+    src = malloc(BODY_SIZE);
+    for (size_t i = 0; i < BODY_SIZE; ++i) {
+        src[i] = (char)(i * 7 + i / 251);
+    }
+    size_t chunks[] = {1, 13, 4096, 65535, BODY_SIZE};
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(*chunks); ++c) {
+        enc = encode(src, BODY_SIZE, chunks[c], &len);
+        assert(decode(b, enc, len, 1000, &cr) == FCY_OK);
+        assert(cr.size == BODY_SIZE);
+        assert(buffer_readable_bytes(b) == BODY_SIZE);
+        assert(memcmp(buffer_peek(b), src, BODY_SIZE) == 0);
+        free(enc);
+    }
+    free(src);
+
+    bench("many small chunks", 16);
+    bench("small chunks", 512);
+    bench("few huge chunks", 256 * 1024);
+
+    mem_pool_destroy(p);
+    printf("test_chunk_reader ok\n");
+}
+
+static char *encode(const char *src, size_t len, size_t chunk, size_t *out_len)
+{
+    char    *out = malloc(len + (len / chunk + 2) * 32);
+    size_t  n = 0;
+
+    for (size_t i = 0; i < len; i += chunk) {
+        size_t c = len - i < chunk ? len - i : chunk;
+        n += (size_t)sprintf(out + n, "%zx\r\n", c);
+        memcpy(out + n, src + i, c);
+        n += c;
+        memcpy(out + n, "\r\n", 2);
+        n += 2;
+    }
+    memcpy(out + n, "0\r\n\r\n", 5);
+    *out_len = n + 5;
+    return out;
+}
+
+/* 模拟数据分多次到达, 每次step个字节, 解码完后其余的字节照常追加 */
+static int decode(buffer *b, const char *data, size_t len, size_t step, chunk_reader *cr)
+{
+    int     err = FCY_AGAIN;
+    size_t  i = 0, n;
+
+    memset(cr, 0, sizeof(*cr));
+    buffer_retrieve_all(b);
+
+    while (i < len && err == FCY_AGAIN) {
+        n = len - i < step ? len - i : step;
+        buffer_append(b, data + i, n);
+        i += n;
+        err = chunk_reader_decode(cr, b);
+        if (err == FCY_AGAIN) {
+            assert(buffer_readable_bytes(b) == cr->size);
+        }
+    }
+    if (err == FCY_OK && i < len) {
+        buffer_append(b, data + i, len - i);
+    }
+    return err;
+}
+
+static void bench(const char *name, size_t chunk)
+{
+    mem_pool        *p = mem_pool_create(TEST_POOL_SIZE);
+    buffer          *b = buffer_create(p, 64);
+    struct timespec t1, t2;
+    chunk_reader    cr;
+    char            *src, *enc;
+    size_t          len;
+    double          ms;
+
+    src = calloc(1, BODY_SIZE);
+    enc = encode(src, BODY_SIZE, chunk, &len);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        memset(&cr, 0, sizeof(cr));
+        buffer_retrieve_all(b);
+        buffer_append(b, enc, len);
+        assert(chunk_reader_decode(&cr, b) == FCY_OK);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    ms = (t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6;
+    printf("%s (%zu bytes): %.1f ms, %.0f MB/s\n",
+           name, chunk, ms, (double)len * BENCH_ROUNDS / ms / 1e3);
+
+    free(enc);
+    free(src);
+    mem_pool_destroy(p);
+}
@@ -0,0 +1,74 @@
+//
+// Created by frank on 17-6-18.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "base.h"
+#include "http_header.h"
+
+static string str(const char *s);
+
+int main()
+{
+    char        buf[HTTP_TIME_LEN + 1], etag[HTTP_ETAG_LEN];
+    struct stat st;
+    string      s;
+    int         n;
+
+    /* Last-Modified 原样回来 */
+    http_time(buf, 784111777);
+    assert(strcmp(buf, "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+    s = str(buf);
+    assert(http_parse_time(&s) == 784111777);
+    s = str("Thu, 01 Jan 1970 00:00:00 GMT");
+    assert(http_parse_time(&s) == 0);
+
+    /* Date每秒生成一次 */
+    s = str(http_date());
+    assert(s.data == http_date() && labs(http_parse_time(&s) - time(NULL)) <= 1);
+
+    /* 其他格式不认 */
+    s = str("Sunday, 06-Nov-94 08:49:37 GMT");
+    assert(http_parse_time(&s) == -1);
+    s = str("Sun Nov  6 08:49:37 1994");
+    assert(http_parse_time(&s) == -1);
+    s = str("Sun, 06 Nox 1994 08:49:37 GMT");
+    assert(http_parse_time(&s) == -1);
+    s = str("Sun, 06 Nov 1994 28:49:37 GMT");
+    assert(http_parse_time(&s) == -1);
+
+    bzero(&st, sizeof(st));
+    st.st_ino = 0xabc;
+    st.st_mtime = 784111777;
+    st.st_size = 1000;
+    n = http_etag(etag, &st);
+    assert(strcmp(etag, "\"abc-2ebc98a1-3e8\"") == 0 && n == (int)strlen(etag));
+
+    /* If-None-Match 弱比较, If-Range 强比较 */
+    s = str("\"abc-2ebc98a1-3e8\"");
+    assert(http_etag_match(&s, etag, (size_t)n, 1));
+    assert(http_etag_match(&s, etag, (size_t)n, 0));
+    s = str("\"x\", W/\"abc-2ebc98a1-3e8\"");
+    assert(http_etag_match(&s, etag, (size_t)n, 1));
+    assert(!http_etag_match(&s, etag, (size_t)n, 0));
+    s = str(" * ");
+    assert(http_etag_match(&s, etag, (size_t)n, 1));
+    s = str("\"abc-2ebc98a1-3e9\", \"abc\"");
+    assert(!http_etag_match(&s, etag, (size_t)n, 1));
+    s = str("abc-2ebc98a1-3e8");
+    assert(!http_etag_match(&s, etag, (size_t)n, 1));
+    s = str("\"abc-2ebc98a1-3e8");
+    assert(!http_etag_match(&s, etag, (size_t)n, 1));
+
+    printf("test conditional passed\n");
+    return 0;
+}
+
+static string str(const char *s)
+{
+    string r = {strlen(s), (char*)s};
+
+    return r;
+}
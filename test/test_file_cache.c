@@ -0,0 +1,138 @@
+//
+// Created by frank on 17-6-16.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "base.h"
+#include "log.h"
+#include "http_parser.h"
+#include "server.h"
+#include "file_cache.h"
+
+/* config.c is not linked */
+int log_level               = LOG_LEVEL_WARN;
+int epoll_events            = 0;
+int sendfile_max_chunk      = 0;
+int write_budget            = 0;
+int aio_threads             = 0;
+int open_file_cache         = 2;
+int open_file_cache_valid   = 60000;
+int open_file_cache_events  = 0;
+int open_file_cache_mem     = 64;
+int open_file_cache_mem_max = 16;
+array *servers;
+
+static void write_file(const char *path, const char *data);
+
+int main()
+{
+    char            dir[] = "/tmp/test_file_cache.XXXXXX";
+    char            path[64];
+    mem_pool        *pool;
+    server          *srv;
+    location        *loc;
+    cached_file     *f, *g, *h;
+
+    assert(mkdtemp(dir) != NULL);
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    assert(mkdir(path, 0755) == 0);
+    snprintf(path, sizeof(path), "%s/a.css", dir);
+    write_file(path, "a");
+    snprintf(path, sizeof(path), "%s/sub/index.html", dir);
+    write_file(path, "index");
+
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    assert(pool != NULL);
+    servers = array_create(pool, 1, sizeof(server));
+    srv = array_alloc(servers);
+    bzero(srv, sizeof(server));
+    srv->locations = array_create(pool, 1, sizeof(location));
+    loc = array_alloc(srv->locations);
+    bzero(loc, sizeof(location));
+    loc->root_dirfd = open(dir, O_DIRECTORY | O_RDONLY);
+    assert(loc->root_dirfd != -1);
+    str_set(&loc->index[0], "index.htm");
+    str_set(&loc->index[1], "index.html");
+    loc->warmup = 1;
+
+    /* 启动时读入两个小文件 */
+    assert(file_cache_init() == FCY_OK);
+    assert(file_cache_stats.entries == 2 && file_cache_stats.misses == 2);
+    assert(file_cache_stats.mem_entries == 2 && file_cache_stats.mem_size == 6);
+
+    /* 命中, 文件在内存中, 响应头也放在一起 */
+    f = file_cache_open(loc, "/a.css", 6);
+    assert(f->status == STATUS_OK && f->fd != -1 && f->st.st_size == 1);
+    assert(strcmp(f->suffix.data, ".css") == 0);
+    assert(f->body != NULL && f->body[0] == 'a');
+    assert(file_cache_stats.hits == 1 && file_cache_stats.misses == 2);
+    file_cache_set_header(f, "HTTP/1.1 200 OK", 15);
+    assert(f->header.len == 15 && file_cache_stats.mem_size == 21);
+    g = file_cache_open(loc, "/a.css", 6);
+    assert(g == f);
+    file_cache_release(g);
+
+    /* 目录找到索引文件, 后缀是索引文件的, 挤出最久没用的 */
+    open_file_cache_valid = 1;
+    g = file_cache_open(loc, "/sub", 4);
+    assert(g->status == STATUS_OK && g->st.st_size == 5);
+    assert(strcmp(g->suffix.data, ".html") == 0);
+    assert(g->body != NULL && memcmp(g->body, "index", 5) == 0);
+    assert(file_cache_stats.evicted == 1);
+    file_cache_release(g);
+
+    /* 不存在的也缓存, 正在用的fd不关闭, 内存中的释放 */
+    h = file_cache_open(loc, "/none", 5);
+    assert(h->status == STATUS_NOT_FOUND && h->fd == -1 && h->body == NULL);
+    file_cache_release(h);
+    assert(file_cache_stats.evicted == 2 && file_cache_stats.entries == 2);
+    assert(!f->cached && f->body == NULL);
+    assert(file_cache_stats.mem_entries == 1 && file_cache_stats.mem_size == 5);
+    assert(fcntl(f->fd, F_GETFD) != -1);
+    file_cache_release(f);
+
+    /* 过期后stat一次, 没变的继续用, 变了的重新打开 */
+    usleep(2000);
+    h = file_cache_open(loc, "/none", 5);
+    assert(h->status == STATUS_NOT_FOUND && file_cache_stats.revalidated == 1);
+    file_cache_release(h);
+
+    snprintf(path, sizeof(path), "%s/sub/index.html", dir);
+    write_file(path, "changed");
+    usleep(2000);
+    g = file_cache_open(loc, "/sub", 4);
+    assert(g->status == STATUS_OK && file_cache_stats.expired == 1);
+    assert(g->st.st_size == 7 && memcmp(g->body, "changed", 7) == 0);
+
+    /* 预压缩的文件跟在索引文件后面 */
+    snprintf(path, sizeof(path), "%s/sub/index.html.gz", dir);
+    write_file(path, "gz");
+    h = file_cache_open_sibling(loc, g, ".gz");
+    assert(h->status == STATUS_OK && h->st.st_size == 2);
+    assert(strcmp(h->path, "/sub/index.html.gz") == 0);
+    file_cache_release(h);
+    file_cache_release(g);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/sub/index.html", dir);
+
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/a.css", dir);
+    unlink(path);
+    rmdir(dir);
+    mem_pool_destroy(pool);
+    printf("test file cache passed\n");
+    return 0;
+}
+
+static void write_file(const char *path, const char *data)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    assert(fd != -1);
+    assert(write(fd, data, strlen(data)) == (ssize_t)strlen(data));
+    close(fd);
+}
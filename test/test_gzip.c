@@ -0,0 +1,96 @@
+//
+// Created by frank on 17-6-17.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <zlib.h>
+#include "base.h"
+#include "log.h"
+#include "event.h"
+#include "http_header.h"
+#include "gzip.h"
+
+/* config.c is not linked */
+int log_level           = LOG_LEVEL_WARN;
+int epoll_events        = 0;
+int gzip_comp_level     = 6;
+
+static void inflate_all(const char *data, size_t len, char *out, size_t *out_len);
+static int accepts(const char *value, const char *coding);
+
+int main()
+{
+    mem_pool    *pool;
+    buffer      *out;
+    char        text[20000], plain[20000];
+    size_t      n;
+
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    assert(pool != NULL);
+    out = buffer_create(pool, 16);
+    assert(out != NULL);
+    for (size_t i = 0; i < sizeof(text); ++i) {
+        text[i] = "fancy web server "[i % 17];
+    }
+
+    assert(gzip_init() == FCY_OK);
+
+    /* 分几次压缩, 解压后相同, 流可以重复使用 */
+    for (int round = 0; round < 2; ++round) {
+        buffer_retrieve_all(out);
+        assert(gzip_begin(round == 0 ? 1 : 9) == FCY_OK);
+        assert(gzip_update(text, 7000, out, 0) == FCY_OK);
+        assert(gzip_update(text + 7000, sizeof(text) - 7000, out, 1) == FCY_OK);
+        assert(buffer_readable_bytes(out) < sizeof(text) / 10);
+
+        n = sizeof(plain);
+        inflate_all(buffer_peek(out), buffer_readable_bytes(out), plain, &n);
+        assert(n == sizeof(text) && memcmp(plain, text, n) == 0);
+    }
+    assert(gzip_stats.responses == 2 && gzip_stats.bytes_in == 2 * sizeof(text));
+
+    /* worker忙时降低压缩级别 */
+    event_lag = 0;
+    assert(gzip_level() == 6);
+    event_lag = GZIP_LAG_STEP * 2 + 1;
+    assert(gzip_level() == 4);
+    event_lag = GZIP_LAG_STEP * 100;
+    assert(gzip_level() == 1);
+
+    assert(accepts("gzip", "gzip"));
+    assert(accepts("deflate, GZIP;q=0.5", "gzip"));
+    assert(!accepts("gzip;q=0", "gzip"));
+    assert(!accepts("gzip; q=0.000, br", "gzip"));
+    assert(accepts("br;q=1, *", "gzip"));
+    assert(!accepts("*, gzip;q=0", "gzip"));
+    assert(!accepts("x-gzip, deflate", "gzip"));
+    assert(!accepts("", "gzip"));
+
+    mem_pool_destroy(pool);
+    printf("test gzip passed\n");
+    return 0;
+}
+
+static void inflate_all(const char *data, size_t len, char *out, size_t *out_len)
+{
+    z_stream zs;
+
+    bzero(&zs, sizeof(zs));
+    assert(inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK);
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = (uInt)len;
+    zs.next_out = (Bytef*)out;
+    zs.avail_out = (uInt)*out_len;
+    assert(inflate(&zs, Z_FINISH) == Z_STREAM_END);
+    *out_len = zs.total_out;
+    inflateEnd(&zs);
+}
+
+static int accepts(const char *value, const char *coding)
+{
+    string v = {strlen(value), (char*)value};
+
+    return http_accept_encoding(&v, coding, strlen(coding));
+}
@@ -0,0 +1,128 @@
+//
+// Created by frank on 17-6-14.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "base.h"
+#include "hpack.h"
+
+#define MAX_HEADERS 8
+
+typedef struct {
+    int     n;
+    char    names[MAX_HEADERS][64];
+    char    values[MAX_HEADERS][64];
+} headers;
+
+static void on_header(void *user, string *name, string *value);
+static void decode(hpack *h, const u_char *p, size_t len, headers *hs);
+static void expect(headers *hs, int i, const char *name, const char *value);
+
+int main()
+{
+    mem_pool    *pool;
+    buffer      *b;
+    hpack       h;
+    headers     hs;
+
+    /* RFC 7541 C.4, 三个连续的请求, huffman编码, 共享动态表 */
+    static const u_char c41[] = {
+            0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2,
+            0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff,
+    };
+    static const u_char c42[] = {
+            0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10, 0x64,
+            0x9c, 0xbf,
+    };
+    static const u_char c43[] = {
+            0x82, 0x87, 0x85, 0xbf, 0x40, 0x88, 0x25, 0xa8, 0x49, 0xe9,
+            0x5b, 0xa9, 0x7d, 0x7f, 0x89, 0x25, 0xa8, 0x49, 0xe9, 0x5b,
+            0xb8, 0xe8, 0xb4, 0xbf,
+    };
+
+    hpack_init(&h);
+
+    decode(&h, c41, sizeof(c41), &hs);
+    assert(hs.n == 4);
+    expect(&hs, 0, ":method", "GET");
+    expect(&hs, 1, ":scheme", "http");
+    expect(&hs, 2, ":path", "/");
+    expect(&hs, 3, ":authority", "www.example.com");
+    assert(h.size == 57);
+
+    decode(&h, c42, sizeof(c42), &hs);
+    assert(hs.n == 5);
+    expect(&hs, 3, ":authority", "www.example.com");
+    expect(&hs, 4, "cache-control", "no-cache");
+    assert(h.size == 110);
+
+    decode(&h, c43, sizeof(c43), &hs);
+    assert(hs.n == 5);
+    expect(&hs, 1, ":scheme", "https");
+    expect(&hs, 2, ":path", "/index.html");
+    expect(&hs, 3, ":authority", "www.example.com");
+    expect(&hs, 4, "custom-key", "custom-value");
+    assert(h.size == 164);
+
+    /* 超出动态表的索引, 错误的huffman填充 */
+    static const u_char bad_index[] = {0xc5};
+    static const u_char bad_padding[] = {0x40, 0x81, 0x00, 0x81, 0x1f};
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    assert(pool != NULL);
+    assert(hpack_decode(&h, (u_char*)bad_index, (u_char*)bad_index + 1,
+                        pool, on_header, &hs) == FCY_ERROR);
+    assert(hpack_decode(&h, (u_char*)bad_padding, (u_char*)bad_padding + sizeof(bad_padding),
+                        pool, on_header, &hs) == FCY_ERROR);
+
+    /* 编码后能被解码, 名字转为小写 */
+    b = buffer_create(pool, 1024);
+    assert(b != NULL);
+    hpack_encode_status(b, 200);
+    hpack_encode_status(b, 302);
+    hpack_encode_header(b, "Content-Type", 12, "text/html", 9);
+    hpack_encode_header(b, "X-Fancy", 7, "on", 2);
+
+    hpack_init(&h);
+    decode(&h, (u_char*)buffer_peek(b), buffer_readable_bytes(b), &hs);
+    assert(hs.n == 4);
+    expect(&hs, 0, ":status", "200");
+    expect(&hs, 1, ":status", "302");
+    expect(&hs, 2, "content-type", "text/html");
+    expect(&hs, 3, "x-fancy", "on");
+    assert(h.size == 0);
+
+    mem_pool_destroy(pool);
+    printf("test hpack passed\n");
+    return 0;
+}
+
+static void on_header(void *user, string *name, string *value)
+{
+    headers *hs = user;
+
+    assert(hs->n < MAX_HEADERS);
+    assert(name->len < 64 && value->len < 64);
+    assert(name->data[name->len] == '\0' && value->data[value->len] == '\0');
+    strcpy(hs->names[hs->n], name->data);
+    strcpy(hs->values[hs->n], value->data);
+    ++hs->n;
+}
+
+static void decode(hpack *h, const u_char *p, size_t len, headers *hs)
+{
+    mem_pool *pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+
+    assert(pool != NULL);
+    hs->n = 0;
+    assert(hpack_decode(h, (u_char*)p, (u_char*)p + len, pool, on_header, hs) == FCY_OK);
+    mem_pool_destroy(pool);
+}
+
+static void expect(headers *hs, int i, const char *name, const char *value)
+{
+    assert(strcmp(hs->names[i], name) == 0);
+    assert(strcmp(hs->values[i], value) == 0);
+}
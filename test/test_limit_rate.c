@@ -0,0 +1,112 @@
+//
+// Created by frank on 17-6-20.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "base.h"
+#include "log.h"
+#include "timer.h"
+#include "connection.h"
+
+/* config.c is not linked */
+int log_level           = LOG_LEVEL_WARN;
+int epoll_events        = 0;
+int sendfile_max_chunk  = 0;
+int write_budget        = 0;
+int aio_threads         = 0;
+
+static int          file_fd;
+static off_t        offset;
+static struct stat  st;
+static int          parks;
+
+static void send_h(event *ev);
+static void send_file(event *ev);
+
+int main()
+{
+    char        path[] = "/tmp/test_limit_rate.XXXXXX";
+    char        buf[64 * 1024];
+    int         sv[2], size = 256 * 1024, sndbuf = 1024 * 1024;
+    size_t      rate = 128 * 1024, after = 64 * 1024;
+    mem_pool    *pool;
+    connection  *conn;
+    timer_msec  begin, elapsed;
+
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    assert(pool != NULL);
+    assert(conn_pool_init(16, 16) == FCY_OK);
+    assert(event_init(pool, 16) == FCY_OK);
+    timer_init();
+
+    file_fd = mkstemp(path);
+    assert(file_fd != -1);
+    memset(buf, 'a', sizeof(buf));
+    for (int n = 0; n < size; n += (int)sizeof(buf)) {
+        assert(write(file_fd, buf, sizeof(buf)) == sizeof(buf));
+    }
+    assert(fstat(file_fd, &st) == 0);
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+    assert(setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+    conn = conn_get();
+    conn->sockfd = sv[0];
+
+    /* 先发limit_after和至少一秒的量, 超过后等定时器, 不占EPOLLOUT */
+    begin = current_msec();
+    conn_limit_rate(conn, rate, after);
+    conn_enable_write(conn, send_h);
+    send_h(&conn->write);
+    assert(st.st_size <= size - (off_t)(after + rate) && conn->write.active);
+    while (conn->write.active && st.st_size > 0) {
+        send_h(&conn->write);
+    }
+    assert(st.st_size > 0 && st.st_size <= 64 * 1024);
+    assert(!conn->write.active && conn->write.timer_set);
+
+    /* 任何时候发出的都不超过速率允许的 */
+    while (st.st_size > 0) {
+        event_and_timer_process();
+        while (read(sv[1], buf, sizeof(buf)) > 0) {
+        }
+        elapsed = current_msec() - begin;
+        assert((size_t)offset <= after + rate * (elapsed + 1000) / 1000);
+    }
+    assert(conn->write.active && !conn->write.timer_set);
+
+    /* 每次等到一步的量: 64k最多5步 */
+    assert(parks <= 1 + (int)(64 * 1024 / (rate * CONN_LIMIT_STEP / 1000)));
+
+    /* 不限速的直接发完 */
+    conn_limit_rate(conn, 0, 0);
+    assert(!conn->limited);
+    offset = 0;
+    assert(fstat(file_fd, &st) == 0);
+    while (st.st_size > 0) {
+        send_h(&conn->write);
+        while (read(sv[1], buf, sizeof(buf)) > 0) {
+        }
+    }
+    assert(conn->write.active && !conn->write.timer_set);
+
+    conn_disable_write(conn);
+    conn_free(conn);
+    unlink(path);
+    printf("test limit rate passed\n");
+    return 0;
+}
+
+static void send_h(event *ev)
+{
+    send_file(ev);
+    if (ev->timer_set) {
+        ++parks;
+    }
+}
+
+static void send_file(event *ev)
+{
+    CONN_SEND_FILE(ev->conn, file_fd, &offset, (&st), assert(0));
+}
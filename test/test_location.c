@@ -0,0 +1,136 @@
+//
+// Created by frank on 17-6-12.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include "base.h"
+#include "location.h"
+
+#define N_LOCATIONS     1000
+#define BENCH_ROUNDS    2000
+
+static location fixed[] = {
+        {.prefix = string("/")},
+        {.prefix = string("/api/")},
+        {.prefix = string("/api/v2/")},
+        {.prefix = string("/static")},
+        {.prefix = string("/st")},
+        {.prefix = string("/api/v2/status"), .exact = 1},
+        {.prefix = string("/"), .exact = 1},
+};
+
+static location generated[N_LOCATIONS];
+static char     names[N_LOCATIONS][32];
+static char     uris[N_LOCATIONS][64];
+
+static location_tree *tree;
+
+static location *tree_find(const char *uri, size_t len);
+static location *linear_find(const char *uri, size_t len);
+static void bench(const char *name, location *(*find)(const char *, size_t));
+
+int main()
+{
+    tree = location_tree_create();
+    assert(tree != NULL);
+
+    /* 顺序无关, 最长前缀优先, 精确匹配优先 */
+    for (int i = (int)(sizeof(fixed) / sizeof(*fixed)) - 1; i >= 0; --i) {
+        assert(location_add(tree, &fixed[i]) == FCY_OK);
+    }
+    assert(location_find(tree, "/", 1) == &fixed[6]);
+    assert(location_find(tree, "/index.html", 11) == &fixed[0]);
+    assert(location_find(tree, "/api", 4) == &fixed[0]);
+    assert(location_find(tree, "/api/", 5) == &fixed[1]);
+    assert(location_find(tree, "/api/v1/x", 9) == &fixed[1]);
+    assert(location_find(tree, "/api/v2/x", 9) == &fixed[2]);
+    assert(location_find(tree, "/api/v2/status", 14) == &fixed[5]);
+    assert(location_find(tree, "/api/v2/statusx", 15) == &fixed[2]);
+    assert(location_find(tree, "/static/a.css", 13) == &fixed[3]);
+    assert(location_find(tree, "/stat", 5) == &fixed[4]);
+    assert(location_find(tree, "/s", 2) == &fixed[0]);
+
+    /* 重复的location */
+    location dup = {.prefix = string("/api/")};
+    location dup_exact = {.prefix = string("/api/v2/status"), .exact = 1};
+    assert(location_add(tree, &dup) == FCY_ERROR);
+    assert(location_add(tree, &dup_exact) == FCY_ERROR);
+
+    /* 大量location, 结果与逐个比较最长前缀一致 */
+    for (int i = 0; i < N_LOCATIONS; ++i) {
+        int len = sprintf(names[i], "/app%d/module%d/", i % 97, i);
+        generated[i].prefix.data = names[i];
+        generated[i].prefix.len = (size_t)len;
+        assert(location_add(tree, &generated[i]) == FCY_OK);
+        sprintf(uris[i], "%spage/%d.html?x=1", names[i], i);
+    }
+    for (int i = 0; i < N_LOCATIONS; ++i) {
+        size_t len = strchr(uris[i], '?') - uris[i];
+        assert(location_find(tree, uris[i], len) == &generated[i]);
+        assert(location_find(tree, uris[i], len) == linear_find(uris[i], len));
+    }
+
+    bench("radix tree", tree_find);
+    bench("linear scan", linear_find);
+
+    printf("test_location ok\n");
+}
+
+static location *tree_find(const char *uri, size_t len)
+{
+    return location_find(tree, uri, len);
+}
+
+/* longest prefix by comparing all of them */
+static location *linear_find(const char *uri, size_t len)
+{
+    location    *best = NULL;
+    size_t      n = sizeof(fixed) / sizeof(*fixed);
+
+    for (size_t i = 0; i < n + N_LOCATIONS; ++i) {
+        location *loc = i < n ? &fixed[i] : &generated[i - n];
+
+        if (loc->prefix.len > len
+            || strncmp(uri, loc->prefix.data, loc->prefix.len) != 0) {
+            continue;
+        }
+        if (loc->exact) {
+            if (loc->prefix.len == len) {
+                return loc;
+            }
+            continue;
+        }
+        if (best == NULL || loc->prefix.len > best->prefix.len) {
+            best = loc;
+        }
+    }
+    return best;
+}
+
+static void bench(const char *name, location *(*find)(const char *, size_t))
+{
+    struct timespec t1, t2;
+    size_t          len[N_LOCATIONS];
+    size_t          hit = 0;
+    double          ms;
+
+    for (int i = 0; i < N_LOCATIONS; ++i) {
+        len[i] = strchr(uris[i], '?') - uris[i];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        for (int i = 0; i < N_LOCATIONS; ++i) {
+            hit += find(uris[i], len[i]) != NULL;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    assert(hit == (size_t)N_LOCATIONS * BENCH_ROUNDS);
+    ms = (t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6;
+    printf("%s, %d locations: %.1f ns per lookup\n",
+           name, N_LOCATIONS, ms * 1e6 / ((double)N_LOCATIONS * BENCH_ROUNDS));
+}
@@ -2,11 +2,15 @@
 // Created by frank on 17-2-15.
 //
 
+#undef NDEBUG
 #include <assert.h>
 #include <stdio.h>
-#include "request.h"
+#include <time.h>
+#include "base.h"
+#include "http_scan.h"
+#include "http_parser.h"
 
-const static char *dataset[] = {
+static const char *dataset[] = {
 
         /* 注意uri路径 */
         "GET /assets/css/style-nuvue6sithwirecbhvw3dkaobiojqvtadsnhguwi7k04xklybw5djl1smadp.min.css HTTP/1.0\r\n\r\n",
@@ -121,84 +125,304 @@ const static char *dataset[] = {
 };
 
 
-static request *create_request(mem_pool *pool);
-static void test_one_request(request *r, const char *data);
+/* both parsers must reject these */
+static const char *bad_dataset[] = {
+        "GETX / HTTP/1.1\r\n\r\n",
+        "GET/ HTTP/1.1\r\n\r\n",
+        "GET / HTTP/2.0\r\n\r\n",
+        "GET /a\x01b HTTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost : x\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost:\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: x\n\r\n",
+};
+
+/* 规范化: 输入, path, args */
+static const char *uri_dataset[][3] = {
+        {"/", "/", NULL},
+        {"/index.html", "/index.html", NULL},
+        {"//a///b//", "/a/b/", NULL},
+        {"/a/./b/../c", "/a/c", NULL},
+        {"/a/b/..", "/a/", NULL},
+        {"/a/b/.", "/a/b/", NULL},
+        {"/a/../..x", "/..x", NULL},
+        {"/a/...", "/a/...", NULL},
+        {"/hello%20world%20.html", "/hello world .html", NULL},
+        {"/a%2fb%2F..%2Fc", "/a/c", NULL},
+        {"/a/%2e%2E/b", "/b", NULL},
+        {"/a%3fb%23c?x=%20&y#frag", "/a?b#c", "x=%20&y"},
+        {"/a/../b?", "/b", ""},
+        {"/x#/../..", "/x", NULL},
+        {"/assets/css/style-nuvue6sithwirecbhvw3dkaobiojqvtadsnhguwi7k04xklybw5djl1smadp.min.css",
+         "/assets/css/style-nuvue6sithwirecbhvw3dkaobiojqvtadsnhguwi7k04xklybw5djl1smadp.min.css", NULL},
+};
+
+static const char *bad_uri_dataset[] = {
+        "", "a", "/..", "/a/../..", "/%2e%2e/x", "/a/%2f..%2f..",
+        "/a%", "/a%2", "/a%zz", "/a%00b", "/a b",
+};
+
+#define MAX_HEADERS     32
+#define BENCH_ROUNDS    200000
+
+typedef struct {
+    int         n;
+    char        uri[1024];
+    char        args[1024];
+    char        suffix[64];
+    int         has_args;
+    char        names[MAX_HEADERS][128];
+    char        values[MAX_HEADERS][1024];
+} result;
+
+static void on_uri(void *user, string *uri, string *suffix, string *args);
+static void on_header(void *user, int id, string *name, string *value);
+static int parse_whole(const char *data, result *res);
+static int parse_bytewise(const char *data, result *res);
+static void bench(int level, int resumable);
+static int parse_uri_only(const char *data, result *res);
+static void bench_uri(int level);
 
 int main()
 {
-    mem_pool    *pool;
-    request     *rqst;
-    int         n;
+    result      whole, bytewise;
+    int         n, level;
+    int         levels[] = {HTTP_SCAN_SCALAR, HTTP_SCAN_SSE42, HTTP_SCAN_AVX2};
+
+    /* 每个已知header名都能查到自己, 不区分大小写 */
+    for (int id = 0; id < HEADER_KNOWN; ++id) {
+        char    lower[64];
+        string  *name = &header_name_str[id];
 
-    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
-    if (pool == NULL) {
-        err_quit("mem_pool_create error");
+        for (size_t i = 0; i <= name->len; ++i) {
+            lower[i] = (char)tolower(name->data[i]);
+        }
+        assert(http_header_id(name->data, name->len) == id);
+        assert(http_header_id(lower, name->len) == id);
+        assert(http_header_id(name->data, name->len - 1) != id);
     }
+    assert(http_header_id("Hosts", 5) == HEADER_OTHER);
+    assert(http_header_id("X-Custom", 8) == HEADER_OTHER);
 
     n = sizeof(dataset) / sizeof(*dataset);
-    for (int i = 0; i < n; ++i) {
-        rqst = create_request(pool);
-        if (rqst == NULL) {
-            err_quit("create_request error");
+
+    /* 一次读入和逐字节读入, 结果必须一致 */
+    for (int l = 0; l < 3; ++l) {
+        level = http_scan_use(levels[l]);
+        if (level != levels[l]) {
+            continue;
+        }
+        for (int i = 0; i < n; ++i) {
+            int err1 = parse_whole(dataset[i], &whole);
+            int err2 = parse_bytewise(dataset[i], &bytewise);
+
+            assert(err1 == err2);
+            if (err1 != FCY_OK) {
+                continue;
+            }
+            assert(strcmp(whole.uri, bytewise.uri) == 0);
+            assert(whole.n == bytewise.n);
+            for (int j = 0; j < whole.n; ++j) {
+                assert(strcmp(whole.names[j], bytewise.names[j]) == 0);
+                assert(strcmp(whole.values[j], bytewise.values[j]) == 0);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(bad_dataset) / sizeof(*bad_dataset); ++i) {
+        assert(parse_whole(bad_dataset[i], &whole) == FCY_ERROR);
+        assert(parse_bytewise(bad_dataset[i], &bytewise) == FCY_ERROR);
+    }
+
+    for (int l = 0; l < 3; ++l) {
+        level = http_scan_use(levels[l]);
+        if (level != levels[l]) {
+            continue;
         }
+        for (size_t i = 0; i < sizeof(uri_dataset) / sizeof(*uri_dataset); ++i) {
+            assert(parse_uri_only(uri_dataset[i][0], &whole) == FCY_OK);
+            assert(strcmp(whole.uri, uri_dataset[i][1]) == 0);
+            if (uri_dataset[i][2] == NULL) {
+                assert(!whole.has_args);
+            }
+            else {
+                assert(whole.has_args && strcmp(whole.args, uri_dataset[i][2]) == 0);
+            }
+        }
+        for (size_t i = 0; i < sizeof(bad_uri_dataset) / sizeof(*bad_uri_dataset); ++i) {
+            assert(parse_uri_only(bad_uri_dataset[i], &whole) == FCY_ERROR);
+        }
+    }
+
+    /* 后缀只取最后一段, 不含args */
+    assert(parse_uri_only("/a.b/c.min.js?v=1.2", &whole) == FCY_OK);
+    assert(strcmp(whole.suffix, ".js") == 0);
+    assert(parse_uri_only("/a.b/c?v=1.2", &whole) == FCY_OK);
+    assert(whole.suffix[0] == '\0');
 
-        test_one_request(rqst, dataset[i]);
+    for (int l = 0; l < 3; ++l) {
+        bench(levels[l], 0);
+        bench(levels[l], 1);
+        bench_uri(levels[l]);
     }
 
-    mem_pool_destroy(pool);
+    printf("test_process_request ok\n");
 }
 
-static request *create_request(mem_pool *pool)
+static void on_uri(void *user, string *uri, string *suffix, string *args)
 {
-    request     *rqst;
-
-    rqst = pcalloc(pool, sizeof(*rqst));
-    if (rqst == NULL) {
-        return NULL;
+    result  *res = user;
+
+    assert(uri->data[uri->len] == '\0');
+    snprintf(res->uri, sizeof(res->uri), "%.*s", (int)uri->len, uri->data);
+    snprintf(res->suffix, sizeof(res->suffix), "%.*s", (int)suffix->len, suffix->data);
+    res->has_args = args->data != NULL;
+    if (res->has_args) {
+        assert(args->data[args->len] == '\0');
+        snprintf(res->args, sizeof(res->args), "%.*s", (int)args->len, args->data);
     }
+}
 
-    rqst->header_in = buffer_create(pool, BUFFER_DEFAULT_SIZE);
-    rqst->conn = pcalloc(pool, sizeof(*rqst->conn));
-    rqst->pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+static void on_header(void *user, int id, string *name, string *value)
+{
+    result  *res = user;
 
-    if (rqst->conn == NULL || rqst->header_in == NULL) {
-        return NULL;
+    assert(res->n < MAX_HEADERS);
+    assert(id == http_header_id(name->data, name->len));
+    if (id != HEADER_OTHER) {
+        assert(strcasecmp(header_name_str[id].data, name->data) == 0);
     }
+    snprintf(res->names[res->n], sizeof(res->names[0]),
+             "%.*s", (int)name->len, name->data);
+    snprintf(res->values[res->n], sizeof(res->values[0]),
+             "%.*s", (int)value->len, value->data);
+    ++res->n;
+}
 
-    return rqst;
+static void parser_init(http_parser *ps, result *res)
+{
+    memset(ps, 0, sizeof(*ps));
+    memset(res, 0, sizeof(*res));
+    ps->type = HTTP_PARSE_REQUEST;
+    ps->uri_cb = on_uri;
+    ps->header_cb = on_header;
+    ps->user = res;
 }
 
-static void test_one_request(request *r, const char *data)
+static int parse_whole(const char *data, result *res)
 {
-    buffer      *in;
+    static char buf[8192];
+    http_parser ps;
+    size_t      n;
+
+    parser_init(&ps, res);
+    n = strlen(data);
+    memcpy(buf, data, n);
+
+    return parser_execute(&ps, buf, buf + n);
+}
+
+/* 模拟数据分多次到达, 且每次到达后缓冲区可能被移动 */
+static int parse_bytewise(const char *data, result *res)
+{
+    static char buf[2][8192];
+    http_parser ps;
     size_t      i, n;
-    int         err = 0;
+    int         err = FCY_AGAIN;
 
-    in = r->header_in;
+    parser_init(&ps, res);
     n = strlen(data);
 
-    for (i = 0; i < n; ++i) {
-        if (buffer_write(in, &data[i], 1) == -1) {
-            err_quit("buffer_write error");
-            return;
-        }
+    for (i = 1; i <= n && err == FCY_AGAIN; ++i) {
+        char *cur = buf[i % 2], *prev = buf[(i + 1) % 2];
 
-        err = parse_request(r);
-        if (err == FCY_ERROR) {
-            err_quit("parse_request error");
-            exit(1);
-        }
-        if (err == FCY_OK) {
-            break;
+        memcpy(cur, prev, i - 1);
+        cur[i - 1] = data[i - 1];
+        memset(prev, 0xff, i - 1);
+        err = parser_execute(&ps, cur, cur + i);
+    }
+    return err;
+}
+
+/* resumable: hand over one byte first, so the one-shot path is not taken */
+static void bench(int level, int resumable)
+{
+    static char     buf[8192];
+    struct timespec t1, t2;
+    http_parser     ps;
+    size_t          bytes = 0, len[sizeof(dataset) / sizeof(*dataset)];
+    int             n = sizeof(dataset) / sizeof(*dataset);
+    double          ms;
+
+    if (http_scan_use(level) != level) {
+        printf("scan level %d: not supported\n", level);
+        return;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        len[i] = strlen(dataset[i]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        for (int i = 0; i < n; ++i) {
+            memcpy(buf, dataset[i], len[i]);
+            memset(&ps, 0, sizeof(ps));
+            ps.type = HTTP_PARSE_REQUEST;
+            if (resumable) {
+                parser_execute(&ps, buf, buf + 1);
+            }
+            parser_execute(&ps, buf, buf + len[i]);
+            bytes += len[i];
         }
     }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
 
-    assert(err == FCY_OK);
+    ms = (t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6;
+    printf("scan level %d, %s: %.1f ms, %.0f MB/s\n",
+           level, resumable ? "resumable" : "one-shot", ms, bytes / ms / 1e3);
+}
+
+static int parse_uri_only(const char *data, result *res)
+{
+    static char buf[1024];
+    http_parser ps;
+    size_t      n;
+
+    parser_init(&ps, res);
+    n = strlen(data);
+    memcpy(buf, data, n + 1);
+
+    return parser_execute_uri(&ps, buf, buf + n);
+}
 
-    err = check_request_header(r);
-    if (err == FCY_OK && r->is_static) {
-        err = open_static_file(r);
+static void bench_uri(int level)
+{
+    static char     buf[1024];
+    struct timespec t1, t2;
+    http_parser     ps;
+    size_t          bytes = 0, len[sizeof(uri_dataset) / sizeof(*uri_dataset)];
+    int             n = sizeof(uri_dataset) / sizeof(*uri_dataset);
+    double          ms;
+
+    if (http_scan_use(level) != level) {
+        return;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        len[i] = strlen(uri_dataset[i][0]);
+    }
+
+    memset(&ps, 0, sizeof(ps));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        for (int i = 0; i < n; ++i) {
+            memcpy(buf, uri_dataset[i][0], len[i] + 1);
+            parser_execute_uri(&ps, buf, buf + len[i]);
+            bytes += len[i];
+        }
     }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
 
-    request_print(r);
+    ms = (t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6;
+    printf("scan level %d, uri: %.1f ms, %.0f MB/s\n", level, ms, bytes / ms / 1e3);
 }
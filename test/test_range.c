@@ -0,0 +1,56 @@
+//
+// Created by frank on 17-6-18.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "base.h"
+#include "http_header.h"
+
+static int parse(const char *value, off_t size, http_range *ranges);
+
+int main()
+{
+    http_range  r[4];
+
+    /* 普通的, 超出文件的截断, 后缀 */
+    assert(parse("bytes=0-99", 1000, r) == 1);
+    assert(r[0].start == 0 && r[0].end == 99);
+    assert(parse("bytes=900-5000", 1000, r) == 1 && r[0].end == 999);
+    assert(parse("bytes=500-", 1000, r) == 1);
+    assert(r[0].start == 500 && r[0].end == 999);
+    assert(parse("bytes=-100", 1000, r) == 1);
+    assert(r[0].start == 900 && r[0].end == 999);
+    assert(parse("bytes=-5000", 1000, r) == 1 && r[0].start == 0);
+
+    /* 多个, 不满足的跳过 */
+    assert(parse("bytes=0-0, 2000-, -1", 1000, r) == 2);
+    assert(r[0].end == 0 && r[1].start == 999);
+    assert(parse("Bytes= 0-1 ,5-6", 1000, r) == 2 && r[1].end == 6);
+
+    /* 都不满足: 416 */
+    assert(parse("bytes=1000-", 1000, r) == 0);
+    assert(parse("bytes=-0", 1000, r) == 0);
+    assert(parse("bytes=0-", 0, r) == 0);
+
+    /* 忽略: 格式错误, 太多 */
+    assert(parse("items=0-1", 1000, r) == -1);
+    assert(parse("bytes=5-1", 1000, r) == -1);
+    assert(parse("bytes=", 1000, r) == -1);
+    assert(parse("bytes=-", 1000, r) == -1);
+    assert(parse("bytes=1-2,", 1000, r) == -1);
+    assert(parse("bytes=a-b", 1000, r) == -1);
+    assert(parse("bytes=99999999999999999999-", 1000, r) == -1);
+    assert(parse("bytes=0-0,1-1,2-2,3-3,4-4", 1000, r) == -1);
+
+    printf("test range passed\n");
+    return 0;
+}
+
+static int parse(const char *value, off_t size, http_range *ranges)
+{
+    string s = {strlen(value), (char*)value};
+
+    return http_parse_range(&s, size, ranges, 4);
+}
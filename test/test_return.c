@@ -0,0 +1,84 @@
+//
+// Created by frank on 17-6-20.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "base.h"
+#include "log.h"
+#include "http_header.h"
+#include "request.h"
+
+/* config.c is not linked */
+int log_level               = LOG_LEVEL_WARN;
+int epoll_events            = 0;
+int sendfile_max_chunk      = 0;
+int write_budget            = 0;
+int aio_threads             = 0;
+int open_file_cache         = 0;
+int open_file_cache_valid   = 0;
+int open_file_cache_events  = 0;
+int open_file_cache_mem     = 0;
+int open_file_cache_mem_max = 0;
+int gzip_comp_level         = 1;
+array *servers;
+
+static int contains(string *s, const char *text);
+
+int main()
+{
+    mem_pool    *pool;
+    location    loc;
+    string      *close, *keep;
+
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    assert(pool);
+
+    /* 正文跟在响应头后面, 日期留空 */
+    bzero(&loc, sizeof(loc));
+    loc.return_code = 200;
+    str_set(&loc.return_text, "ok");
+    assert(request_render_return(&loc, pool) == FCY_OK);
+    close = &loc.return_response[0];
+    keep = &loc.return_response[1];
+    assert(strncmp(close->data, "HTTP/1.1 200 OK\r\nServer: fancy beta\r\nDate: ", 43) == 0);
+    assert(loc.return_date == 43 && close->data[43] == ' ');
+    assert(contains(close, "\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok"));
+    assert(contains(keep, "\r\nConnection: keep-alive\r\n\r\nok"));
+    assert(memcmp(keep->data + keep->len - 2, "ok", 2) == 0);
+
+    /* 重定向没有正文 */
+    bzero(&loc, sizeof(loc));
+    loc.return_code = 301;
+    str_set(&loc.return_text, "https://example.com/");
+    assert(request_render_return(&loc, pool) == FCY_OK);
+    close = &loc.return_response[0];
+    assert(strncmp(close->data, "HTTP/1.1 301 Moved Permanently\r\n", 32) == 0);
+    assert(contains(close, "\r\nLocation: https://example.com/\r\nContent-Length: 0\r\n"));
+    assert(memcmp(close->data + close->len - 4, "\r\n\r\n", 4) == 0);
+
+    /* 204没有Content-Length */
+    bzero(&loc, sizeof(loc));
+    loc.return_code = 204;
+    str_set(&loc.return_text, "");
+    assert(request_render_return(&loc, pool) == FCY_OK);
+    assert(!contains(&loc.return_response[1], "Content-Length"));
+
+    mem_pool_destroy(pool);
+    printf("test return passed\n");
+    return 0;
+}
+
+/* the body is not terminated */
+static int contains(string *s, const char *text)
+{
+    size_t  n = strlen(text);
+
+    for (size_t i = 0; i + n <= s->len; ++i) {
+        if (memcmp(s->data + i, text, n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+//
+// Created by frank on 17-6-15.
+//
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "base.h"
+#include "server.h"
+
+static server *add_server(array *servers, int port, const char **names);
+
+int main()
+{
+    mem_pool    *pool;
+    array       *servers;
+    listening   *ls80, *ls81;
+
+    const char *default_names[] = {NULL};
+    const char *a_names[] = {"a.com", "www.a.com", NULL};
+    const char *b_names[] = {".b.com", NULL};
+    const char *xb_names[] = {".x.b.com", "b.com", NULL};
+    const char *other_names[] = {"a.com", NULL};
+
+    pool = mem_pool_create(MEM_POOL_DEFAULT_SIZE);
+    assert(pool != NULL);
+    servers = array_create(pool, 8, sizeof(server));
+    assert(servers != NULL);
+
+    add_server(servers, 80, default_names);
+    add_server(servers, 80, a_names);
+    add_server(servers, 80, b_names);
+    add_server(servers, 80, xb_names);
+    add_server(servers, 81, other_names);
+
+    server_init(servers);
+    assert(listenings->size == 2);
+    ls80 = array_at(listenings, 0);
+    ls81 = array_at(listenings, 1);
+    assert(ls80->port == 80 && ls81->port == 81);
+
+    server *s0 = array_at(servers, 0), *sa = array_at(servers, 1);
+    server *sb = array_at(servers, 2), *sxb = array_at(servers, 3);
+    server *s81 = array_at(servers, 4);
+
+    /* 第一个server是默认的 */
+    assert(ls80->default_server == s0);
+    assert(server_find(ls80, "", 0) == s0);
+    assert(server_find(ls80, "none.com", 8) == s0);
+    assert(server_find(ls80, ":80", 3) == s0);
+
+    /* 精确匹配, 忽略大小写, 端口和结尾的'.' */
+    assert(server_find(ls80, "a.com", 5) == sa);
+    assert(server_find(ls80, "WWW.A.Com:8080", 14) == sa);
+    assert(server_find(ls80, "a.com.", 6) == sa);
+    assert(server_find(ls80, "aa.com", 6) == s0);
+
+    /* 通配, 最长的后缀优先, 精确匹配优先 */
+    assert(server_find(ls80, "y.b.com", 7) == sb);
+    assert(server_find(ls80, "y.x.b.com", 9) == sxb);
+    assert(server_find(ls80, "x.b.com", 7) == sb);
+    assert(server_find(ls80, "b.com", 5) == sxb);
+
+    /* 端口之间互不影响 */
+    assert(ls81->default_server == s81);
+    assert(server_find(ls81, "a.com", 5) == s81);
+    assert(server_find(ls81, "y.b.com", 7) == s81);
+
+    printf("test_server ok\n");
+    return 0;
+}
+
+static server *add_server(array *servers, int port, const char **names)
+{
+    server  *srv = array_alloc(servers);
+
+    assert(srv != NULL);
+    bzero(srv, sizeof(server));
+    srv->listen_on = port;
+    srv->names = array_create(servers->pool, 4, sizeof(string));
+    srv->locations = array_create(servers->pool, 1, sizeof(location));
+    assert(srv->names != NULL && srv->locations != NULL);
+
+    for (; *names != NULL; ++names) {
+        string *name = array_alloc(srv->names);
+        assert(name != NULL);
+        name->data = (char*)*names;
+        name->len = strlen(*names);
+    }
+    return srv;
+}